@@ -0,0 +1,290 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include "../Project/stb_image.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "../Project/CookManifest.h"
+#include "../Project/GltfLoader.h"
+#include "../Project/MeshCache.h"
+#include "../Project/Model.h"
+#include "../Project/TextureCook.h"
+#include "../Project/ThreadPool.h"
+
+using namespace std;
+
+// Offline cooker: builds everything the game would otherwise cook on first use and records it in
+// cache/manifest.txt. Run it from the game's working directory (or pass that directory).
+//   res/**/*.gltf            mesh cache, plus a texture record per material texture
+//   res/<dir>/right.* ...    cubemap when all six faces are there, in the order the game loads them,
+//                            and its image-based light (SH irradiance, GGX specular levels)
+//   res/images/*             sRGB colour textures
+//   shaders/*                hashed only, there is no offline shader format
+// Unchanged records are found by size and time alone, changed files are hashed and an asset is
+// only cooked again when its content hash moved.
+
+namespace
+{
+	const vector<string> CUBEMAP_FACES = { "right", "left", "top", "bottom", "front", "back" };
+	const uint32_t SHADER_RECORD_VERSION = 1;
+
+	enum class Outcome { Unchanged, Cooked, Failed };
+
+	struct CookResult {
+		CookRecord record;
+		Outcome outcome;
+	};
+
+	struct TextureJob {
+		string source;
+		TextureUsage usage;
+		bool gamma;
+	};
+
+	CookManifest previous;
+	// file_time_type ticks when the run began, outputs newer than this were cooked by it
+	int64_t runStart;
+
+	string textureKey(const TextureJob& job)
+	{
+		string tag = job.usage == TextureUsage::Normal ? "normal" : job.gamma ? "srgb" : "color";
+		return "texture " + tag + " " + job.source;
+	}
+
+	bool parseTextureKey(const string& key, TextureJob& job)
+	{
+		size_t kind = key.find(' '), tag = key.find(' ', kind + 1);
+		if (kind == string::npos || tag == string::npos || key.compare(0, kind, "texture") != 0)
+			return false;
+		string usage = key.substr(kind + 1, tag - kind - 1);
+		job = { key.substr(tag + 1), usage == "normal" ? TextureUsage::Normal : TextureUsage::Color, usage == "srgb" };
+		return true;
+	}
+
+	// Hashes sources, and runs cook unless the previous record has the same hash and its outputs are intact
+	CookResult cookAsset(const string& key, uint32_t version, const vector<string>& sources,
+		const vector<string>& outputs, const function<bool()>& cook)
+	{
+		const CookRecord* old = previous.find(key);
+		if (old && CookManifest::isUnchanged(*old))
+			return { *old, Outcome::Unchanged };
+
+		CookResult result = { {}, Outcome::Cooked };
+		result.record.key = key;
+		for (const string& source : sources)
+		{
+			CookedFile file;
+			if (!CookManifest::hashFile(source, file))
+			{
+				cout << "ERROR::COOKER:: Missing source " << source << " of " << key << endl;
+				result.outcome = Outcome::Failed;
+				return result;
+			}
+			result.record.inputs.push_back(file);
+		}
+		result.record.hash = CookManifest::recordHash(key, version, result.record.inputs);
+
+		// only the times moved (a checkout, a copy), the cooked data is still what these contents make
+		if (old && old->hash == result.record.hash)
+		{
+			CookRecord outputsOnly = *old;
+			outputsOnly.inputs.clear();
+			if (CookManifest::isUnchanged(outputsOnly))
+			{
+				result.record.outputs = old->outputs;
+				result.record.needs = old->needs;
+				result.outcome = Outcome::Unchanged;
+				return result;
+			}
+		}
+
+		if (!cook())
+			result.outcome = Outcome::Failed;
+		for (const string& output : outputs)
+		{
+			CookedFile file;
+			if (!CookManifest::statFile(output, file))
+				result.outcome = Outcome::Failed;
+			result.record.outputs.push_back(file);
+		}
+		if (result.outcome == Outcome::Failed)
+			cout << "ERROR::COOKER:: Couldn't cook " << key << endl;
+		return result;
+	}
+
+	CookResult cookModel(const string& path, ThreadPool& pool)
+	{
+		string key = "model flip " + path;
+		const CookRecord* old = previous.find(key);
+		if (old && CookManifest::isUnchanged(*old))
+			return { *old, Outcome::Unchanged };
+
+		// the buffers key the mesh cache too, so the JSON is parsed to find them
+		GltfScene gltf;
+		if (!gltf.open(path))
+		{
+			cout << "ERROR::COOKER:: " << gltf.error << endl;
+			CookRecord record = {};
+			record.key = key;
+			return { record, Outcome::Failed };
+		}
+		vector<string> sources = { path };
+		sources.insert(sources.end(), gltf.bufferPaths().begin(), gltf.bufferPaths().end());
+		gltf.close();
+
+		Model model;
+		CookResult result = cookAsset(key, MESH_CACHE_VERSION, sources, { MeshCache::cachePath(path) }, [&]() {
+			model.import(path, pool);
+			return true;
+		});
+		if (result.outcome == Outcome::Cooked)
+			for (const TextureRef& ref : model.importedTextures())
+				result.record.needs.push_back(textureKey({ ref.path, textureUsage(ref), model.gammaCorrection }));
+		return result;
+	}
+
+	CookResult cookTextureJob(const TextureJob& job)
+	{
+		string cooked = cookedTexturePath(job.source, job.usage, job.gamma);
+		return cookAsset(textureKey(job), TEXTURE_COOK_VERSION, { job.source }, { cooked }, [&]() {
+			// a model import earlier in this run may have cooked it already
+			CookedFile output;
+			if (CookManifest::statFile(cooked, output) && output.modified >= runStart)
+				return true;
+			return cookTexture(job.source, cooked, job.usage, job.gamma);
+		});
+	}
+
+	CookResult cookCubemapJob(const vector<string>& faces)
+	{
+		string directory = faces[0].substr(0, faces[0].find_last_of('/'));
+		string cooked = cookedCubemapPath(faces);
+		return cookAsset("cubemap bc1 " + directory, TEXTURE_COOK_VERSION, faces, { cooked }, [&]() {
+			return cookCubemap(faces, cooked);
+		});
+	}
+
+	CookResult cookEnvironmentJob(const vector<string>& faces, ThreadPool& pool)
+	{
+		string directory = faces[0].substr(0, faces[0].find_last_of('/'));
+		string cooked = cookedEnvironmentPath(faces);
+		return cookAsset("environment ggx " + directory, ENVIRONMENT_VERSION, faces, { cooked }, [&]() {
+			return cookEnvironment(faces, cooked, pool);
+		});
+	}
+
+	CookResult hashShader(const string& path)
+	{
+		return cookAsset("shader glsl " + path, SHADER_RECORD_VERSION, { path }, {}, []() { return true; });
+	}
+
+	string genericPath(const filesystem::path& path)
+	{
+		return path.generic_string();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	error_code ec;
+	if (argc > 1)
+		filesystem::current_path(argv[1], ec);
+	if (ec || !filesystem::is_directory("res"))
+	{
+		cout << "ERROR::COOKER:: Run from the directory holding res/ and shaders/, or pass it" << endl;
+		return 1;
+	}
+	auto start = chrono::steady_clock::now();
+	runStart = filesystem::file_time_type::clock::now().time_since_epoch().count();
+	previous.load(COOK_MANIFEST_PATH);
+
+	vector<string> models, shaders;
+	vector<vector<string>> cubemaps;
+	vector<TextureJob> images;
+	for (const auto& entry : filesystem::recursive_directory_iterator("res", ec))
+	{
+		if (entry.is_directory())
+		{
+			vector<string> faces;
+			for (const string& face : CUBEMAP_FACES)
+				for (const char* extension : { ".jpg", ".png" })
+					if (filesystem::is_regular_file(entry.path() / (face + extension)))
+					{
+						faces.push_back(genericPath(entry.path() / (face + extension)));
+						break;
+					}
+			if (faces.size() == CUBEMAP_FACES.size())
+				cubemaps.push_back(faces);
+			continue;
+		}
+		string path = genericPath(entry.path());
+		if (entry.path().extension() == ".gltf")
+			models.push_back(path);
+		else if (entry.path().parent_path() == filesystem::path("res") / "images")
+			images.push_back({ path, TextureUsage::Color, true });
+	}
+	for (const auto& entry : filesystem::recursive_directory_iterator("shaders", ec))
+		if (entry.is_regular_file())
+			shaders.push_back(genericPath(entry.path()));
+
+	ThreadPool pool;
+	CookManifest manifest;
+	size_t counts[3] = { 0, 0, 0 };
+	auto collect = [&](future<CookResult>& job) {
+		CookResult result = pool.wait(job);
+		counts[int(result.outcome)]++;
+		if (result.outcome == Outcome::Cooked)
+			cout << "Cooked " << result.record.key << endl;
+		if (result.outcome != Outcome::Failed)
+			manifest.set(result.record);
+		return result;
+	};
+
+	// models first, their records name the material textures cooked in the second pass
+	vector<future<CookResult>> jobs;
+	for (const string& path : models)
+		jobs.push_back(pool.submit([&pool, path]() { return cookModel(path, pool); }));
+	for (const vector<string>& faces : cubemaps)
+	{
+		jobs.push_back(pool.submit([faces]() { return cookCubemapJob(faces); }));
+		jobs.push_back(pool.submit([&pool, faces]() { return cookEnvironmentJob(faces, pool); }));
+	}
+	for (const string& path : shaders)
+		jobs.push_back(pool.submit([path]() { return hashShader(path); }));
+
+	map<string, TextureJob> textures;
+	for (const TextureJob& image : images)
+		textures[textureKey(image)] = image;
+	for (future<CookResult>& job : jobs)
+	{
+		CookResult result = collect(job);
+		TextureJob texture;
+		for (const string& key : result.record.needs)
+			if (parseTextureKey(key, texture))
+				textures[key] = texture;
+	}
+
+	jobs.clear();
+	for (const auto& texture : textures)
+	{
+		TextureJob job = texture.second;
+		jobs.push_back(pool.submit([job]() { return cookTextureJob(job); }));
+	}
+	for (future<CookResult>& job : jobs)
+		collect(job);
+
+	if (!manifest.save(COOK_MANIFEST_PATH))
+		return 1;
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << "Cooked " << counts[int(Outcome::Cooked)] << ", unchanged " << counts[int(Outcome::Unchanged)]
+		<< ", failed " << counts[int(Outcome::Failed)] << " of " << manifest.all().size() + counts[int(Outcome::Failed)]
+		<< " assets in " << seconds << " s on " << pool.size() + 1 << " threads" << endl;
+	return counts[int(Outcome::Failed)] ? 1 : 0;
+}
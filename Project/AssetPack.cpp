@@ -0,0 +1,354 @@
+#include "AssetPack.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+	const char PACK_MAGIC[4] = { 'A', 'P', 'A', 'K' };
+	const uint32_t COMPRESSION_NONE = 0;
+	const uint32_t COMPRESSION_LZ = 1;
+
+	struct PackHeader {
+		char     magic[4];
+		uint32_t version;
+		uint64_t entryCount;
+		uint64_t stringBytes;
+	};
+
+	static_assert(sizeof(AssetPack::Entry) == 48, "Entry layout changed, bump ASSET_PACK_VERSION");
+
+	// LZ77 in the LZ4 block layout: a token with literal/match length nibbles, the literals,
+	// a 16-bit back offset and length extension bytes. Fast to decode, modest ratio.
+	const size_t LZ_MIN_MATCH = 4;
+	const size_t LZ_HASH_BITS = 16;
+
+	uint32_t read32(const unsigned char* p)
+	{
+		uint32_t v;
+		memcpy(&v, p, 4);
+		return v;
+	}
+
+	void writeLength(vector<unsigned char>& out, size_t length)
+	{
+		for (; length >= 255; length -= 255)
+			out.push_back(255);
+		out.push_back((unsigned char)length);
+	}
+
+	void emitSequence(vector<unsigned char>& out, const unsigned char* literals, size_t literalCount, size_t offset, size_t matchLength)
+	{
+		size_t match = matchLength ? matchLength - LZ_MIN_MATCH : 0;
+		out.push_back((unsigned char)((min(literalCount, size_t(15)) << 4) | min(match, size_t(15))));
+		if (literalCount >= 15)
+			writeLength(out, literalCount - 15);
+		out.insert(out.end(), literals, literals + literalCount);
+		if (!matchLength)
+			return;
+		out.push_back((unsigned char)(offset & 0xFF));
+		out.push_back((unsigned char)(offset >> 8));
+		if (match >= 15)
+			writeLength(out, match - 15);
+	}
+
+	vector<unsigned char> lzCompress(const unsigned char* src, size_t size)
+	{
+		vector<unsigned char> out;
+		out.reserve(size / 2);
+		vector<uint32_t> table(size_t(1) << LZ_HASH_BITS, 0);
+		size_t anchor = 0, i = 0;
+		while (i + LZ_MIN_MATCH <= size)
+		{
+			uint32_t sequence = read32(src + i);
+			uint32_t slot = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+			// stored + 1 so zero means empty
+			size_t candidate = table[slot];
+			table[slot] = uint32_t(i + 1);
+			if (candidate == 0 || i + 1 - candidate > 65535 || read32(src + candidate - 1) != sequence)
+			{
+				i++;
+				continue;
+			}
+			candidate--;
+			size_t length = LZ_MIN_MATCH;
+			while (i + length < size && src[candidate + length] == src[i + length])
+				length++;
+			emitSequence(out, src + anchor, i - anchor, i - candidate, length);
+			i += length;
+			anchor = i;
+		}
+		emitSequence(out, src + anchor, size - anchor, 0, 0);
+		return out;
+	}
+
+	bool readLength(const unsigned char*& in, const unsigned char* end, size_t& length)
+	{
+		unsigned char byte;
+		do
+		{
+			if (in == end)
+				return false;
+			byte = *in++;
+			length += byte;
+		} while (byte == 255);
+		return true;
+	}
+
+	bool lzDecompress(const unsigned char* in, size_t inSize, unsigned char* out, size_t outSize)
+	{
+		const unsigned char* end = in + inSize;
+		size_t written = 0;
+		while (in < end)
+		{
+			unsigned char token = *in++;
+			size_t literals = token >> 4;
+			if (literals == 15 && !readLength(in, end, literals))
+				return false;
+			if (literals > size_t(end - in) || literals > outSize - written)
+				return false;
+			memcpy(out + written, in, literals);
+			in += literals;
+			written += literals;
+			// the last sequence carries literals only
+			if (in == end)
+				break;
+			if (end - in < 2)
+				return false;
+			size_t offset = in[0] | (in[1] << 8);
+			in += 2;
+			size_t length = token & 15;
+			if (length == 15 && !readLength(in, end, length))
+				return false;
+			length += LZ_MIN_MATCH;
+			if (offset == 0 || offset > written || length > outSize - written)
+				return false;
+			// byte by byte, matches may overlap their own output
+			for (size_t k = 0; k < length; k++, written++)
+				out[written] = out[written - offset];
+		}
+		return written == outSize;
+	}
+
+	bool shouldCompress(const string& key)
+	{
+		// already compressed, or meant to be uploaded straight from the mapping
+		static const char* stored[] = { ".png", ".jpg", ".jpeg", ".ktx" };
+		for (const char* extension : stored)
+		{
+			size_t length = strlen(extension);
+			if (key.size() >= length && key.compare(key.size() - length, length, extension) == 0)
+				return false;
+		}
+		return true;
+	}
+}
+
+string normalizeAssetPath(const string& path)
+{
+	vector<string> segments;
+	string segment;
+	for (size_t i = 0; i <= path.size(); i++)
+	{
+		char c = i < path.size() ? path[i] : '/';
+		if (c != '/' && c != '\\')
+		{
+			segment += (char)tolower((unsigned char)c);
+			continue;
+		}
+		if (segment == "..")
+		{
+			if (!segments.empty() && segments.back() != "..")
+				segments.pop_back();
+			else
+				segments.push_back(segment);
+		}
+		else if (!segment.empty() && segment != ".")
+			segments.push_back(segment);
+		segment.clear();
+	}
+	string key;
+	for (const string& s : segments)
+		key += (key.empty() ? "" : "/") + s;
+	return key;
+}
+
+AssetPack::AssetPack() : entries(nullptr), strings(nullptr), count(0)
+{
+}
+
+bool AssetPack::open(const string& path)
+{
+	close();
+	if (!file.open(path) || file.size() < sizeof(PackHeader))
+	{
+		file.close();
+		return false;
+	}
+	PackHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	size_t tocBytes = size_t(header.entryCount) * sizeof(Entry);
+	if (memcmp(header.magic, PACK_MAGIC, 4) != 0 || header.version != ASSET_PACK_VERSION
+		|| header.entryCount > file.size() / sizeof(Entry) || sizeof(PackHeader) + tocBytes + header.stringBytes > file.size())
+	{
+		cout << "ERROR::ASSET_PACK:: " << path << " is not a version " << ASSET_PACK_VERSION << " pack" << endl;
+		file.close();
+		return false;
+	}
+	entries = reinterpret_cast<const Entry*>(file.data() + sizeof(PackHeader));
+	strings = reinterpret_cast<const char*>(file.data() + sizeof(PackHeader) + tocBytes);
+
+	// a truncated pack is rejected as a whole rather than failing entry by entry later
+	for (size_t i = 0; i < header.entryCount; i++)
+		if (entries[i].path + uint64_t(entries[i].pathLength) > header.stringBytes
+			|| entries[i].offset + entries[i].storedSize > file.size()
+			|| (entries[i].compression == COMPRESSION_NONE && entries[i].storedSize != entries[i].size))
+		{
+			cout << "ERROR::ASSET_PACK:: " << path << " is truncated or corrupt" << endl;
+			close();
+			return false;
+		}
+	count = size_t(header.entryCount);
+	return true;
+}
+
+void AssetPack::close()
+{
+	file.close();
+	entries = nullptr;
+	strings = nullptr;
+	count = 0;
+}
+
+const AssetPack::Entry* AssetPack::find(const string& key) const
+{
+	// same order as string::operator< used when packing
+	auto compare = [this](const Entry& entry, const string& key) {
+		int order = memcmp(strings + entry.path, key.data(), min(size_t(entry.pathLength), key.size()));
+		return order < 0 || (order == 0 && entry.pathLength < key.size());
+	};
+	const Entry* end = entries + count;
+	const Entry* entry = lower_bound(entries, end, key, compare);
+	if (entry == end || entry->pathLength != key.size() || memcmp(strings + entry->path, key.data(), key.size()) != 0)
+		return nullptr;
+	return entry;
+}
+
+bool AssetPack::extract(const Entry& entry, vector<unsigned char>& out) const
+{
+	out.resize(size_t(entry.size));
+	if (entry.compression == COMPRESSION_NONE)
+	{
+		memcpy(out.data(), data(entry), out.size());
+		return true;
+	}
+	return entry.compression == COMPRESSION_LZ && lzDecompress(data(entry), size_t(entry.storedSize), out.data(), out.size());
+}
+
+bool writeAssetPack(const string& packPath, const vector<string>& roots)
+{
+	struct Source {
+		string key, path;
+	};
+	vector<Source> sources;
+	error_code ec;
+	for (const string& root : roots)
+		for (filesystem::recursive_directory_iterator it(root, ec), end; it != end; it.increment(ec))
+			if (it->is_regular_file(ec))
+			{
+				string path = it->path().generic_string();
+				sources.push_back({ normalizeAssetPath(path), path });
+			}
+	sort(sources.begin(), sources.end(), [](const Source& a, const Source& b) { return a.key < b.key; });
+	sources.erase(unique(sources.begin(), sources.end(), [](const Source& a, const Source& b) { return a.key == b.key; }), sources.end());
+
+	vector<AssetPack::Entry> toc(sources.size());
+	vector<char> blob;
+	for (size_t i = 0; i < sources.size(); i++)
+	{
+		toc[i] = {};
+		toc[i].path = uint32_t(blob.size());
+		toc[i].pathLength = uint32_t(sources[i].key.size());
+		blob.insert(blob.end(), sources[i].key.begin(), sources[i].key.end());
+	}
+
+	string tmpPath = packPath + ".tmp";
+	ofstream out(tmpPath, ios::binary | ios::trunc);
+	size_t payloadStart = sizeof(PackHeader) + toc.size() * sizeof(AssetPack::Entry) + blob.size();
+	size_t cursor = (payloadStart + ASSET_PACK_ALIGNMENT - 1) & ~(ASSET_PACK_ALIGNMENT - 1);
+	out.seekp(cursor);
+	size_t rawBytes = 0, packedBytes = 0;
+	for (size_t i = 0; i < sources.size(); i++)
+	{
+		// read the whole file; packing is an offline step
+		MappedFile source;
+		vector<unsigned char> stored;
+		AssetPack::Entry& entry = toc[i];
+		entry.modified = filesystem::last_write_time(sources[i].path, ec).time_since_epoch().count();
+		if (source.open(sources[i].path))
+		{
+			entry.size = source.size();
+			vector<unsigned char> compressed;
+			if (shouldCompress(sources[i].key))
+				compressed = lzCompress(source.data(), source.size());
+			if (!compressed.empty() && compressed.size() <= source.size() - source.size() / 8)
+			{
+				entry.compression = COMPRESSION_LZ;
+				stored.swap(compressed);
+			}
+			else
+				stored.assign(source.data(), source.data() + source.size());
+		}
+		// mapping fails on empty files too, those are real 0-byte entries; anything else would hide
+		// the loose file behind an empty one
+		else if (filesystem::file_size(sources[i].path, ec) != 0 || ec)
+		{
+			cout << "ERROR::ASSET_PACK:: Couldn't read " << sources[i].path << endl;
+			out.close();
+			filesystem::remove(tmpPath, ec);
+			return false;
+		}
+		entry.offset = cursor;
+		entry.storedSize = stored.size();
+		out.write((const char*)stored.data(), stored.size());
+		cursor += stored.size();
+		size_t aligned = (cursor + ASSET_PACK_ALIGNMENT - 1) & ~(ASSET_PACK_ALIGNMENT - 1);
+		for (; cursor < aligned; cursor++)
+			out.put('\0');
+		rawBytes += size_t(entry.size);
+		packedBytes += stored.size();
+	}
+
+	PackHeader header;
+	memcpy(header.magic, PACK_MAGIC, 4);
+	header.version = ASSET_PACK_VERSION;
+	header.entryCount = toc.size();
+	header.stringBytes = blob.size();
+	out.seekp(0);
+	out.write((const char*)&header, sizeof(header));
+	out.write((const char*)toc.data(), toc.size() * sizeof(AssetPack::Entry));
+	out.write(blob.data(), blob.size());
+	out.close();
+	if (!out)
+	{
+		cout << "ERROR::ASSET_PACK:: Couldn't write " << tmpPath << endl;
+		filesystem::remove(tmpPath, ec);
+		return false;
+	}
+	filesystem::remove(packPath, ec);
+	filesystem::rename(tmpPath, packPath, ec);
+	if (ec)
+	{
+		cout << "ERROR::ASSET_PACK:: Couldn't replace " << packPath << endl;
+		return false;
+	}
+	cout << "Packed " << toc.size() << " files into " << packPath << ": " << rawBytes / (1024.0 * 1024.0) << " MiB -> "
+		<< packedBytes / (1024.0 * 1024.0) << " MiB" << endl;
+	return true;
+}
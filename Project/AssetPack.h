@@ -0,0 +1,61 @@
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+using namespace std;
+
+const uint32_t ASSET_PACK_VERSION = 1;
+// payload alignment, enough for any GL upload straight out of the mapping
+const size_t ASSET_PACK_ALIGNMENT = 64;
+
+// One archive holding many asset files, read through a single mapping.
+// Layout: header, table of contents sorted by path, path strings, 64-byte aligned payloads.
+class AssetPack
+{
+public:
+    struct Entry {
+        uint64_t offset;
+        uint64_t size;          // bytes once extracted
+        uint64_t storedSize;    // bytes in the pack, equals size unless compressed
+        int64_t  modified;      // source file_time_type ticks when packed
+        uint32_t path;
+        uint32_t pathLength;
+        uint32_t compression;   // 0 stored, 1 LZ
+        uint32_t reserved;
+    };
+
+    AssetPack();
+
+    bool open(const string& path);
+    void close();
+    bool isOpen() const { return file.isOpen(); }
+
+    // Binary search of the table of contents, key as made by normalizeAssetPath
+    const Entry* find(const string& key) const;
+    // Payload inside the mapping, only meaningful for stored entries
+    const unsigned char* data(const Entry& entry) const { return file.data() + entry.offset; }
+    // Decompresses (or copies) an entry, false if the payload is corrupt
+    bool extract(const Entry& entry, vector<unsigned char>& out) const;
+
+    size_t entryCount() const { return count; }
+
+private:
+    MappedFile file;
+    const Entry* entries;
+    const char* strings;
+    size_t count;
+};
+
+// Lookup key of a path: forward slashes, lower case, "." and ".." segments resolved
+string normalizeAssetPath(const string& path);
+
+// Packs every file under roots (paths relative to the working directory) into packPath.
+// Entries are compressed when that saves at least an eighth, KTX stays stored so it can be uploaded in place.
+bool writeAssetPack(const string& packPath, const vector<string>& roots);
+
+#endif
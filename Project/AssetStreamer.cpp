@@ -0,0 +1,63 @@
+#include "AssetStreamer.h"
+#include "GeometryArena.h"
+
+#include <iostream>
+
+using namespace std;
+
+AssetStreamer::AssetStreamer(ThreadPool& pool, size_t uploadBudget) : uploadBudget(uploadBudget), pool(pool), lastFrameBytes(0)
+{
+}
+
+AssetStreamer::~AssetStreamer()
+{
+	for (Request& request : requests)
+		if (!request.imported)
+			pool.wait(request.import);
+}
+
+void AssetStreamer::request(Model& model, const string& path, const string& name, bool isUV_flipped)
+{
+	if (requests.empty())
+		busySince = chrono::steady_clock::now();
+	Model* target = &model;
+	ThreadPool* workers = &pool;
+	requests.push_back({ target, name, pool.submit([target, workers, path, isUV_flipped]() {
+		target->import(path, *workers, isUV_flipped);
+	}), false });
+}
+
+void AssetStreamer::update()
+{
+	lastFrameBytes = 0;
+	if (requests.empty())
+		return;
+
+	// finished imports upload in request order; one that isn't ready doesn't hold back the rest
+	for (auto it = requests.begin(); it != requests.end() && lastFrameBytes < uploadBudget;)
+	{
+		if (!it->imported)
+		{
+			if (it->import.wait_for(chrono::seconds(0)) != future_status::ready)
+			{
+				++it;
+				continue;
+			}
+			it->import.get();
+			it->imported = true;
+		}
+		lastFrameBytes += it->model->uploadStep(uploadBudget - lastFrameBytes, lastFrameBytes == 0);
+		if (!it->model->isResident())
+			break;
+		it->model->printMemoryReport(it->name);
+		it = requests.erase(it);
+	}
+
+	if (requests.empty())
+	{
+		Model::importStats.print(chrono::duration<double>(chrono::steady_clock::now() - busySince).count());
+		// the proxies of the models just finished freed their ranges
+		GeometryArena::instance().compactIfFragmented();
+		GeometryArena::instance().printReport();
+	}
+}
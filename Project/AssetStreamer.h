@@ -0,0 +1,49 @@
+#ifndef ASSET_STREAMER_H
+#define ASSET_STREAMER_H
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <string>
+
+#include "Model.h"
+#include "ThreadPool.h"
+using namespace std;
+
+// Imports models on the worker pool and uploads them on the GL thread a slice per frame,
+// so a late load costs at most uploadBudget bytes of GPU transfers in any one frame.
+// Models draw their bounding-sphere proxy until they are resident.
+class AssetStreamer
+{
+public:
+    size_t uploadBudget;
+
+    AssetStreamer(ThreadPool& pool, size_t uploadBudget = 8 * 1024 * 1024);
+    // waits for imports still in flight, they write into the models
+    ~AssetStreamer();
+    AssetStreamer(const AssetStreamer&) = delete;
+    AssetStreamer& operator=(const AssetStreamer&) = delete;
+
+    // Starts importing path into model and returns immediately, name is used in the reports
+    void request(Model& model, const string& path, const string& name, bool isUV_flipped = true);
+    // Once per frame on the GL thread: uploads imported models, oldest request first
+    void update();
+    bool idle() const { return requests.empty(); }
+    size_t uploadedLastFrame() const { return lastFrameBytes; }
+
+private:
+    struct Request {
+        Model* model;
+        string name;
+        future<void> import;
+        bool imported;
+    };
+
+    ThreadPool& pool;
+    deque<Request> requests;
+    size_t lastFrameBytes;
+    chrono::steady_clock::time_point busySince;
+};
+
+#endif
@@ -0,0 +1,180 @@
+#include "CookManifest.h"
+#include "AssetPack.h"
+#include "MappedFile.h"
+#include "VirtualFileSystem.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+namespace
+{
+	// the rest of the line after the fields already read, paths may contain spaces
+	string restOfLine(istringstream& line)
+	{
+		string rest;
+		getline(line >> ws, rest);
+		return rest;
+	}
+}
+
+CookManifest::CookManifest()
+{
+}
+
+CookManifest& CookManifest::instance()
+{
+	static CookManifest manifest;
+	return manifest;
+}
+
+bool CookManifest::load(const string& path)
+{
+	records.clear();
+	vouched.clear();
+	ifstream in(path);
+	string text;
+	uint32_t version = 0;
+	if (!in || !(in >> text >> version) || text != "cook-manifest" || version != COOK_MANIFEST_VERSION)
+		return false;
+
+	CookRecord* record = nullptr;
+	string row;
+	while (getline(in, row))
+	{
+		istringstream line(row);
+		string tag;
+		if (!(line >> tag))
+			continue;
+		CookedFile file = {};
+		if (tag == "record")
+		{
+			CookRecord next = {};
+			line >> hex >> next.hash >> dec;
+			next.key = restOfLine(line);
+			record = &records[next.key];
+			*record = next;
+		}
+		else if (!record)
+			return false;
+		else if (tag == "in" && line >> hex >> file.hash >> dec >> file.size >> file.modified)
+		{
+			file.path = restOfLine(line);
+			record->inputs.push_back(file);
+		}
+		else if (tag == "out" && line >> file.size >> file.modified)
+		{
+			file.path = restOfLine(line);
+			record->outputs.push_back(file);
+		}
+		else if (tag == "needs")
+			record->needs.push_back(restOfLine(line));
+		else
+		{
+			cout << "ERROR::COOK_MANIFEST:: Malformed line in " << path << ": " << row << endl;
+			records.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CookManifest::save(const string& path) const
+{
+	string tmpPath = path + ".tmp";
+	error_code ec;
+	filesystem::create_directories(filesystem::path(path).parent_path(), ec);
+	{
+		ofstream out(tmpPath, ios::trunc);
+		out << "cook-manifest " << COOK_MANIFEST_VERSION << "\n";
+		for (const auto& item : records)
+		{
+			const CookRecord& record = item.second;
+			out << "record " << hex << record.hash << dec << " " << record.key << "\n";
+			for (const CookedFile& file : record.inputs)
+				out << "in " << hex << file.hash << dec << " " << file.size << " " << file.modified << " " << file.path << "\n";
+			for (const CookedFile& file : record.outputs)
+				out << "out " << file.size << " " << file.modified << " " << file.path << "\n";
+			for (const string& key : record.needs)
+				out << "needs " << key << "\n";
+		}
+		if (!out)
+		{
+			cout << "ERROR::COOK_MANIFEST:: Couldn't write " << tmpPath << endl;
+			return false;
+		}
+	}
+	filesystem::rename(tmpPath, path, ec);
+	return !ec;
+}
+
+const CookRecord* CookManifest::find(const string& key) const
+{
+	auto record = records.find(key);
+	return record == records.end() ? nullptr : &record->second;
+}
+
+void CookManifest::set(const CookRecord& record)
+{
+	records[record.key] = record;
+}
+
+size_t CookManifest::validate()
+{
+	vouched.clear();
+	size_t current = 0;
+	for (const auto& item : records)
+	{
+		if (!isUnchanged(item.second))
+			continue;
+		for (const CookedFile& file : item.second.outputs)
+			vouched.insert(normalizeAssetPath(file.path));
+		current++;
+	}
+	return current;
+}
+
+bool CookManifest::vouchesFor(const string& path) const
+{
+	return !vouched.empty() && vouched.count(normalizeAssetPath(path)) != 0;
+}
+
+bool CookManifest::isUnchanged(const CookRecord& record)
+{
+	CookedFile now;
+	for (const CookedFile& file : record.inputs)
+		if (!statFile(file.path, now) || now.size != file.size || now.modified != file.modified)
+			return false;
+	for (const CookedFile& file : record.outputs)
+		if (!statFile(file.path, now) || now.size != file.size || now.modified != file.modified)
+			return false;
+	return true;
+}
+
+bool CookManifest::statFile(const string& path, CookedFile& file)
+{
+	file.path = path;
+	file.hash = 0;
+	return VirtualFileSystem::instance().stat(path, file.size, file.modified);
+}
+
+bool CookManifest::hashFile(const string& path, CookedFile& file)
+{
+	AssetFile contents;
+	if (!statFile(path, file) || !VirtualFileSystem::instance().open(path, contents))
+		return false;
+	file.hash = hashBytes(contents.data(), contents.size());
+	return true;
+}
+
+uint64_t CookManifest::recordHash(const string& key, uint32_t version, const vector<CookedFile>& inputs)
+{
+	uint64_t hash = hashBytes(key.data(), key.size());
+	hash = hashBytes(&version, sizeof(version), hash);
+	for (const CookedFile& file : inputs)
+		hash = hashBytes(&file.hash, sizeof(file.hash), hash);
+	return hash;
+}
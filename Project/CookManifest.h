@@ -0,0 +1,64 @@
+#ifndef COOK_MANIFEST_H
+#define COOK_MANIFEST_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+using namespace std;
+
+const uint32_t COOK_MANIFEST_VERSION = 1;
+const char* const COOK_MANIFEST_PATH = "cache/manifest.txt";
+
+// A file as the cooker last saw it
+struct CookedFile {
+    string path;
+    uint64_t size;
+    int64_t modified;   // file_time_type ticks
+    uint64_t hash;      // contents, only kept for inputs
+};
+
+// One cooked asset: what it was built from and what it produced
+struct CookRecord {
+    string key;             // "<kind> <settings> <source>", e.g. "texture srgb res/images/box.png"
+    uint64_t hash;          // the key, the cook version and the contents of every input
+    vector<CookedFile> inputs;
+    vector<CookedFile> outputs;
+    vector<string> needs;   // keys of records cooked from files this asset references
+};
+
+// Written by the cooker next to the cooked data. At startup the runtime checks every record
+// against the files on disk (sizes and times, nothing is read) and skips its own staleness
+// checks for outputs whose record still holds. Load and validate before any loading starts.
+class CookManifest
+{
+public:
+    CookManifest();
+    static CookManifest& instance();
+
+    bool load(const string& path);
+    bool save(const string& path) const;
+
+    const CookRecord* find(const string& key) const;
+    void set(const CookRecord& record);
+    const map<string, CookRecord>& all() const { return records; }
+
+    // Runtime: stats the inputs and outputs of every record, returns how many still hold
+    size_t validate();
+    // path was written by a cook whose record validate() found current
+    bool vouchesFor(const string& path) const;
+
+    // every input and output still has the size and time the record saw
+    static bool isUnchanged(const CookRecord& record);
+    static bool statFile(const string& path, CookedFile& file);
+    // statFile plus the hash of the contents
+    static bool hashFile(const string& path, CookedFile& file);
+    static uint64_t recordHash(const string& key, uint32_t version, const vector<CookedFile>& inputs);
+
+private:
+    map<string, CookRecord> records;
+    unordered_set<string> vouched;  // normalized output paths
+};
+
+#endif
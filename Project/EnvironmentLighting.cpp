@@ -0,0 +1,102 @@
+#include "EnvironmentLighting.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+	const UniformHandle<bool> litUniform("environmentLit");
+	const UniformHandle<int> specularUniform("environmentSpecular");
+	const UniformHandle<float> maxLevelUniform("environmentMaxLevel");
+	const UniformHandle<float> intensityUniform("environmentIntensity");
+
+	const UniformHandle<glm::vec3>& shUniform(int i)
+	{
+		static const UniformHandle<glm::vec3> coefficients[9] = {
+			UniformHandle<glm::vec3>("environmentSH[0]"), UniformHandle<glm::vec3>("environmentSH[1]"),
+			UniformHandle<glm::vec3>("environmentSH[2]"), UniformHandle<glm::vec3>("environmentSH[3]"),
+			UniformHandle<glm::vec3>("environmentSH[4]"), UniformHandle<glm::vec3>("environmentSH[5]"),
+			UniformHandle<glm::vec3>("environmentSH[6]"), UniformHandle<glm::vec3>("environmentSH[7]"),
+			UniformHandle<glm::vec3>("environmentSH[8]") };
+		return coefficients[i];
+	}
+}
+
+EnvironmentLighting::EnvironmentLighting(ThreadPool& pool) : intensity(1.0f), pool(pool), ready(false), header(nullptr),
+	sh(), levels(0), specular(0)
+{
+}
+
+EnvironmentLighting::~EnvironmentLighting()
+{
+	// a worker may still be cooking into the mapping
+	if (opening.valid())
+		pool.wait(opening);
+	if (specular)
+		glDeleteTextures(1, &specular);
+}
+
+void EnvironmentLighting::open(const vector<string>& faces)
+{
+	if (opening.valid() || ready)
+		return;
+	opening = pool.submit([this, faces]() {
+		return loadCookedEnvironment(faces, pool, file, header);
+	});
+}
+
+void EnvironmentLighting::update()
+{
+	if (ready || !opening.valid() || opening.wait_for(chrono::seconds(0)) != future_status::ready)
+		return;
+	if (!opening.get())
+	{
+		cout << "ERROR::ENVIRONMENT_LIGHTING:: No environment, lights keep their ambient terms" << endl;
+		return;
+	}
+
+	glGenTextures(1, &specular);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, specular);
+	const unsigned char* data = file.data() + sizeof(EnvironmentFileHeader);
+	for (unsigned int level = 0; level < header->levels; level++)
+	{
+		GLsizei size = max(header->size >> level, 1u);
+		for (unsigned int face = 0; face < 6; face++)
+		{
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB16F, size, size, 0, GL_RGB, GL_HALF_FLOAT, data);
+			data += size_t(size) * size * 3 * sizeof(uint16_t);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, header->levels - 1);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	// the GL copy is all that's needed from here on
+	copy(&header->sh[0][0], &header->sh[0][0] + 27, &sh[0][0]);
+	levels = header->levels;
+	header = nullptr;
+	file.close();
+	ready = true;
+	cout << "Environment lighting: " << levels << " specular levels" << endl;
+}
+
+void EnvironmentLighting::bind(Shader* shader, unsigned int unit) const
+{
+	shader->set(litUniform, ready);
+	if (!ready)
+		return;
+	for (int i = 0; i < 9; i++)
+		shader->set(shUniform(i), glm::vec3(sh[i][0], sh[i][1], sh[i][2]));
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, specular);
+	glActiveTexture(GL_TEXTURE0);
+	shader->set(specularUniform, int(unit));
+	shader->set(maxLevelUniform, float(levels - 1));
+	shader->set(intensityUniform, intensity);
+}
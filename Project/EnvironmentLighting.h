@@ -0,0 +1,47 @@
+#ifndef ENVIRONMENT_LIGHTING_H
+#define ENVIRONMENT_LIGHTING_H
+
+#include <future>
+#include <string>
+#include <vector>
+
+#include "Shader.h"
+#include "TextureCook.h"
+#include "ThreadPool.h"
+using namespace std;
+
+// Image-based light of the skybox, precomputed by cookEnvironment: nine SH coefficients for the
+// diffuse term and a GGX-prefiltered cubemap whose levels go from mirror to rough. Shaders pay a
+// few multiplies and one textureLod for it. GL thread only.
+class EnvironmentLighting
+{
+public:
+    float intensity;
+
+    EnvironmentLighting(ThreadPool& pool);
+    ~EnvironmentLighting();
+    EnvironmentLighting(const EnvironmentLighting&) = delete;
+    EnvironmentLighting& operator=(const EnvironmentLighting&) = delete;
+
+    // Cooks (if stale) and maps the environment on the pool, a later update() uploads it
+    void open(const vector<string>& faces);
+    bool isReady() const { return ready; }
+    // Once per frame until ready
+    void update();
+
+    // Sets the environment* uniforms and binds the specular cubemap to unit; the shader falls back
+    // to its lights' ambient terms while the cook is still running
+    void bind(Shader* shader, unsigned int unit) const;
+
+private:
+    ThreadPool& pool;
+    future<bool> opening;
+    bool ready;
+    AssetFile file;
+    const EnvironmentFileHeader* header;
+    float sh[9][3];
+    unsigned int levels;
+    unsigned int specular;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#include "GLExtensions.h"
+
+#include <GLFW/glfw3.h>
+
+#include <cstring>
+#include <map>
+#include <string>
+
+bool hasGLExtension(const char* name)
+{
+	static std::map<std::string, bool> known;
+	auto cached = known.find(name);
+	if (cached != known.end())
+		return cached->second;
+
+	bool found = false;
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count && !found; i++)
+	{
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		found = extension && strcmp(extension, name) == 0;
+	}
+	known[name] = found;
+	return found;
+}
+
+void* getGLProcAddress(const char* name)
+{
+	return (void*)glfwGetProcAddress(name);
+}
@@ -0,0 +1,39 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+
+// The bundled glad loader only covers core 3.3, extension tokens live here
+
+// EXT_texture_compression_s3tc / EXT_texture_sRGB
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT         0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT        0x83F3
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT        0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT  0x8C4F
+
+// ARB_buffer_storage
+#define GL_MAP_PERSISTENT_BIT                   0x0040
+#define GL_MAP_COHERENT_BIT                     0x0080
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// ARB_shader_storage_buffer_object (core in 4.3)
+#define GL_SHADER_STORAGE_BUFFER                0x90D2
+
+// ARB_get_program_binary (core in 4.1)
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT      0x8257
+#define GL_PROGRAM_BINARY_LENGTH                0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS           0x87FE
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+
+// KHR_parallel_shader_compile / ARB_parallel_shader_compile, same token under both names
+#define GL_COMPLETION_STATUS_KHR                0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+// Must be called with a current context, the result is cached per name
+bool hasGLExtension(const char* name);
+// Entry point through the window system's loader, nullptr if the driver doesn't export it
+void* getGLProcAddress(const char* name);
+
+#endif
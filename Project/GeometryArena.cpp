@@ -0,0 +1,303 @@
+#include "GeometryArena.h"
+#include "Mesh.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+	// a pool starts this large and doubles from there
+	const size_t INITIAL_BYTES[GEOMETRY_BUFFER_COUNT] = { 8 * 1024 * 1024, 4 * 1024 * 1024, 64 * 1024 };
+	// ranges start on whole elements: a packed vertex (so the offset is the base vertex),
+	// four index bytes (16-bit indices come in pairs), a placement matrix
+	const size_t ELEMENT_SIZES[GEOMETRY_BUFFER_COUNT] = { sizeof(PackedVertex), sizeof(unsigned int), sizeof(glm::mat4) };
+
+	// adds a free range, merged with the ranges right before and after it
+	void addFree(map<size_t, size_t>& free, size_t offset, size_t count)
+	{
+		auto next = free.lower_bound(offset);
+		if (next != free.end() && offset + count == next->first)
+		{
+			count += next->second;
+			next = free.erase(next);
+		}
+		if (next != free.begin())
+		{
+			auto previous = prev(next);
+			if (previous->first + previous->second == offset)
+			{
+				previous->second += count;
+				return;
+			}
+		}
+		free[offset] = count;
+	}
+}
+
+GeometryArena::GeometryArena() : boundFormat(VERTEX_FORMAT_COUNT), compactions(0)
+{
+	for (int b = 0; b < GEOMETRY_BUFFER_COUNT; b++)
+	{
+		pools[b].id = 0;
+		pools[b].elementSize = ELEMENT_SIZES[b];
+		pools[b].capacity = 0;
+		pools[b].used = 0;
+	}
+	for (int f = 0; f < VERTEX_FORMAT_COUNT; f++)
+		vertexArrays[f] = 0;
+}
+
+GeometryArena& GeometryArena::instance()
+{
+	static GeometryArena arena;
+	return arena;
+}
+
+unsigned int GeometryArena::allocate(GeometryBuffer buffer, const void* data, size_t bytes)
+{
+	// every buffer exists before the vertex arrays point into them
+	if (!vertexArrays[0])
+	{
+		for (int b = 0; b < GEOMETRY_BUFFER_COUNT; b++)
+		{
+			reallocate(GeometryBuffer(b), INITIAL_BYTES[b] / pools[b].elementSize, vector<Move>());
+			addFree(pools[b].free, 0, pools[b].capacity);
+		}
+		specifyFormats();
+	}
+
+	Pool& pool = pools[buffer];
+	size_t count = max((bytes + pool.elementSize - 1) / pool.elementSize, size_t(1));
+	size_t offset = reserve(buffer, count);
+	if (bytes)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, pool.id);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, offset * pool.elementSize, bytes, data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	unsigned int handle;
+	if (!freeHandles.empty())
+	{
+		handle = freeHandles.back();
+		freeHandles.pop_back();
+	}
+	else
+	{
+		allocations.emplace_back();
+		handle = (unsigned int)allocations.size();
+	}
+	allocations[handle - 1] = { buffer, offset, count, true };
+	return handle;
+}
+
+void GeometryArena::free(unsigned int allocation)
+{
+	if (!allocation || !allocations[allocation - 1].live)
+		return;
+	Allocation& a = allocations[allocation - 1];
+	release(a.buffer, a.offset, a.count);
+	a.live = false;
+	freeHandles.push_back(allocation);
+}
+
+size_t GeometryArena::offset(unsigned int allocation) const
+{
+	const Allocation& a = allocations[allocation - 1];
+	return a.offset * pools[a.buffer].elementSize;
+}
+
+size_t GeometryArena::bytes(unsigned int allocation) const
+{
+	const Allocation& a = allocations[allocation - 1];
+	return a.count * pools[a.buffer].elementSize;
+}
+
+void GeometryArena::bind(VertexFormat format)
+{
+	if (format == boundFormat)
+		return;
+	glBindVertexArray(vertexArrays[format]);
+	boundFormat = format;
+}
+
+void GeometryArena::bindInstances(unsigned int allocation)
+{
+	bind(VERTEX_FORMAT_PACKED_INSTANCED);
+	size_t base = offset(allocation);
+	glBindBuffer(GL_ARRAY_BUFFER, pools[GEOMETRY_INSTANCES].id);
+	for (unsigned int column = 0; column < 4; column++)
+		glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(base + column * sizeof(glm::vec4)));
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+size_t GeometryArena::reserve(GeometryBuffer buffer, size_t count)
+{
+	Pool& pool = pools[buffer];
+	for (auto block = pool.free.begin(); block != pool.free.end(); ++block)
+	{
+		if (block->second < count)
+			continue;
+		size_t offset = block->first, rest = block->second - count;
+		pool.free.erase(block);
+		if (rest)
+			pool.free[offset + count] = rest;
+		pool.used += count;
+		return offset;
+	}
+
+	// nothing fits: double until it does, the new space joins the free tail
+	size_t capacity = pool.capacity;
+	while (capacity < pool.capacity + count)
+		capacity *= 2;
+	size_t oldCapacity = pool.capacity;
+	reallocate(buffer, capacity, vector<Move>(1, { 0, 0, oldCapacity }));
+	addFree(pool.free, oldCapacity, capacity - oldCapacity);
+	return reserve(buffer, count);
+}
+
+void GeometryArena::release(GeometryBuffer buffer, size_t offset, size_t count)
+{
+	addFree(pools[buffer].free, offset, count);
+	pools[buffer].used -= count;
+}
+
+void GeometryArena::reallocate(GeometryBuffer buffer, size_t capacity, const vector<Move>& moves)
+{
+	Pool& pool = pools[buffer];
+	unsigned int id;
+	glGenBuffers(1, &id);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+	glBufferData(GL_COPY_WRITE_BUFFER, capacity * pool.elementSize, nullptr, GL_STATIC_DRAW);
+	if (pool.id)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, pool.id);
+		for (const Move& move : moves)
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+				move.from * pool.elementSize, move.to * pool.elementSize, move.count * pool.elementSize);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glDeleteBuffers(1, &pool.id);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	pool.id = id;
+	pool.capacity = capacity;
+	// the vertex arrays still point at the old buffer
+	if (vertexArrays[0])
+		specifyFormats();
+}
+
+void GeometryArena::specifyFormats()
+{
+	if (!vertexArrays[0])
+		glGenVertexArrays(VERTEX_FORMAT_COUNT, vertexArrays);
+	for (int f = 0; f < VERTEX_FORMAT_COUNT; f++)
+	{
+		glBindVertexArray(vertexArrays[f]);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pools[GEOMETRY_INDICES].id);
+		glBindBuffer(GL_ARRAY_BUFFER, pools[GEOMETRY_VERTICES].id);
+		// vertex positions + tangent handedness
+		glVertexAttribPointer(0, 4, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)0);
+		glEnableVertexAttribArray(0);
+		// octahedral normal (xy) and tangent (zw)
+		glVertexAttribPointer(1, 4, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Frame));
+		glEnableVertexAttribArray(1);
+		// vertex texture coords
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, TexCoords));
+		glEnableVertexAttribArray(2);
+
+		// per-instance placement, one mat4 over four attribute slots, bindInstances() moves it
+		if (f == VERTEX_FORMAT_PACKED_INSTANCED)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, pools[GEOMETRY_INSTANCES].id);
+			for (unsigned int column = 0; column < 4; column++)
+			{
+				glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(column * sizeof(glm::vec4)));
+				glEnableVertexAttribArray(3 + column);
+				glVertexAttribDivisor(3 + column, 1);
+			}
+		}
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	boundFormat = VERTEX_FORMAT_COUNT;
+}
+
+void GeometryArena::compact()
+{
+	for (int b = 0; b < GEOMETRY_BUFFER_COUNT; b++)
+	{
+		// live ranges in buffer order, packed from the front
+		vector<Allocation*> live;
+		for (Allocation& allocation : allocations)
+			if (allocation.live && allocation.buffer == b)
+				live.push_back(&allocation);
+		sort(live.begin(), live.end(), [](const Allocation* x, const Allocation* y) { return x->offset < y->offset; });
+		vector<Move> moves;
+		size_t next = 0;
+		for (Allocation* allocation : live)
+		{
+			// neighbours that stay neighbours go over in one copy
+			if (!moves.empty() && moves.back().from + moves.back().count == allocation->offset)
+				moves.back().count += allocation->count;
+			else
+				moves.push_back({ allocation->offset, next, allocation->count });
+			allocation->offset = next;
+			next += allocation->count;
+		}
+
+		// a quarter of headroom so the next load doesn't grow it right away
+		Pool& pool = pools[b];
+		size_t capacity = max(INITIAL_BYTES[b] / pool.elementSize, next + next / 4);
+		reallocate(GeometryBuffer(b), capacity, moves);
+		pool.free.clear();
+		addFree(pool.free, next, capacity - next);
+	}
+	compactions++;
+}
+
+bool GeometryArena::compactIfFragmented(float maxWaste)
+{
+	for (const Pool& pool : pools)
+	{
+		// free space before the tail is lost to holes
+		size_t holes = pool.capacity - pool.used;
+		if (!pool.free.empty() && prev(pool.free.end())->first + prev(pool.free.end())->second == pool.capacity)
+			holes -= prev(pool.free.end())->second;
+		if (holes > maxWaste * pool.capacity)
+		{
+			compact();
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t GeometryArena::capacityBytes() const
+{
+	size_t total = 0;
+	for (const Pool& pool : pools)
+		total += pool.capacity * pool.elementSize;
+	return total;
+}
+
+size_t GeometryArena::usedBytes() const
+{
+	size_t total = 0;
+	for (const Pool& pool : pools)
+		total += pool.used * pool.elementSize;
+	return total;
+}
+
+void GeometryArena::printReport() const
+{
+	const char* names[GEOMETRY_BUFFER_COUNT] = { "vertices", "indices", "instances" };
+	cout << "Geometry arena: " << usedBytes() / (1024.0 * 1024.0) << " MiB used of " << capacityBytes() / (1024.0 * 1024.0)
+		<< " MiB in " << allocations.size() - freeHandles.size() << " ranges, " << compactions << " compactions" << endl;
+	for (int b = 0; b < GEOMETRY_BUFFER_COUNT; b++)
+		cout << "  " << names[b] << ": " << pools[b].used * pools[b].elementSize / 1024.0 << " of "
+			<< pools[b].capacity * pools[b].elementSize / 1024.0 << " KiB, " << pools[b].free.size() << " free ranges" << endl;
+}
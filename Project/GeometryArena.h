@@ -0,0 +1,87 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+// Buffers the arena suballocates from, each in units of its own element
+enum GeometryBuffer { GEOMETRY_VERTICES, GEOMETRY_INDICES, GEOMETRY_INSTANCES, GEOMETRY_BUFFER_COUNT };
+
+// Vertex layouts over the shared buffers, one vertex array object each
+enum VertexFormat { VERTEX_FORMAT_PACKED, VERTEX_FORMAT_PACKED_INSTANCED, VERTEX_FORMAT_COUNT };
+
+// Process-wide vertex, index and instance buffers every Mesh lives in. Ranges come from a first-fit
+// free list that merges neighbours on free; a buffer that runs out doubles and copies itself over
+// on the GPU. Meshes draw with a base vertex, so switching meshes costs no vertex array change.
+// Allocations are handles, compact() may move what they point to. GL thread only.
+class GeometryArena
+{
+public:
+    static GeometryArena& instance();
+
+    // Copies bytes of data into a new range of buffer, returns its handle (never 0)
+    unsigned int allocate(GeometryBuffer buffer, const void* data, size_t bytes);
+    void free(unsigned int allocation);
+    // byte offset of an allocation in its buffer, valid until the next compact()
+    size_t offset(unsigned int allocation) const;
+    size_t bytes(unsigned int allocation) const;
+
+    // Binds the vertex array of format unless it is still bound from the last call
+    void bind(VertexFormat format);
+    // Code that binds vertex arrays of its own calls this afterwards
+    void forgetBinding() { boundFormat = VERTEX_FORMAT_COUNT; }
+    // Points the instance attributes of the instanced format at an allocation; core 3.3 has no
+    // base instance, so this re-specifies them instead. Binds the instanced format.
+    void bindInstances(unsigned int allocation);
+
+    // Moves every live range to the front of its buffer and trims the free tail
+    void compact();
+    // compact() once the holes between live ranges hold more than maxWaste of the capacity
+    bool compactIfFragmented(float maxWaste = 0.25f);
+
+    size_t capacityBytes() const;
+    size_t usedBytes() const;
+    void printReport() const;
+
+private:
+    struct Allocation {
+        GeometryBuffer buffer;
+        size_t offset;  // in elements
+        size_t count;
+        bool live;
+    };
+    struct Pool {
+        unsigned int id;
+        size_t elementSize;
+        size_t capacity;            // in elements
+        size_t used;
+        map<size_t, size_t> free;   // offset -> count, never touching each other
+    };
+    // elements going over from the old buffer to the new one
+    struct Move {
+        size_t from, to, count;
+    };
+
+    Pool pools[GEOMETRY_BUFFER_COUNT];
+    vector<Allocation> allocations;     // handle - 1
+    vector<unsigned int> freeHandles;
+    unsigned int vertexArrays[VERTEX_FORMAT_COUNT];
+    VertexFormat boundFormat;
+    size_t compactions;
+
+    GeometryArena();
+    // first fit, grows the pool when nothing fits
+    size_t reserve(GeometryBuffer buffer, size_t count);
+    void release(GeometryBuffer buffer, size_t offset, size_t count);
+    // replaces the pool's buffer with one of capacity elements, copying moves over from the old one
+    void reallocate(GeometryBuffer buffer, size_t capacity, const vector<Move>& moves);
+    // re-points the vertex arrays at the current buffers
+    void specifyFormats();
+};
+
+#endif
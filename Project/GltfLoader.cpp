@@ -0,0 +1,592 @@
+#include "GltfLoader.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+	const unsigned int GLTF_BYTE = 5120;
+	const unsigned int GLTF_UNSIGNED_BYTE = 5121;
+	const unsigned int GLTF_SHORT = 5122;
+	const unsigned int GLTF_UNSIGNED_SHORT = 5123;
+	const unsigned int GLTF_UNSIGNED_INT = 5125;
+	const unsigned int GLTF_FLOAT = 5126;
+	const unsigned int GLTF_TRIANGLES = 4;
+
+	// just enough of a JSON DOM for a glTF manifest
+	struct JsonValue {
+		enum Type { Null, Bool, Number, String, Array, Object };
+		Type type = Null;
+		double number = 0.0;
+		string text;
+		vector<JsonValue> items;
+		vector<pair<string, JsonValue>> members;
+
+		const JsonValue& operator[](const char* key) const
+		{
+			static const JsonValue missing;
+			for (const auto& member : members)
+				if (member.first == key)
+					return member.second;
+			return missing;
+		}
+
+		const JsonValue& operator[](int i) const
+		{
+			static const JsonValue missing;
+			return i >= 0 && size_t(i) < items.size() ? items[i] : missing;
+		}
+
+		bool has(const char* key) const { return (*this)[key].type != Null; }
+		size_t size() const { return items.size(); }
+		int asInt(int fallback = -1) const { return type == Number ? int(number) : fallback; }
+		float asFloat(float fallback = 0.0f) const { return type == Number ? float(number) : fallback; }
+	};
+
+	class JsonParser
+	{
+	public:
+		JsonParser(const char* begin, const char* end) : p(begin), end(end), failed(false) {}
+
+		bool parse(JsonValue& value)
+		{
+			parseValue(value, 0);
+			skipSpace();
+			return !failed && p == end;
+		}
+
+	private:
+		const char* p;
+		const char* end;
+		bool failed;
+
+		void skipSpace()
+		{
+			while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+				p++;
+		}
+
+		bool expect(char c)
+		{
+			skipSpace();
+			if (p < end && *p == c)
+			{
+				p++;
+				return true;
+			}
+			failed = true;
+			return false;
+		}
+
+		bool literal(const char* word)
+		{
+			size_t length = strlen(word);
+			if (size_t(end - p) < length || memcmp(p, word, length) != 0)
+				return false;
+			p += length;
+			return true;
+		}
+
+		void appendUtf8(string& out, unsigned int code)
+		{
+			if (code < 0x80)
+				out += char(code);
+			else if (code < 0x800)
+			{
+				out += char(0xC0 | (code >> 6));
+				out += char(0x80 | (code & 0x3F));
+			}
+			else
+			{
+				out += char(0xE0 | (code >> 12));
+				out += char(0x80 | ((code >> 6) & 0x3F));
+				out += char(0x80 | (code & 0x3F));
+			}
+		}
+
+		void parseString(string& out)
+		{
+			if (!expect('"'))
+				return;
+			while (p < end && *p != '"')
+			{
+				if (*p != '\\')
+				{
+					out += *p++;
+					continue;
+				}
+				if (++p == end)
+					break;
+				char c = *p++;
+				switch (c)
+				{
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'n': out += '\n'; break;
+				case 'r': out += '\r'; break;
+				case 't': out += '\t'; break;
+				case 'u':
+					if (end - p < 4)
+					{
+						failed = true;
+						return;
+					}
+					appendUtf8(out, (unsigned int)strtoul(string(p, p + 4).c_str(), nullptr, 16));
+					p += 4;
+					break;
+				default: out += c; break;
+				}
+			}
+			if (p == end)
+				failed = true;
+			else
+				p++;
+		}
+
+		void parseValue(JsonValue& value, int depth)
+		{
+			skipSpace();
+			if (p == end || depth > 64)
+			{
+				failed = true;
+				return;
+			}
+			if (*p == '{')
+			{
+				p++;
+				value.type = JsonValue::Object;
+				skipSpace();
+				if (p < end && *p == '}')
+				{
+					p++;
+					return;
+				}
+				while (!failed)
+				{
+					value.members.emplace_back();
+					skipSpace();
+					parseString(value.members.back().first);
+					if (!expect(':'))
+						return;
+					parseValue(value.members.back().second, depth + 1);
+					skipSpace();
+					if (p < end && *p == ',')
+						p++;
+					else
+					{
+						expect('}');
+						return;
+					}
+				}
+			}
+			else if (*p == '[')
+			{
+				p++;
+				value.type = JsonValue::Array;
+				skipSpace();
+				if (p < end && *p == ']')
+				{
+					p++;
+					return;
+				}
+				while (!failed)
+				{
+					value.items.emplace_back();
+					parseValue(value.items.back(), depth + 1);
+					skipSpace();
+					if (p < end && *p == ',')
+						p++;
+					else
+					{
+						expect(']');
+						return;
+					}
+				}
+			}
+			else if (*p == '"')
+			{
+				value.type = JsonValue::String;
+				parseString(value.text);
+			}
+			else if (literal("true"))
+			{
+				value.type = JsonValue::Bool;
+				value.number = 1.0;
+			}
+			else if (literal("false"))
+				value.type = JsonValue::Bool;
+			else if (literal("null"))
+				value.type = JsonValue::Null;
+			else
+			{
+				// strtod needs a terminated string, numbers are short
+				const char* start = p;
+				while (p < end && (isdigit((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E'))
+					p++;
+				string digits(start, p);
+				char* stop = nullptr;
+				value.type = JsonValue::Number;
+				value.number = strtod(digits.c_str(), &stop);
+				if (digits.empty() || *stop != '\0')
+					failed = true;
+			}
+		}
+	};
+
+	// relative URIs may escape spaces and other characters as %XX
+	string decodeUri(const string& uri)
+	{
+		string out;
+		for (size_t i = 0; i < uri.size(); i++)
+		{
+			if (uri[i] == '%' && i + 2 < uri.size() && isxdigit((unsigned char)uri[i + 1]) && isxdigit((unsigned char)uri[i + 2]))
+			{
+				out += char(strtoul(uri.substr(i + 1, 2).c_str(), nullptr, 16));
+				i += 2;
+			}
+			else
+				out += uri[i];
+		}
+		return out;
+	}
+
+	unsigned int componentSize(unsigned int type)
+	{
+		switch (type)
+		{
+		case GLTF_BYTE: case GLTF_UNSIGNED_BYTE: return 1;
+		case GLTF_SHORT: case GLTF_UNSIGNED_SHORT: return 2;
+		case GLTF_UNSIGNED_INT: case GLTF_FLOAT: return 4;
+		default: return 0;
+		}
+	}
+
+	unsigned int componentCount(const string& type)
+	{
+		if (type == "SCALAR") return 1;
+		if (type == "VEC2") return 2;
+		if (type == "VEC3") return 3;
+		if (type == "VEC4") return 4;
+		return 0;
+	}
+
+	glm::mat4 nodeTransform(const JsonValue& node)
+	{
+		const JsonValue& matrix = node["matrix"];
+		if (matrix.size() == 16)
+		{
+			// column-major like glm
+			float m[16];
+			for (int i = 0; i < 16; i++)
+				m[i] = matrix[i].asFloat();
+			return glm::make_mat4(m);
+		}
+		glm::mat4 transform(1.0f);
+		const JsonValue& t = node["translation"];
+		if (t.size() == 3)
+			transform = glm::translate(transform, glm::vec3(t[0].asFloat(), t[1].asFloat(), t[2].asFloat()));
+		const JsonValue& r = node["rotation"];
+		if (r.size() == 4)
+			transform *= glm::mat4_cast(glm::quat(r[3].asFloat(1.0f), r[0].asFloat(), r[1].asFloat(), r[2].asFloat()));
+		const JsonValue& s = node["scale"];
+		if (s.size() == 3)
+			transform = glm::scale(transform, glm::vec3(s[0].asFloat(1.0f), s[1].asFloat(1.0f), s[2].asFloat(1.0f)));
+		return transform;
+	}
+}
+
+bool GltfScene::open(const string& path)
+{
+	close();
+	string directory = path.substr(0, path.find_last_of('/') + 1);
+
+	AssetFile manifest;
+	if (!VirtualFileSystem::instance().open(path, manifest))
+	{
+		error = "cannot open " + path;
+		return false;
+	}
+	JsonValue root;
+	const char* text = reinterpret_cast<const char*>(manifest.data());
+	if (!JsonParser(text, text + manifest.size()).parse(root) || root.type != JsonValue::Object)
+	{
+		error = "malformed JSON in " + path;
+		return false;
+	}
+	manifest.close();
+	if (root["asset"]["version"].text.compare(0, 2, "2.") != 0)
+	{
+		error = "only glTF 2.x is supported";
+		return false;
+	}
+
+	// buffers are mapped (or sit in the asset pack), never read into memory
+	const JsonValue& bufferList = root["buffers"];
+	for (size_t i = 0; i < bufferList.size(); i++)
+	{
+		const string& uri = bufferList[i]["uri"].text;
+		if (uri.empty() || uri.compare(0, 5, "data:") == 0)
+		{
+			error = "embedded buffers are not supported";
+			return false;
+		}
+		bufferFiles.push_back(directory + decodeUri(uri));
+		buffers.emplace_back();
+		if (!VirtualFileSystem::instance().open(bufferFiles.back(), buffers.back())
+			|| buffers.back().size() < size_t(bufferList[i]["byteLength"].number))
+		{
+			error = "cannot map " + bufferFiles.back();
+			return false;
+		}
+	}
+
+	const JsonValue& viewList = root["bufferViews"];
+	for (size_t i = 0; i < viewList.size(); i++)
+	{
+		const JsonValue& view = viewList[i];
+		BufferView bufferView = { (unsigned int)view["buffer"].asInt(), size_t(view["byteOffset"].asInt(0)),
+			size_t(view["byteLength"].asInt(0)), size_t(view["byteStride"].asInt(0)) };
+		if (bufferView.buffer >= buffers.size() || bufferView.byteOffset + bufferView.byteLength > buffers[bufferView.buffer].size())
+		{
+			error = "buffer view out of range";
+			return false;
+		}
+		bufferViews.push_back(bufferView);
+	}
+
+	const JsonValue& accessorList = root["accessors"];
+	for (size_t i = 0; i < accessorList.size(); i++)
+	{
+		const JsonValue& a = accessorList[i];
+		Accessor accessor = { a["bufferView"].asInt(), size_t(a["byteOffset"].asInt(0)), (unsigned int)a["componentType"].asInt(0),
+			(unsigned int)a["count"].asInt(0), componentCount(a["type"].text), a["normalized"].number != 0.0 };
+		if (a.has("sparse"))
+			accessor.bufferView = -1;
+		accessors.push_back(accessor);
+	}
+
+	// texture slots named the way the shaders and the Assimp path name them
+	const JsonValue& images = root["images"];
+	const JsonValue& textures = root["textures"];
+	auto textureRef = [&](const JsonValue& info, const char* type, vector<TextureRef>& refs) {
+		if (!info.has("index") || info["texCoord"].asInt(0) != 0)
+			return;
+		const JsonValue& image = images[textures[info["index"].asInt()]["source"].asInt()];
+		if (image["uri"].type == JsonValue::String && image["uri"].text.compare(0, 5, "data:") != 0)
+			refs.push_back({ type, decodeUri(image["uri"].text) });
+	};
+	const JsonValue& materialList = root["materials"];
+	for (size_t i = 0; i < materialList.size(); i++)
+	{
+		vector<TextureRef> refs;
+		textureRef(materialList[i]["pbrMetallicRoughness"]["baseColorTexture"], "texture_diffuse", refs);
+		textureRef(materialList[i]["normalTexture"], "texture_normal", refs);
+		materials.push_back(refs);
+	}
+
+	// flattened primitives, meshIndex -> first primitive
+	const JsonValue& meshList = root["meshes"];
+	vector<unsigned int> firstPrimitive;
+	for (size_t i = 0; i < meshList.size(); i++)
+	{
+		firstPrimitive.push_back((unsigned int)primitives.size());
+		const JsonValue& primitiveList = meshList[i]["primitives"];
+		for (size_t k = 0; k < primitiveList.size(); k++)
+		{
+			const JsonValue& prim = primitiveList[k];
+			const JsonValue& attributes = prim["attributes"];
+			Primitive primitive = { attributes["POSITION"].asInt(), attributes["NORMAL"].asInt(), attributes["TANGENT"].asInt(),
+				attributes["TEXCOORD_0"].asInt(), prim["indices"].asInt(), prim["material"].asInt() };
+			// points and lines are skipped, same as the Assimp path leaves them unlit
+			if (prim["mode"].asInt(GLTF_TRIANGLES) != GLTF_TRIANGLES)
+				primitive.position = -1;
+			if (primitive.position >= 0 && (!validAccessor(primitive.position, 3)
+				|| (primitive.normal >= 0 && !validAccessor(primitive.normal, 3))
+				|| (primitive.tangent >= 0 && !validAccessor(primitive.tangent, 4))
+				|| (primitive.texCoord >= 0 && !validAccessor(primitive.texCoord, 2))
+				|| (primitive.indices >= 0 && !validAccessor(primitive.indices, 1))))
+			{
+				error = "unsupported or out of range accessor in mesh " + to_string(i);
+				return false;
+			}
+			if (primitive.material >= int(materials.size()))
+				primitive.material = -1;
+			primitives.push_back(primitive);
+		}
+	}
+	firstPrimitive.push_back((unsigned int)primitives.size());
+
+	// walk the default scene, one instance with its world transform per placed primitive
+	const JsonValue& nodeList = root["nodes"];
+	const JsonValue& scene = root["scenes"][root["scene"].asInt(0)];
+	struct Pending {
+		int node, parent;
+		glm::mat4 parentTransform;
+	};
+	vector<Pending> stack;
+	for (size_t i = scene["nodes"].size(); i-- > 0;)
+		stack.push_back({ scene["nodes"][i].asInt(), -1, glm::mat4(1.0f) });
+	while (!stack.empty())
+	{
+		Pending pending = stack.back();
+		stack.pop_back();
+		const JsonValue& node = nodeList[pending.node];
+		if (node.type != JsonValue::Object || nodes.size() > nodeList.size())
+		{
+			error = "invalid node hierarchy";
+			return false;
+		}
+		NodeData nodeData;
+		nodeData.name = node["name"].text;
+		nodeData.transform = nodeTransform(node);
+		nodeData.parent = pending.parent;
+		glm::mat4 world = pending.parentTransform * nodeData.transform;
+		int mesh = node["mesh"].asInt();
+		if (mesh >= 0 && mesh + 1 < int(firstPrimitive.size()))
+			for (unsigned int p = firstPrimitive[mesh]; p < firstPrimitive[mesh + 1]; p++)
+				if (primitives[p].position >= 0)
+				{
+					nodeData.meshes.push_back((unsigned int)instances.size());
+					instances.push_back({ p, world, (int)nodes.size() });
+				}
+		int index = (int)nodes.size();
+		nodes.push_back(nodeData);
+		const JsonValue& children = node["children"];
+		for (size_t i = children.size(); i-- > 0;)
+			stack.push_back({ children[i].asInt(), index, world });
+	}
+	return true;
+}
+
+void GltfScene::close()
+{
+	instances.clear();
+	nodes.clear();
+	error.clear();
+	bufferFiles.clear();
+	buffers.clear();
+	bufferViews.clear();
+	accessors.clear();
+	primitives.clear();
+	materials.clear();
+}
+
+bool GltfScene::validAccessor(int index, unsigned int components) const
+{
+	if (index < 0 || index >= int(accessors.size()))
+		return false;
+	const Accessor& accessor = accessors[index];
+	unsigned int size = componentSize(accessor.componentType);
+	if (accessor.bufferView < 0 || accessor.bufferView >= int(bufferViews.size()) || size == 0)
+		return false;
+	if (components == 1 ? accessor.componentType == GLTF_FLOAT || accessor.components != 1 : accessor.components != components)
+		return false;
+	if (accessor.count == 0)
+		return true;
+	const BufferView& view = bufferViews[accessor.bufferView];
+	size_t elementSize = size_t(size) * accessor.components;
+	size_t stride = view.byteStride ? view.byteStride : elementSize;
+	return accessor.byteOffset + stride * (accessor.count - 1) + elementSize <= view.byteLength;
+}
+
+float GltfScene::read(const Accessor& accessor, unsigned int i, unsigned int c) const
+{
+	const BufferView& view = bufferViews[accessor.bufferView];
+	unsigned int size = componentSize(accessor.componentType);
+	size_t stride = view.byteStride ? view.byteStride : size_t(size) * accessor.components;
+	const unsigned char* p = buffers[view.buffer].data() + view.byteOffset + accessor.byteOffset + stride * i + size * c;
+	// buffer views are only 4-byte aligned by convention, memcpy keeps the reads legal
+	switch (accessor.componentType)
+	{
+	case GLTF_FLOAT: { float v; memcpy(&v, p, 4); return v; }
+	case GLTF_UNSIGNED_INT: { uint32_t v; memcpy(&v, p, 4); return float(v); }
+	case GLTF_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, p, 2); return accessor.normalized ? v / 65535.0f : float(v); }
+	case GLTF_SHORT: { int16_t v; memcpy(&v, p, 2); return accessor.normalized ? glm::max(v / 32767.0f, -1.0f) : float(v); }
+	case GLTF_UNSIGNED_BYTE: return accessor.normalized ? *p / 255.0f : float(*p);
+	case GLTF_BYTE: return accessor.normalized ? glm::max(int8_t(*p) / 127.0f, -1.0f) : float(int8_t(*p));
+	default: return 0.0f;
+	}
+}
+
+MeshData GltfScene::convert(unsigned int i) const
+{
+	const Primitive& primitive = primitives[instances[i].primitive];
+	const Accessor& positions = accessors[primitive.position];
+
+	MeshData data;
+	data.vertices.resize(positions.count);
+	for (unsigned int v = 0; v < positions.count; v++)
+	{
+		Vertex& vertex = data.vertices[v];
+		vertex = {};
+		glm::vec3 position(read(positions, v, 0), read(positions, v, 1), read(positions, v, 2));
+		vertex.Position = position;
+		glm::vec3 normal(0.0f);
+		if (primitive.normal >= 0)
+		{
+			const Accessor& normals = accessors[primitive.normal];
+			normal = glm::vec3(read(normals, v, 0), read(normals, v, 1), read(normals, v, 2));
+			vertex.Normal = glm::normalize(normal);
+		}
+		// glTF UVs already start at the top left like stb_image rows, no flip
+		if (primitive.texCoord >= 0)
+		{
+			const Accessor& texCoords = accessors[primitive.texCoord];
+			vertex.TexCoords = glm::vec2(read(texCoords, v, 0), read(texCoords, v, 1));
+		}
+		if (primitive.tangent >= 0)
+		{
+			const Accessor& tangents = accessors[primitive.tangent];
+			vertex.Tangent = glm::vec3(read(tangents, v, 0), read(tangents, v, 1), read(tangents, v, 2));
+			vertex.Bitangent = glm::cross(normal, vertex.Tangent) * read(tangents, v, 3);
+		}
+	}
+
+	if (primitive.indices >= 0)
+	{
+		const Accessor& indices = accessors[primitive.indices];
+		data.indices.resize(indices.count);
+		for (unsigned int k = 0; k < indices.count; k++)
+		{
+			data.indices[k] = (unsigned int)read(indices, k, 0);
+			if (data.indices[k] >= positions.count)
+				data.indices[k] = 0;
+		}
+	}
+	else
+	{
+		data.indices.resize(positions.count);
+		for (unsigned int k = 0; k < positions.count; k++)
+			data.indices[k] = k;
+	}
+	data.indices.resize(data.indices.size() / 3 * 3);
+
+	// without normals the spec asks for flat shading, area-weighted smooth normals are close enough here
+	if (primitive.normal < 0)
+	{
+		for (size_t k = 0; k < data.indices.size(); k += 3)
+		{
+			Vertex& a = data.vertices[data.indices[k]];
+			Vertex& b = data.vertices[data.indices[k + 1]];
+			Vertex& c = data.vertices[data.indices[k + 2]];
+			glm::vec3 n = glm::cross(b.Position - a.Position, c.Position - a.Position);
+			a.Normal += n;
+			b.Normal += n;
+			c.Normal += n;
+		}
+		for (Vertex& vertex : data.vertices)
+			if (glm::length(vertex.Normal) > 0.0f)
+				vertex.Normal = glm::normalize(vertex.Normal);
+	}
+
+	if (primitive.material >= 0)
+		data.textures = materials[primitive.material];
+	return data;
+}
@@ -0,0 +1,75 @@
+#ifndef GLTF_LOADER_H
+#define GLTF_LOADER_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "MeshCache.h"
+#include "VirtualFileSystem.h"
+using namespace std;
+
+// Reader for glTF 2.0 scenes with external .bin buffers (the Sketchfab exports under res/models),
+// opened through the VirtualFileSystem.
+// Triangle lists only; POSITION, NORMAL, TANGENT and TEXCOORD_0 are read straight from the
+// mapped buffers, no copy is made unless the pack stores a buffer compressed.
+class GltfScene
+{
+public:
+    // one mesh primitive placed by one node, the unit that becomes a MeshData
+    struct Instance {
+        unsigned int primitive;
+        glm::mat4 transform;
+        int node;
+    };
+
+    vector<Instance> instances;
+    // node hierarchy with local transforms, meshes index into instances
+    vector<NodeData> nodes;
+    string error;
+
+    // Parses the JSON and maps every buffer it references
+    bool open(const string& path);
+    void close();
+
+    // .bin files the scene reads from, the mesh cache has to be keyed by them too
+    const vector<string>& bufferPaths() const { return bufferFiles; }
+
+    // Builds the vertices/indices/texture refs of instance i in the primitive's own space,
+    // Model places them with the instance transform.
+    // Only reads the mapped buffers, so instances may be converted on several threads at once.
+    MeshData convert(unsigned int i) const;
+
+private:
+    struct Accessor {
+        int bufferView;
+        size_t byteOffset;
+        unsigned int componentType;
+        unsigned int count;
+        unsigned int components;
+        bool normalized;
+    };
+    struct BufferView {
+        unsigned int buffer;
+        size_t byteOffset, byteLength, byteStride;
+    };
+    struct Primitive {
+        int position, normal, tangent, texCoord, indices, material;
+    };
+
+    vector<string> bufferFiles;
+    vector<AssetFile> buffers;
+    vector<BufferView> bufferViews;
+    vector<Accessor> accessors;
+    vector<Primitive> primitives;
+    vector<vector<TextureRef>> materials;
+
+    // index in range, element type as expected and every element inside its buffer
+    bool validAccessor(int accessor, unsigned int components) const;
+    // component c of element i converted to float, normalized integers map to [0, 1] or [-1, 1]
+    float read(const Accessor& accessor, unsigned int i, unsigned int c) const;
+};
+
+#endif
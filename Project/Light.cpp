@@ -78,49 +78,3 @@ void Light::turnOff()
 {
 	active = false;
 }
-
-// returns 1 if light is put to shader and 0 if is not
-int Light::putInShader(Shader* shader, int lightNumber)
-{
-	if (!isLightOn()) return 0;
-
-	string num = to_string(lightNumber);
-
-	switch (this->type)
-	{
-	case LightType::Directional:
-		shader->setInt	("light[" + num + "].type",		int(type));
-		shader->setVec3	("light[" + num + "].direction",direction);
-		shader->setVec3	("light[" + num + "].ambient",	ambient);
-		shader->setVec3	("light[" + num + "].diffuse",	diffuse);
-		shader->setVec3	("light[" + num + "].specular", specular);
-		break;
-	case LightType::Point:
-		shader->setInt	("light[" + num + "].type",		int(type));
-		shader->setVec3	("light[" + num + "].position", position);
-		shader->setVec3	("light[" + num + "].ambient",	ambient);
-		shader->setVec3	("light[" + num + "].diffuse",	diffuse);
-		shader->setVec3	("light[" + num + "].specular", specular);
-		shader->setFloat("light[" + num + "].constant", constant);
-		shader->setFloat("light[" + num + "].linear",	linear);
-		shader->setFloat("light[" + num + "].quadratic",quadratic);
-		break;
-	case LightType::Spot:
-		shader->setInt	("light[" + num + "].type",		int(type));
-		shader->setVec3	("light[" + num + "].position", position);
-		shader->setVec3	("light[" + num + "].direction",direction);
-		shader->setFloat("light[" + num + "].cutOff",	cutOff);
-		shader->setVec3	("light[" + num + "].ambient",	ambient);
-		shader->setVec3	("light[" + num + "].diffuse",	diffuse);
-		shader->setVec3	("light[" + num + "].specular", specular);
-		shader->setFloat("light[" + num + "].constant", constant);
-		shader->setFloat("light[" + num + "].linear",	linear);
-		shader->setFloat("light[" + num + "].quadratic",quadratic);
-		break;
-	case LightType::Ambient:
-		shader->setInt	("light[" + num + "].type",		int(type));
-		shader->setVec3	("light[" + num + "].ambient",	ambient);
-		break;
-	}
-	return 1;
-}
\ No newline at end of file
@@ -5,8 +5,6 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <string>
 
-#include "Shader.h"
-
 enum class LightType { None = 0, Directional = 1, Point = 2, Spot = 3, Ambient = 4 };
 
 class Light
@@ -51,8 +49,6 @@ public:
 	bool isLightOn();
 	void turnOn();
 	void turnOff();
-
-	int putInShader(Shader* shader, int lightNumber);
 };
 
 extern const Light NoneLight;
@@ -0,0 +1,37 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return ptr != nullptr; }
+    const unsigned char* data() const { return ptr; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char* ptr;
+    size_t length;
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#endif
+};
+
+// 64-bit FNV-1a, used for keying cooked data
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+#endif
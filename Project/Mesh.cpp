@@ -2,81 +2,369 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <string>
 #include <vector>
+#include "GeometryArena.h"
 #include "Mesh.h"
+#include "VirtualTexture.h"
 
 using namespace std;
 
+static_assert(sizeof(PackedVertex) == 20, "PackedVertex must stay 20 bytes");
+
 Mesh::Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+	: vertices(move(vertices)), indices(move(indices)), textures(move(textures)), virtualTexture(nullptr),
+	vertexAllocation(0), indexAllocation(0), instanceAllocation(0)
+{
+	this->indexCount = (unsigned int)this->indices.size();
+	this->lods.assign(1, { 0, indexCount, 0.0f });
+
+	setupMesh(this->vertices, this->indices);
+}
+
+Mesh::Mesh(Span<Vertex> vertices, Span<unsigned int> indices, vector<Texture> textures, vector<MeshLod> lods, vector<Meshlet> meshlets,
+	vector<glm::mat4> instances, vector<MeshPart> parts)
+	: textures(move(textures)), lods(move(lods)), meshlets(move(meshlets)), parts(move(parts)), instances(move(instances)), virtualTexture(nullptr),
+	vertexAllocation(0), indexAllocation(0), instanceAllocation(0)
+{
+	this->indexCount = (unsigned int)indices.size;
+	if (this->lods.empty())
+		this->lods.assign(1, { 0, indexCount, 0.0f });
+
+	setupMesh(vertices, indices);
+}
+
+Mesh::Mesh(Mesh&& other) noexcept
+	: vertexAllocation(0), indexAllocation(0), instanceAllocation(0)
+{
+	*this = move(other);
+}
+
+Mesh& Mesh::operator=(Mesh&& other) noexcept
+{
+	if (this != &other)
+	{
+		destroy();
+		vertices = move(other.vertices);
+		indices = move(other.indices);
+		textures = move(other.textures);
+		samplerUniforms = move(other.samplerUniforms);
+		lods = move(other.lods);
+		meshlets = move(other.meshlets);
+		parts = move(other.parts);
+		instances = move(other.instances);
+		vertexAllocation = other.vertexAllocation;
+		indexAllocation = other.indexAllocation;
+		instanceAllocation = other.instanceAllocation;
+		indexCount = other.indexCount;
+		indexType = other.indexType;
+		posScale = other.posScale;
+		posOffset = other.posOffset;
+		center = other.center;
+		radius = other.radius;
+		uvDensity = other.uvDensity;
+		virtualTexture = other.virtualTexture;
+		other.vertexAllocation = other.indexAllocation = other.instanceAllocation = 0;
+	}
+	return *this;
+}
+
+Mesh::~Mesh()
+{
+	destroy();
+}
+
+void Mesh::destroy()
+{
+	GeometryArena& arena = GeometryArena::instance();
+	arena.free(vertexAllocation);
+	arena.free(indexAllocation);
+	arena.free(instanceAllocation);
+	vertexAllocation = indexAllocation = instanceAllocation = 0;
+}
+
+void Mesh::releaseCpuCopy()
+{
+	vector<Vertex>().swap(vertices);
+	vector<unsigned int>().swap(indices);
+}
+
+size_t Mesh::cpuBytes() const
 {
-	this->vertices = vertices;
-	this->indices = indices;
-	this->textures = textures;
+	return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int)
+		+ lods.capacity() * sizeof(MeshLod) + meshlets.capacity() * sizeof(Meshlet)
+		+ parts.capacity() * sizeof(MeshPart) + instances.capacity() * sizeof(glm::mat4);
+}
 
-	setupMesh();
+size_t Mesh::gpuBytes() const
+{
+	// the arena's share for this mesh, not counting its free space
+	GeometryArena& arena = GeometryArena::instance();
+	size_t bytes = 0;
+	for (unsigned int allocation : { vertexAllocation, indexAllocation, instanceAllocation })
+		if (allocation)
+			bytes += arena.bytes(allocation);
+	return bytes;
 }
 
-void Mesh::Draw(Shader* shader)
+static bool sphereInFrustum(const glm::vec3& center, float radius, const MeshletCulling& culling)
 {
-	unsigned int diffuseNr = 1;
-	unsigned int specularNr = 1;
-	unsigned int normalNr = 1;
-	unsigned int heightNr = 1;
+	for (int i = 0; i < 6; i++)
+		if (glm::dot(glm::vec3(culling.frustum[i]), center) + culling.frustum[i].w < -radius)
+			return false;
+	return true;
+}
+
+static bool meshletVisible(const Meshlet& meshlet, const MeshletCulling& culling)
+{
+	if (!sphereInFrustum(meshlet.center, meshlet.radius, culling))
+		return false;
+	// the whole cone faces away from the camera
+	glm::vec3 toCenter = meshlet.center - culling.cameraPosition;
+	return glm::dot(toCenter, meshlet.coneAxis) < meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius;
+}
+
+void Mesh::Draw(Shader* shader, unsigned int lod, const MeshletCulling* culling)
+{
+	static const UniformHandle<glm::vec3> posScaleUniform("posScale"), posOffsetUniform("posOffset");
+	static const UniformHandle<bool> instancedUniform("instanced"), virtualTexturedUniform("virtualTextured");
+
+	// sampler names only change with the texture list
+	if (samplerUniforms.size() != textures.size())
+	{
+		unsigned int diffuseNr = 1;
+		unsigned int specularNr = 1;
+		unsigned int normalNr = 1;
+		unsigned int heightNr = 1;
+		samplerUniforms.clear();
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			string number;
+			string name = textures[i].type;
+			if (name == "texture_diffuse")
+				number = std::to_string(diffuseNr++);
+			else if (name == "texture_specular")
+				number = std::to_string(specularNr++);
+			else if (name == "texture_normal")
+				number = std::to_string(normalNr++);
+			else if (name == "texture_height")
+				number = std::to_string(heightNr++);
+			samplerUniforms.emplace_back(name + number);
+		}
+	}
 	for (unsigned int i = 0; i < textures.size(); i++)
 	{
 		glActiveTexture(GL_TEXTURE0 + i);
-		string number;
-		string name = textures[i].type;
-		if (name == "texture_diffuse")
-			number = std::to_string(diffuseNr++);
-		else if (name == "texture_specular")
-			number = std::to_string(specularNr++);
-		else if (name == "texture_normal")
-			number = std::to_string(normalNr++);
-		else if (name == "texture_height")
-			number = std::to_string(heightNr++);
-
-		glUniform1i(glGetUniformLocation(shader->ID(), (name + number).c_str()), i);
+		shader->set(samplerUniforms[i], int(i));
 		glBindTexture(GL_TEXTURE_2D, textures[i].id);
 	}
 
-	glBindVertexArray(VAO);
-	glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
+	if (virtualTexture)
+		virtualTexture->bind(shader, (unsigned int)textures.size());
+	shader->set(posScaleUniform, posScale);
+	shader->set(posOffsetUniform, posOffset);
+
+	const MeshLod& range = lods[min(lod, (unsigned int)lods.size() - 1)];
+	GeometryArena& arena = GeometryArena::instance();
+	size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+	size_t indexBase = arena.offset(indexAllocation);
+	GLint baseVertex = GLint(arena.offset(vertexAllocation) / sizeof(PackedVertex));
+	if (!instances.empty())
+	{
+		// meshlets are in the mesh's own space, instances draw whole
+		arena.bindInstances(instanceAllocation);
+		shader->set(instancedUniform, true);
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.indexCount, indexType, (void*)(indexBase + range.indexOffset * indexSize),
+			(GLsizei)instances.size(), baseVertex);
+		shader->set(instancedUniform, false);
+	}
+	else if (culling && range.indexOffset == 0 && !meshlets.empty())
+	{
+		arena.bind(VERTEX_FORMAT_PACKED);
+		// a part off screen skips all of its meshlets, neighbouring visible meshlets merge into one range
+		drawCounts.clear();
+		drawOffsets.clear();
+		unsigned int end = ~0u;
+		for (size_t p = 0; p < max(parts.size(), size_t(1)); p++)
+		{
+			size_t first = 0, count = meshlets.size();
+			if (!parts.empty())
+			{
+				if (!sphereInFrustum(parts[p].center, parts[p].radius, *culling))
+					continue;
+				first = parts[p].firstMeshlet;
+				count = parts[p].meshletCount;
+			}
+			for (size_t m = first; m < first + count; m++)
+			{
+				const Meshlet& meshlet = meshlets[m];
+				if (!meshletVisible(meshlet, *culling))
+					continue;
+				if (meshlet.indexOffset == end)
+					drawCounts.back() += meshlet.indexCount;
+				else
+				{
+					drawCounts.push_back(meshlet.indexCount);
+					drawOffsets.push_back((void*)(indexBase + meshlet.indexOffset * indexSize));
+				}
+				end = meshlet.indexOffset + meshlet.indexCount;
+			}
+		}
+		drawBaseVertices.assign(drawCounts.size(), baseVertex);
+		if (!drawCounts.empty())
+			glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(), indexType, drawOffsets.data(),
+				(GLsizei)drawCounts.size(), drawBaseVertices.data());
+	}
+	else
+	{
+		arena.bind(VERTEX_FORMAT_PACKED);
+		glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, indexType, (void*)(indexBase + range.indexOffset * indexSize), baseVertex);
+	}
+
+	// the shadow pass draws float geometry with the same program
+	shader->set(posScaleUniform, glm::vec3(1.0f));
+	shader->set(posOffsetUniform, glm::vec3(0.0f));
+	if (virtualTexture)
+		shader->set(virtualTexturedUniform, false);
 
 	glActiveTexture(GL_TEXTURE0);
 }
 
-void Mesh::setupMesh()
-{
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
-
-	glBindVertexArray(VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-	// vertex positions
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-	glEnableVertexAttribArray(0);
-	// vertex normals
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-	glEnableVertexAttribArray(1);
-	// vertex texture coords
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-	glEnableVertexAttribArray(2);
-	// vertex tangent
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-	glEnableVertexAttribArray(3);
-	// vertex bitangent
-	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-	glEnableVertexAttribArray(4);
-
-	glBindVertexArray(0);
+void Mesh::setupMesh(Span<Vertex> vertexData, Span<unsigned int> indexData)
+{
+	unsigned int vertexCount = (unsigned int)vertexData.size;
+	vector<PackedVertex> packed = packVertices(vertexData.data, vertexCount, posScale, posOffset);
+
+	glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+	for (const Vertex& vertex : vertexData)
+	{
+		lo = glm::min(lo, vertex.Position);
+		hi = glm::max(hi, vertex.Position);
+	}
+	center = vertexCount ? (lo + hi) * 0.5f : glm::vec3(0.0f);
+	radius = 0.0f;
+	for (const Vertex& vertex : vertexData)
+		radius = max(radius, glm::length(vertex.Position - center));
+	// the sphere of every instance, and the largest scale, which samples the textures the densest
+	float maxScale = 1.0f;
+	if (!instances.empty())
+	{
+		glm::vec3 instancesLo(FLT_MAX), instancesHi(-FLT_MAX);
+		for (const glm::mat4& instance : instances)
+		{
+			glm::vec3 placed = glm::vec3(instance * glm::vec4(center, 1.0f));
+			instancesLo = glm::min(instancesLo, placed);
+			instancesHi = glm::max(instancesHi, placed);
+		}
+		glm::vec3 instancesCenter = (instancesLo + instancesHi) * 0.5f;
+		float instancesRadius = 0.0f;
+		maxScale = 0.0f;
+		for (const glm::mat4& instance : instances)
+		{
+			float scale = max(glm::length(glm::vec3(instance[0])), max(glm::length(glm::vec3(instance[1])), glm::length(glm::vec3(instance[2]))));
+			maxScale = max(maxScale, scale);
+			instancesRadius = max(instancesRadius, glm::length(glm::vec3(instance * glm::vec4(center, 1.0f)) - instancesCenter) + radius * scale);
+		}
+		center = instancesCenter;
+		radius = instancesRadius;
+	}
+
+	double surface = 0.0, uvSurface = 0.0;
+	for (unsigned int i = lods[0].indexOffset; i + 2 < lods[0].indexOffset + lods[0].indexCount; i += 3)
+	{
+		const Vertex& a = vertexData[indexData[i]];
+		const Vertex& b = vertexData[indexData[i + 1]];
+		const Vertex& c = vertexData[indexData[i + 2]];
+		surface += glm::length(glm::cross(b.Position - a.Position, c.Position - a.Position));
+		glm::vec2 u = b.TexCoords - a.TexCoords, v = c.TexCoords - a.TexCoords;
+		uvSurface += fabs(u.x * v.y - u.y * v.x);
+	}
+	uvDensity = surface > 0.0 && maxScale > 0.0f ? float(sqrt(uvSurface / surface)) / maxScale : 0.0f;
+
+	// 16-bit indices whenever every vertex is addressable with them
+	vector<uint16_t> shortIndices;
+	const void* indices = indexData.data;
+	size_t indexSize = sizeof(unsigned int);
+	indexType = GL_UNSIGNED_INT;
+	if (vertexCount <= 65536)
+	{
+		shortIndices.assign(indexData.begin(), indexData.end());
+		indices = shortIndices.data();
+		indexSize = sizeof(uint16_t);
+		indexType = GL_UNSIGNED_SHORT;
+	}
+	// the arena's vertex arrays already describe the layout, only the data goes over
+	GeometryArena& arena = GeometryArena::instance();
+	vertexAllocation = arena.allocate(GEOMETRY_VERTICES, packed.data(), packed.size() * sizeof(PackedVertex));
+	indexAllocation = arena.allocate(GEOMETRY_INDICES, indices, indexCount * indexSize);
+	if (!instances.empty())
+		instanceAllocation = arena.allocate(GEOMETRY_INSTANCES, instances.data(), instances.size() * sizeof(glm::mat4));
+}
+
+static int16_t toSnorm16(float v)
+{
+	return (int16_t)glm::round(glm::clamp(v, -1.0f, 1.0f) * 32767.0f);
+}
+
+static glm::vec2 octEncode(glm::vec3 n)
+{
+	n /= glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+	if (n.z < 0.0f)
+	{
+		glm::vec2 folded = (1.0f - glm::abs(glm::vec2(n.y, n.x)));
+		n.x = n.x >= 0.0f ? folded.x : -folded.x;
+		n.y = n.y >= 0.0f ? folded.y : -folded.y;
+	}
+	return glm::vec2(n.x, n.y);
+}
+
+vector<PackedVertex> packVertices(const Vertex* vertices, unsigned int vertexCount, glm::vec3& posScale, glm::vec3& posOffset)
+{
+	glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+	for (unsigned int i = 0; i < vertexCount; i++)
+	{
+		lo = glm::min(lo, vertices[i].Position);
+		hi = glm::max(hi, vertices[i].Position);
+	}
+	if (vertexCount == 0)
+		lo = hi = glm::vec3(0.0f);
+	posOffset = (lo + hi) * 0.5f;
+	posScale = (hi - lo) * 0.5f;
+	for (int c = 0; c < 3; c++)
+		if (posScale[c] <= 0.0f)
+			posScale[c] = 1.0f;
+
+	vector<PackedVertex> packed(vertexCount);
+	for (unsigned int i = 0; i < vertexCount; i++)
+	{
+		const Vertex& v = vertices[i];
+		glm::vec3 position = (v.Position - posOffset) / posScale;
+
+		glm::vec3 normal = glm::length(v.Normal) > 0.0f ? glm::normalize(v.Normal) : glm::vec3(0.0f, 0.0f, 1.0f);
+		// tangents are orthogonalized here, meshes without UVs get any perpendicular one
+		glm::vec3 tangent = v.Tangent - normal * glm::dot(normal, v.Tangent);
+		if (glm::length(tangent) < 1e-6f)
+			tangent = glm::cross(normal, glm::abs(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f));
+		tangent = glm::normalize(tangent);
+		float handedness = glm::dot(glm::cross(normal, tangent), v.Bitangent) < 0.0f ? -1.0f : 1.0f;
+
+		glm::vec2 n = octEncode(normal), t = octEncode(tangent);
+		PackedVertex& p = packed[i];
+		p.Position[0] = toSnorm16(position.x);
+		p.Position[1] = toSnorm16(position.y);
+		p.Position[2] = toSnorm16(position.z);
+		p.Position[3] = toSnorm16(handedness);
+		p.Frame[0] = toSnorm16(n.x);
+		p.Frame[1] = toSnorm16(n.y);
+		p.Frame[2] = toSnorm16(t.x);
+		p.Frame[3] = toSnorm16(t.y);
+		p.TexCoords[0] = glm::packHalf1x16(v.TexCoords.x);
+		p.TexCoords[1] = glm::packHalf1x16(v.TexCoords.y);
+	}
+	return packed;
 }
@@ -6,6 +6,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -16,6 +17,8 @@
 #include "Shader.h"
 using namespace std;
 
+class VirtualTexture;
+
 struct Vertex {
     glm::vec3 Position;
     glm::vec3 Normal;
@@ -24,26 +27,129 @@ struct Vertex {
     glm::vec3 Bitangent;
 };
 
+// GPU layout, 20 bytes: position quantized to the mesh bounds with the tangent handedness in w,
+// octahedral normal and tangent, half-float texture coords
+struct PackedVertex {
+    int16_t Position[4];
+    int16_t Frame[4];
+    uint16_t TexCoords[2];
+};
+
+// One level of detail: a range of the mesh index buffer
+struct MeshLod {
+    unsigned int indexOffset;
+    unsigned int indexCount;
+    float error;    // largest simplification error, in model units
+};
+
+// A cluster of at most MESHLET_MAX_TRIANGLES triangles, a range of the LOD 0 indices
+struct Meshlet {
+    unsigned int indexOffset;
+    unsigned int indexCount;
+    glm::vec3 center;
+    float radius;
+    // every triangle normal lies within the cone, coneCutoff is the sine of its half angle (1 = never culled)
+    glm::vec3 coneAxis;
+    float coneCutoff;
+};
+
+// One source mesh inside a mesh merged by material: its LOD 0 indices and the meshlets cut from them
+struct MeshPart {
+    unsigned int indexOffset;
+    unsigned int indexCount;
+    unsigned int firstMeshlet;
+    unsigned int meshletCount;
+    glm::vec3 center;
+    float radius;
+};
+
+// Camera in the mesh's model space, for culling meshlets
+struct MeshletCulling {
+    glm::vec3 cameraPosition;
+    glm::vec4 frustum[6];   // planes facing inwards, normalized
+};
+
 struct Texture {
     unsigned int id;
     string type;
     string path;
 };
 
+// Non-owning view of contiguous caller memory (a mapped cache, a vector, ...)
+template<typename T>
+struct Span {
+    const T* data;
+    size_t size;
+
+    Span() : data(nullptr), size(0) {}
+    Span(const T* data, size_t size) : data(data), size(size) {}
+    Span(const vector<T>& v) : data(v.data()), size(v.size()) {}
+
+    const T* begin() const { return data; }
+    const T* end() const { return data + size; }
+    const T& operator[](size_t i) const { return data[i]; }
+};
+
+// Owns its ranges of the GeometryArena, so it can be moved but not copied
 class Mesh {
 public:
+    // CPU copies, only kept by the vector constructor until releaseCpuCopy()
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
-    unsigned int VAO;
+    vector<MeshLod>      lods;
+    vector<Meshlet>      meshlets;
+    // source meshes merged into this one, empty when it was imported whole
+    vector<MeshPart>     parts;
+    // model-space placements when the mesh is drawn instanced, empty for a single baked-in one
+    vector<glm::mat4>    instances;
+    unsigned int indexCount;    // all LODs together
+    GLenum indexType;
+    // undoes the position quantization, set as posScale/posOffset while drawing
+    glm::vec3 posScale, posOffset;
+    // bounding sphere in model space, around every instance
+    glm::vec3 center;
+    float radius;
+    // UV units per model unit, averaged over the LOD 0 surface
+    float uvDensity;
+    // when set, albedo and normal come from this instead of textures once it is ready
+    VirtualTexture* virtualTexture;
 
+    // takes ownership of the arrays, pass them with move() to avoid a copy
     Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures);
+    // uploads straight from caller-owned memory (e.g. a mapped mesh cache), no CPU copy is kept
+    Mesh(Span<Vertex> vertices, Span<unsigned int> indices, vector<Texture> textures,
+        vector<MeshLod> lods = vector<MeshLod>(), vector<Meshlet> meshlets = vector<Meshlet>(),
+        vector<glm::mat4> instances = vector<glm::mat4>(), vector<MeshPart> parts = vector<MeshPart>());
+    Mesh(Mesh&& other) noexcept;
+    Mesh& operator=(Mesh&& other) noexcept;
+    Mesh(const Mesh&) = delete;
+    Mesh& operator=(const Mesh&) = delete;
+    ~Mesh();
 
-    void Draw(Shader* shader);
+    // lod is clamped to the coarsest level the mesh has, at LOD 0 off-screen parts, then back-facing
+    // and off-screen meshlets are skipped when culling is given (instanced meshes draw whole)
+    void Draw(Shader* shader, unsigned int lod = 0, const MeshletCulling* culling = nullptr);
+
+    // frees the CPU vertex/index copies, the GPU buffers stay
+    void releaseCpuCopy();
+    size_t cpuBytes() const;
+    size_t gpuBytes() const;
 
 private:
-    unsigned int VBO, EBO;
+    // GeometryArena handles, instanceAllocation is 0 for a mesh that isn't instanced
+    unsigned int vertexAllocation, indexAllocation, instanceAllocation;
+    // ranges of visible meshlets for glMultiDrawElementsBaseVertex, reused between draws
+    vector<GLsizei> drawCounts;
+    vector<const void*> drawOffsets;
+    vector<GLint> drawBaseVertices;
+    // texture_diffuse1... for each of textures, made on the first draw
+    vector<UniformHandle<int>> samplerUniforms;
 
-    void setupMesh();
+    void setupMesh(Span<Vertex> vertexData, Span<unsigned int> indexData);
+    void destroy();
 };
+
+// Quantizes vertices into the packed layout, returns the bounds used for the positions
+vector<PackedVertex> packVertices(const Vertex* vertices, unsigned int vertexCount, glm::vec3& posScale, glm::vec3& posOffset);
 #endif
\ No newline at end of file
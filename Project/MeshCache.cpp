@@ -0,0 +1,361 @@
+#include "MeshCache.h"
+#include "CookManifest.h"
+#include "VirtualFileSystem.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+static_assert(sizeof(Vertex) == 14 * sizeof(float), "Vertex layout changed, bump MESH_CACHE_VERSION");
+static_assert(sizeof(MeshLod) == 12, "MeshLod layout changed, bump MESH_CACHE_VERSION");
+static_assert(sizeof(Meshlet) == 40, "Meshlet layout changed, bump MESH_CACHE_VERSION");
+static_assert(sizeof(MeshPart) == 32, "MeshPart layout changed, bump MESH_CACHE_VERSION");
+static_assert(sizeof(glm::mat4) == 16 * sizeof(float), "instance matrices are stored as 16 floats");
+
+namespace
+{
+	const char CACHE_MAGIC[4] = { 'M', 'D', 'L', 'C' };
+
+	struct CacheHeader {
+		char     magic[4];
+		uint32_t version;
+		uint64_t sourceHash;
+		uint32_t importFlags;
+		uint32_t importOptions;
+		uint32_t meshCount;
+		uint32_t nodeCount;
+		uint32_t textureRefCount;
+		uint32_t nodeMeshCount;
+		uint32_t lodCount;
+		uint32_t meshletCount;
+		uint32_t partCount;
+		uint32_t instanceCount;
+		uint32_t stringBytes;
+	};
+
+	struct CacheMesh {
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t firstTexture;
+		uint32_t textureCount;
+		uint32_t firstLod;
+		uint32_t lodCount;
+		uint32_t firstMeshlet;
+		uint32_t meshletCount;
+		uint32_t firstPart;
+		uint32_t partCount;
+		uint32_t firstInstance;
+		uint32_t instanceCount;
+	};
+
+	struct CacheTextureRef {
+		uint32_t type;
+		uint32_t path;
+	};
+
+	struct CacheNode {
+		float    transform[16];
+		int32_t  parent;
+		uint32_t name;
+		uint32_t firstMesh;
+		uint32_t meshCount;
+	};
+
+	// table layout that follows the header
+	struct CacheLayout {
+		size_t meshes, textureRefs, nodes, nodeMeshes, lods, meshlets, parts, instances, strings, end;
+
+		CacheLayout(const CacheHeader& h)
+		{
+			meshes = sizeof(CacheHeader);
+			textureRefs = meshes + h.meshCount * sizeof(CacheMesh);
+			nodes = textureRefs + h.textureRefCount * sizeof(CacheTextureRef);
+			nodeMeshes = nodes + h.nodeCount * sizeof(CacheNode);
+			lods = nodeMeshes + h.nodeMeshCount * sizeof(uint32_t);
+			meshlets = lods + h.lodCount * sizeof(MeshLod);
+			parts = meshlets + h.meshletCount * sizeof(Meshlet);
+			instances = parts + h.partCount * sizeof(MeshPart);
+			strings = instances + h.instanceCount * sizeof(glm::mat4);
+			end = strings + h.stringBytes;
+		}
+	};
+
+	size_t alignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	uint32_t addString(vector<char>& blob, const string& s)
+	{
+		uint32_t offset = uint32_t(blob.size());
+		blob.insert(blob.end(), s.begin(), s.end());
+		blob.push_back('\0');
+		return offset;
+	}
+}
+
+MeshCache::MeshCache() : sourceHash(0), importFlags(0), importOptions(0)
+{
+}
+
+string MeshCache::cachePath(const string& sourcePath)
+{
+	return "cache/" + sourcePath + ".mesh";
+}
+
+bool MeshCache::open(const string& path, unsigned int flags, unsigned int options, const vector<string>& dependencies)
+{
+	close();
+	sourcePath = path;
+	importFlags = flags;
+	importOptions = options;
+
+	// a current cook manifest already vouches for the sources, hashing them is what it saves
+	bool trusted = CookManifest::instance().vouchesFor(cachePath(sourcePath));
+	if (!trusted && !hashSources(dependencies))
+		return false;
+
+	bool valid = file.open(cachePath(sourcePath)) && file.size() >= sizeof(CacheHeader);
+	if (valid)
+	{
+		const CacheHeader& h = *reinterpret_cast<const CacheHeader*>(file.data());
+		if (trusted)
+			sourceHash = h.sourceHash;
+		valid = memcmp(h.magic, CACHE_MAGIC, 4) == 0
+			&& h.version == MESH_CACHE_VERSION
+			&& h.sourceHash == sourceHash
+			&& h.importFlags == importFlags
+			&& h.importOptions == importOptions
+			&& CacheLayout(h).end <= file.size();
+	}
+	if (valid)
+	{
+		// every mesh payload has to lie inside the file
+		const CacheHeader& h = *reinterpret_cast<const CacheHeader*>(file.data());
+		const CacheMesh* meshes = reinterpret_cast<const CacheMesh*>(file.data() + CacheLayout(h).meshes);
+		for (uint32_t i = 0; i < h.meshCount && valid; i++)
+			valid = meshes[i].vertexOffset + uint64_t(meshes[i].vertexCount) * sizeof(Vertex) <= file.size()
+				&& meshes[i].indexOffset + uint64_t(meshes[i].indexCount) * sizeof(unsigned int) <= file.size()
+				&& meshes[i].firstTexture + meshes[i].textureCount <= h.textureRefCount
+				&& meshes[i].firstLod + meshes[i].lodCount <= h.lodCount
+				&& meshes[i].firstMeshlet + meshes[i].meshletCount <= h.meshletCount
+				&& meshes[i].firstPart + meshes[i].partCount <= h.partCount
+				&& meshes[i].firstInstance + meshes[i].instanceCount <= h.instanceCount;
+	}
+	if (!valid)
+	{
+		file.close();
+		// the miss is followed by write(), which needs the real key
+		if (trusted)
+			hashSources(dependencies);
+	}
+	return valid;
+}
+
+bool MeshCache::hashSources(const vector<string>& dependencies)
+{
+	AssetFile source;
+	if (!VirtualFileSystem::instance().open(sourcePath, source))
+		return false;
+	sourceHash = hashBytes(source.data(), source.size());
+	for (const string& dependency : dependencies)
+	{
+		if (!VirtualFileSystem::instance().open(dependency, source))
+			return false;
+		sourceHash = hashBytes(source.data(), source.size(), sourceHash);
+	}
+	return true;
+}
+
+void MeshCache::close()
+{
+	file.close();
+}
+
+unsigned int MeshCache::meshCount() const
+{
+	return reinterpret_cast<const CacheHeader*>(file.data())->meshCount;
+}
+
+MeshView MeshCache::mesh(unsigned int i) const
+{
+	const CacheHeader& h = *reinterpret_cast<const CacheHeader*>(file.data());
+	CacheLayout layout(h);
+	const CacheMesh& m = reinterpret_cast<const CacheMesh*>(file.data() + layout.meshes)[i];
+	const CacheTextureRef* refs = reinterpret_cast<const CacheTextureRef*>(file.data() + layout.textureRefs);
+
+	MeshView view;
+	view.vertices = Span<Vertex>(reinterpret_cast<const Vertex*>(file.data() + m.vertexOffset), m.vertexCount);
+	view.indices = Span<unsigned int>(reinterpret_cast<const unsigned int*>(file.data() + m.indexOffset), m.indexCount);
+	for (uint32_t t = 0; t < m.textureCount; t++)
+	{
+		const CacheTextureRef& ref = refs[m.firstTexture + t];
+		view.textures.push_back({ stringAt(ref.type), stringAt(ref.path) });
+	}
+	const MeshLod* lods = reinterpret_cast<const MeshLod*>(file.data() + layout.lods);
+	view.lods.assign(lods + m.firstLod, lods + m.firstLod + m.lodCount);
+	const Meshlet* meshlets = reinterpret_cast<const Meshlet*>(file.data() + layout.meshlets);
+	view.meshlets.assign(meshlets + m.firstMeshlet, meshlets + m.firstMeshlet + m.meshletCount);
+	const MeshPart* parts = reinterpret_cast<const MeshPart*>(file.data() + layout.parts);
+	view.parts.assign(parts + m.firstPart, parts + m.firstPart + m.partCount);
+	const glm::mat4* instances = reinterpret_cast<const glm::mat4*>(file.data() + layout.instances);
+	view.instances.assign(instances + m.firstInstance, instances + m.firstInstance + m.instanceCount);
+	return view;
+}
+
+vector<NodeData> MeshCache::nodes() const
+{
+	const CacheHeader& h = *reinterpret_cast<const CacheHeader*>(file.data());
+	CacheLayout layout(h);
+	const CacheNode* cacheNodes = reinterpret_cast<const CacheNode*>(file.data() + layout.nodes);
+	const uint32_t* nodeMeshes = reinterpret_cast<const uint32_t*>(file.data() + layout.nodeMeshes);
+
+	vector<NodeData> result(h.nodeCount);
+	for (uint32_t i = 0; i < h.nodeCount; i++)
+	{
+		const CacheNode& n = cacheNodes[i];
+		result[i].name = stringAt(n.name);
+		memcpy(&result[i].transform, n.transform, sizeof(n.transform));
+		result[i].parent = n.parent;
+		result[i].meshes.assign(nodeMeshes + n.firstMesh, nodeMeshes + n.firstMesh + n.meshCount);
+	}
+	return result;
+}
+
+const char* MeshCache::stringAt(uint32_t offset) const
+{
+	const CacheHeader& h = *reinterpret_cast<const CacheHeader*>(file.data());
+	if (offset >= h.stringBytes)
+		return "";
+	return reinterpret_cast<const char*>(file.data() + CacheLayout(h).strings + offset);
+}
+
+bool MeshCache::write(const ModelData& model) const
+{
+	CacheHeader h;
+	memcpy(h.magic, CACHE_MAGIC, 4);
+	h.version = MESH_CACHE_VERSION;
+	h.sourceHash = sourceHash;
+	h.importFlags = importFlags;
+	h.importOptions = importOptions;
+	h.meshCount = uint32_t(model.meshes.size());
+	h.nodeCount = uint32_t(model.nodes.size());
+
+	vector<char> strings;
+	vector<CacheMesh> meshes(model.meshes.size());
+	vector<CacheTextureRef> textureRefs;
+	vector<CacheNode> nodes(model.nodes.size());
+	vector<uint32_t> nodeMeshes;
+	vector<MeshLod> lods;
+	vector<Meshlet> meshlets;
+	vector<MeshPart> parts;
+	vector<glm::mat4> instances;
+
+	for (size_t i = 0; i < model.meshes.size(); i++)
+	{
+		const MeshData& m = model.meshes[i];
+		meshes[i].vertexCount = uint32_t(m.vertices.size());
+		meshes[i].indexCount = uint32_t(m.indices.size());
+		meshes[i].firstTexture = uint32_t(textureRefs.size());
+		meshes[i].textureCount = uint32_t(m.textures.size());
+		meshes[i].firstLod = uint32_t(lods.size());
+		meshes[i].lodCount = uint32_t(m.lods.size());
+		lods.insert(lods.end(), m.lods.begin(), m.lods.end());
+		meshes[i].firstMeshlet = uint32_t(meshlets.size());
+		meshes[i].meshletCount = uint32_t(m.meshlets.size());
+		meshlets.insert(meshlets.end(), m.meshlets.begin(), m.meshlets.end());
+		meshes[i].firstPart = uint32_t(parts.size());
+		meshes[i].partCount = uint32_t(m.parts.size());
+		parts.insert(parts.end(), m.parts.begin(), m.parts.end());
+		meshes[i].firstInstance = uint32_t(instances.size());
+		meshes[i].instanceCount = uint32_t(m.instances.size());
+		instances.insert(instances.end(), m.instances.begin(), m.instances.end());
+		for (const TextureRef& t : m.textures)
+			textureRefs.push_back({ addString(strings, t.type), addString(strings, t.path) });
+	}
+	for (size_t i = 0; i < model.nodes.size(); i++)
+	{
+		const NodeData& n = model.nodes[i];
+		memcpy(nodes[i].transform, &n.transform, sizeof(nodes[i].transform));
+		nodes[i].parent = n.parent;
+		nodes[i].name = addString(strings, n.name);
+		nodes[i].firstMesh = uint32_t(nodeMeshes.size());
+		nodes[i].meshCount = uint32_t(n.meshes.size());
+		nodeMeshes.insert(nodeMeshes.end(), n.meshes.begin(), n.meshes.end());
+	}
+	h.textureRefCount = uint32_t(textureRefs.size());
+	h.nodeMeshCount = uint32_t(nodeMeshes.size());
+	h.lodCount = uint32_t(lods.size());
+	h.meshletCount = uint32_t(meshlets.size());
+	h.partCount = uint32_t(parts.size());
+	h.instanceCount = uint32_t(instances.size());
+	h.stringBytes = uint32_t(strings.size());
+
+	// vertex and index payloads go after the tables, 16-byte aligned
+	size_t offset = alignUp(CacheLayout(h).end, 16);
+	for (size_t i = 0; i < model.meshes.size(); i++)
+	{
+		meshes[i].vertexOffset = offset;
+		offset = alignUp(offset + meshes[i].vertexCount * sizeof(Vertex), 16);
+		meshes[i].indexOffset = offset;
+		offset = alignUp(offset + meshes[i].indexCount * sizeof(unsigned int), 16);
+	}
+
+	vector<char> buffer(offset, 0);
+	char* out = buffer.data();
+	CacheLayout layout(h);
+	memcpy(out, &h, sizeof(h));
+	if (!meshes.empty())
+		memcpy(out + layout.meshes, meshes.data(), meshes.size() * sizeof(CacheMesh));
+	if (!textureRefs.empty())
+		memcpy(out + layout.textureRefs, textureRefs.data(), textureRefs.size() * sizeof(CacheTextureRef));
+	if (!nodes.empty())
+		memcpy(out + layout.nodes, nodes.data(), nodes.size() * sizeof(CacheNode));
+	if (!nodeMeshes.empty())
+		memcpy(out + layout.nodeMeshes, nodeMeshes.data(), nodeMeshes.size() * sizeof(uint32_t));
+	if (!lods.empty())
+		memcpy(out + layout.lods, lods.data(), lods.size() * sizeof(MeshLod));
+	if (!meshlets.empty())
+		memcpy(out + layout.meshlets, meshlets.data(), meshlets.size() * sizeof(Meshlet));
+	if (!parts.empty())
+		memcpy(out + layout.parts, parts.data(), parts.size() * sizeof(MeshPart));
+	if (!instances.empty())
+		memcpy(out + layout.instances, instances.data(), instances.size() * sizeof(glm::mat4));
+	if (!strings.empty())
+		memcpy(out + layout.strings, strings.data(), strings.size());
+	for (size_t i = 0; i < model.meshes.size(); i++)
+	{
+		const MeshData& m = model.meshes[i];
+		if (!m.vertices.empty())
+			memcpy(out + meshes[i].vertexOffset, m.vertices.data(), m.vertices.size() * sizeof(Vertex));
+		if (!m.indices.empty())
+			memcpy(out + meshes[i].indexOffset, m.indices.data(), m.indices.size() * sizeof(unsigned int));
+	}
+
+	// write to a temporary name first so a crash never leaves a torn cache behind
+	string path = cachePath(sourcePath);
+	string tmpPath = path + ".tmp";
+	error_code ec;
+	filesystem::create_directories(filesystem::path(path).parent_path(), ec);
+	{
+		ofstream cacheFile(tmpPath, ios::binary | ios::trunc);
+		if (!cacheFile.write(buffer.data(), buffer.size()))
+		{
+			cout << "ERROR::MESH_CACHE:: Couldn't write " << tmpPath << endl;
+			return false;
+		}
+	}
+	filesystem::rename(tmpPath, path, ec);
+	if (ec)
+	{
+		cout << "ERROR::MESH_CACHE:: Couldn't write " << path << ": " << ec.message() << endl;
+		filesystem::remove(tmpPath, ec);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,91 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Mesh.h"
+#include "MappedFile.h"
+using namespace std;
+
+// Bump whenever Vertex, the file layout or the import pipeline changes
+const uint32_t MESH_CACHE_VERSION = 6;
+
+// Model import options that change the cooked result, part of the cache key like the import flags
+const unsigned int IMPORT_MERGE_BY_MATERIAL = 1;
+
+struct TextureRef {
+    string type;
+    string path;
+};
+
+// CPU-side result of importing one aiMesh
+struct MeshData {
+    vector<Vertex>       vertices;
+    vector<unsigned int> indices;
+    vector<TextureRef>   textures;
+    vector<MeshLod>      lods;      // ranges of indices, LOD 0 first
+    vector<Meshlet>      meshlets;  // clusters of LOD 0
+    vector<MeshPart>     parts;     // source meshes when several were merged into this one
+    // placements in model space when the mesh repeats, empty when its one placement is baked in
+    vector<glm::mat4>    instances;
+};
+
+struct NodeData {
+    string name;
+    glm::mat4 transform;
+    int parent;
+    vector<unsigned int> meshes;
+};
+
+struct ModelData {
+    vector<MeshData> meshes;
+    vector<NodeData> nodes;
+};
+
+// Points straight into the mapped cache file
+struct MeshView {
+    Span<Vertex>        vertices;
+    Span<unsigned int>  indices;
+    vector<TextureRef>  textures;
+    vector<MeshLod>     lods;
+    vector<Meshlet>     meshlets;
+    vector<MeshPart>    parts;
+    vector<glm::mat4>   instances;
+};
+
+// Cooked binary form of a model, stored under cache/ and keyed by
+// the source file contents plus the import flags and options.
+class MeshCache
+{
+public:
+    MeshCache();
+
+    // Maps the cache for sourcePath, returns false if it is missing or stale.
+    // dependencies are extra files (glTF buffers) whose contents are part of the key.
+    bool open(const string& sourcePath, unsigned int importFlags, unsigned int importOptions, const vector<string>& dependencies = {});
+    bool write(const ModelData& model) const;
+    void close();
+
+    unsigned int meshCount() const;
+    MeshView mesh(unsigned int i) const;
+    vector<NodeData> nodes() const;
+
+    static string cachePath(const string& sourcePath);
+
+private:
+    string sourcePath;
+    uint64_t sourceHash;
+    unsigned int importFlags;
+    unsigned int importOptions;
+    MappedFile file;
+
+    const char* stringAt(uint32_t offset) const;
+    // sets sourceHash from the source and dependency contents
+    bool hashSources(const vector<string>& dependencies);
+};
+
+#endif
@@ -0,0 +1,298 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace std;
+
+VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize)
+{
+	// timestamp of the last transform per vertex, resident while within cacheSize of now
+	vector<unsigned int> stamp(vertexCount, 0);
+	unsigned int time = cacheSize + 1;
+	size_t transformed = 0, unique = 0;
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		unsigned int v = indices[i];
+		if (stamp[v] == 0)
+			unique++;
+		if (time - stamp[v] > cacheSize)
+		{
+			stamp[v] = time++;
+			transformed++;
+		}
+	}
+	VertexCacheStats stats;
+	stats.acmr = indexCount ? float(transformed) / (indexCount / 3) : 0.0f;
+	stats.atvr = unique ? float(transformed) / unique : 0.0f;
+	return stats;
+}
+
+vector<unsigned int> optimizeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount,
+	vector<unsigned int>& clusters, unsigned int cacheSize)
+{
+	size_t triangleCount = indexCount / 3;
+
+	// vertex -> triangle adjacency
+	vector<unsigned int> live(vertexCount, 0);
+	for (size_t i = 0; i < indexCount; i++)
+		live[indices[i]]++;
+	vector<unsigned int> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+		offsets[v + 1] = offsets[v] + live[v];
+	vector<unsigned int> adjacency(indexCount);
+	vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < indexCount; i++)
+		adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+	vector<unsigned int> stamp(vertexCount, 0);
+	vector<bool> emitted(triangleCount, false);
+	vector<unsigned int> deadEnd;
+	vector<unsigned int> candidates;
+	vector<unsigned int> result;
+	result.reserve(indexCount);
+	clusters.clear();
+
+	unsigned int time = cacheSize + 1;
+	size_t cursor = 0;
+	long long fanning = vertexCount ? 0 : -1;
+	bool flushed = true;
+	while (fanning >= 0)
+	{
+		candidates.clear();
+		for (unsigned int a = offsets[fanning]; a < offsets[fanning + 1]; a++)
+		{
+			unsigned int t = adjacency[a];
+			if (emitted[t])
+				continue;
+			if (flushed)
+			{
+				clusters.push_back((unsigned int)(result.size() / 3));
+				flushed = false;
+			}
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int v = indices[t * 3 + k];
+				result.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - stamp[v] > cacheSize)
+					stamp[v] = time++;
+			}
+			emitted[t] = true;
+		}
+
+		// next fanning vertex: the candidate that stays in cache longest without being evicted by its own fan
+		fanning = -1;
+		int bestPriority = -1;
+		for (unsigned int v : candidates)
+		{
+			if (live[v] == 0)
+				continue;
+			int priority = 0;
+			if (time - stamp[v] + 2 * live[v] <= cacheSize)
+				priority = int(time - stamp[v]);
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				fanning = v;
+			}
+		}
+		if (fanning >= 0)
+			continue;
+
+		// dead end: recently used vertices first, then scan forward
+		while (!deadEnd.empty() && fanning < 0)
+		{
+			unsigned int v = deadEnd.back();
+			deadEnd.pop_back();
+			if (live[v] > 0)
+				fanning = v;
+		}
+		while (fanning < 0 && cursor < vertexCount)
+		{
+			if (live[cursor] > 0)
+				fanning = (long long)cursor;
+			cursor++;
+		}
+		flushed = true;
+	}
+	return result;
+}
+
+void optimizeOverdraw(vector<unsigned int>& indices, const vector<unsigned int>& clusters,
+	const Vertex* vertices, size_t vertexCount, float threshold)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (clusters.size() < 2)
+		return;
+
+	glm::vec3 meshCenter(0.0f);
+	for (size_t i = 0; i < indices.size(); i++)
+		meshCenter += vertices[indices[i]].Position;
+	meshCenter /= float(indices.size());
+
+	// clusters facing away from the mesh center tend to occlude the rest, draw them first
+	struct Cluster {
+		unsigned int begin, end;
+		float sortKey;
+	};
+	vector<Cluster> sorted;
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		Cluster cluster = { clusters[c], c + 1 < clusters.size() ? clusters[c + 1] : (unsigned int)triangleCount, 0.0f };
+		glm::vec3 center(0.0f), normal(0.0f);
+		float area = 0.0f;
+		for (unsigned int t = cluster.begin; t < cluster.end; t++)
+		{
+			const glm::vec3& p0 = vertices[indices[t * 3 + 0]].Position;
+			const glm::vec3& p1 = vertices[indices[t * 3 + 1]].Position;
+			const glm::vec3& p2 = vertices[indices[t * 3 + 2]].Position;
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float a = glm::length(n);
+			center += (p0 + p1 + p2) * (a / 3.0f);
+			normal += n;
+			area += a;
+		}
+		if (area > 0.0f)
+			center /= area;
+		float length = glm::length(normal);
+		if (length > 0.0f)
+			cluster.sortKey = glm::dot(center - meshCenter, normal / length);
+		sorted.push_back(cluster);
+	}
+	stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+	vector<unsigned int> reordered;
+	reordered.reserve(indices.size());
+	for (const Cluster& cluster : sorted)
+		reordered.insert(reordered.end(), indices.begin() + cluster.begin * 3, indices.begin() + cluster.end * 3);
+
+	float acmr = analyzeVertexCache(indices.data(), indices.size(), vertexCount).acmr;
+	float reorderedAcmr = analyzeVertexCache(reordered.data(), reordered.size(), vertexCount).acmr;
+	if (reorderedAcmr <= acmr * threshold)
+		indices.swap(reordered);
+}
+
+void optimizeVertexFetch(vector<Vertex>& vertices, vector<unsigned int>& indices)
+{
+	const unsigned int unused = ~0u;
+	vector<unsigned int> remap(vertices.size(), unused);
+	vector<Vertex> reordered;
+	reordered.reserve(vertices.size());
+	for (unsigned int& index : indices)
+	{
+		if (remap[index] == unused)
+		{
+			remap[index] = (unsigned int)reordered.size();
+			reordered.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+	vertices.swap(reordered);
+}
+
+static void finishMeshlet(const MeshData& mesh, Meshlet& meshlet)
+{
+	const unsigned int* indices = &mesh.indices[meshlet.indexOffset];
+	glm::vec3 lo(FLT_MAX), hi(-FLT_MAX), normalSum(0.0f);
+	vector<glm::vec3> normals;
+	for (unsigned int i = 0; i < meshlet.indexCount; i += 3)
+	{
+		glm::vec3 p0 = mesh.vertices[indices[i]].Position, p1 = mesh.vertices[indices[i + 1]].Position, p2 = mesh.vertices[indices[i + 2]].Position;
+		lo = glm::min(lo, glm::min(p0, glm::min(p1, p2)));
+		hi = glm::max(hi, glm::max(p0, glm::max(p1, p2)));
+		glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(n);
+		if (length > 0.0f)
+		{
+			normals.push_back(n / length);
+			normalSum += n / length;
+		}
+	}
+	meshlet.center = (lo + hi) * 0.5f;
+	meshlet.radius = 0.0f;
+	for (unsigned int i = 0; i < meshlet.indexCount; i++)
+		meshlet.radius = max(meshlet.radius, glm::length(mesh.vertices[indices[i]].Position - meshlet.center));
+
+	// a cone wider than a hemisphere can never face away entirely
+	meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+	meshlet.coneCutoff = 1.0f;
+	float length = glm::length(normalSum);
+	if (length == 0.0f)
+		return;
+	meshlet.coneAxis = normalSum / length;
+	float minDot = 1.0f;
+	for (const glm::vec3& n : normals)
+		minDot = min(minDot, glm::dot(n, meshlet.coneAxis));
+	if (minDot > 0.0f)
+		meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+}
+
+void buildMeshlets(MeshData& mesh)
+{
+	mesh.meshlets.clear();
+	unsigned int lodIndexCount = mesh.lods.empty() ? (unsigned int)mesh.indices.size() : mesh.lods[0].indexCount;
+	if (lodIndexCount % 3 != 0)
+		return;
+
+	// a part boundary always starts a new meshlet, so each part owns a run of them
+	vector<MeshPart> whole(1, { 0, lodIndexCount, 0, 0, glm::vec3(0.0f), 0.0f });
+	vector<MeshPart>& parts = mesh.parts.empty() ? whole : mesh.parts;
+	// stamp of the meshlet a vertex was last counted in
+	vector<unsigned int> seen(mesh.vertices.size(), ~0u);
+	for (MeshPart& part : parts)
+	{
+		part.firstMeshlet = (unsigned int)mesh.meshlets.size();
+		Meshlet meshlet = {};
+		meshlet.indexOffset = part.indexOffset;
+		unsigned int vertexCount = 0;
+		for (unsigned int i = part.indexOffset; i < part.indexOffset + part.indexCount; i += 3)
+		{
+			unsigned int newVertices = 0;
+			unsigned int stamp = (unsigned int)mesh.meshlets.size();
+			for (int k = 0; k < 3; k++)
+				newVertices += seen[mesh.indices[i + k]] != stamp;
+			if (meshlet.indexCount / 3 == MESHLET_MAX_TRIANGLES || vertexCount + newVertices > MESHLET_MAX_VERTICES)
+			{
+				finishMeshlet(mesh, meshlet);
+				mesh.meshlets.push_back(meshlet);
+				meshlet = {};
+				meshlet.indexOffset = i;
+				vertexCount = 0;
+				stamp++;
+			}
+			for (int k = 0; k < 3; k++)
+				if (seen[mesh.indices[i + k]] != stamp)
+				{
+					seen[mesh.indices[i + k]] = stamp;
+					vertexCount++;
+				}
+			meshlet.indexCount += 3;
+		}
+		if (meshlet.indexCount)
+		{
+			finishMeshlet(mesh, meshlet);
+			mesh.meshlets.push_back(meshlet);
+		}
+		part.meshletCount = (unsigned int)mesh.meshlets.size() - part.firstMeshlet;
+	}
+}
+
+MeshOptimizeReport optimizeMesh(MeshData& mesh)
+{
+	MeshOptimizeReport report;
+	report.before = analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+	// point and line primitives survive aiProcess_Triangulate, leave those meshes alone
+	if (mesh.indices.size() % 3 == 0 && !mesh.indices.empty())
+	{
+		vector<unsigned int> clusters;
+		mesh.indices = optimizeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(), clusters);
+		optimizeOverdraw(mesh.indices, clusters, mesh.vertices.data(), mesh.vertices.size());
+		optimizeVertexFetch(mesh.vertices, mesh.indices);
+	}
+	report.after = analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+	return report;
+}
@@ -0,0 +1,47 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <cstddef>
+#include <vector>
+
+#include "MeshCache.h"
+using namespace std;
+
+// Post-transform cache efficiency of an index buffer, simulated as a FIFO cache
+struct VertexCacheStats {
+    float acmr;     // transformed vertices per triangle
+    float atvr;     // transformed vertices per unique vertex
+};
+
+struct MeshOptimizeReport {
+    VertexCacheStats before, after;
+};
+
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = VERTEX_CACHE_SIZE);
+
+// Tipsify triangle order, clusters receives the first triangle of every cluster
+// (a run that starts after the cache had to be flushed)
+vector<unsigned int> optimizeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount,
+    vector<unsigned int>& clusters, unsigned int cacheSize = VERTEX_CACHE_SIZE);
+
+// Draws outward-facing clusters first, kept only if ACMR grows by less than threshold
+void optimizeOverdraw(vector<unsigned int>& indices, const vector<unsigned int>& clusters,
+    const Vertex* vertices, size_t vertexCount, float threshold = 1.05f);
+
+// Renumbers vertices in first-use order and drops unreferenced ones
+void optimizeVertexFetch(vector<Vertex>& vertices, vector<unsigned int>& indices);
+
+const unsigned int MESHLET_MAX_TRIANGLES = 128;
+const unsigned int MESHLET_MAX_VERTICES = 64;
+
+// Splits the LOD 0 index range into consecutive meshlets and computes their bounds and normal cones.
+// Meshlets never straddle two parts, each part gets its meshlet range.
+// Run after the vertex cache pass so neighbouring triangles are already spatially close.
+void buildMeshlets(MeshData& mesh);
+
+// All three passes, in order
+MeshOptimizeReport optimizeMesh(MeshData& mesh);
+
+#endif
@@ -0,0 +1,211 @@
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
+
+using namespace std;
+
+namespace
+{
+	// symmetric 4x4 plane quadric: xx xy xz xw yy yz yw zz zw ww
+	struct Quadric {
+		double a[10];
+
+		Quadric() { fill(a, a + 10, 0.0); }
+
+		void addPlane(const glm::dvec3& n, double d)
+		{
+			a[0] += n.x * n.x; a[1] += n.x * n.y; a[2] += n.x * n.z; a[3] += n.x * d;
+			a[4] += n.y * n.y; a[5] += n.y * n.z; a[6] += n.y * d;
+			a[7] += n.z * n.z; a[8] += n.z * d;
+			a[9] += d * d;
+		}
+
+		void add(const Quadric& q)
+		{
+			for (int i = 0; i < 10; i++)
+				a[i] += q.a[i];
+		}
+
+		double error(const glm::vec3& p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+				+ a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+				+ a[7] * z * z + 2 * a[8] * z
+				+ a[9];
+		}
+	};
+
+	struct Collapse {
+		unsigned int from, to;
+		double cost;
+	};
+
+	uint64_t edgeKey(unsigned int a, unsigned int b)
+	{
+		return (uint64_t(a) << 32) | b;
+	}
+}
+
+vector<unsigned int> simplifyMesh(const Vertex* vertices, size_t vertexCount, const vector<unsigned int>& indices,
+	size_t targetIndexCount, float& error)
+{
+	vector<unsigned int> result = indices;
+	error = 0.0f;
+
+	// an edge without its opposite half-edge is an open border or a seam between split vertices
+	unordered_set<uint64_t> halfEdges;
+	halfEdges.reserve(indices.size());
+	for (size_t i = 0; i < indices.size(); i += 3)
+		for (int k = 0; k < 3; k++)
+			halfEdges.insert(edgeKey(indices[i + k], indices[i + (k + 1) % 3]));
+	vector<bool> locked(vertexCount, false);
+	for (size_t i = 0; i < indices.size(); i += 3)
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int a = indices[i + k], b = indices[i + (k + 1) % 3];
+			if (halfEdges.find(edgeKey(b, a)) == halfEdges.end())
+				locked[a] = locked[b] = true;
+		}
+
+	vector<Quadric> quadrics(vertexCount);
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		glm::dvec3 p0 = vertices[indices[i]].Position, p1 = vertices[indices[i + 1]].Position, p2 = vertices[indices[i + 2]].Position;
+		glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+		double length = glm::length(n);
+		if (length == 0.0)
+			continue;
+		n /= length;
+		for (int k = 0; k < 3; k++)
+			quadrics[indices[i + k]].addPlane(n, -glm::dot(n, p0));
+	}
+
+	vector<unsigned int> offsets(vertexCount + 1), adjacency;
+	vector<Collapse> collapses;
+	vector<bool> touched(vertexCount);
+	vector<unsigned int> remap(vertexCount);
+	while (result.size() > targetIndexCount)
+	{
+		// vertex -> triangle adjacency of the current result
+		fill(offsets.begin(), offsets.end(), 0);
+		for (unsigned int v : result)
+			offsets[v + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			offsets[v + 1] += offsets[v];
+		adjacency.resize(result.size());
+		vector<unsigned int> cursor(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < result.size(); i++)
+			adjacency[cursor[result[i]]++] = (unsigned int)(i / 3);
+
+		// the cheaper direction of every edge that has a free end
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3)
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+				if (a > b && halfEdges.find(edgeKey(b, a)) != halfEdges.end())
+					continue;
+				Quadric q = quadrics[a];
+				q.add(quadrics[b]);
+				Collapse ab = { a, b, locked[a] ? HUGE_VAL : q.error(vertices[b].Position) };
+				Collapse ba = { b, a, locked[b] ? HUGE_VAL : q.error(vertices[a].Position) };
+				Collapse best = ab.cost <= ba.cost ? ab : ba;
+				if (best.cost != HUGE_VAL)
+					collapses.push_back(best);
+			}
+		if (collapses.empty())
+			break;
+		sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		// apply independent collapses in cost order, each removes about two triangles
+		size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+		size_t removed = 0;
+		fill(touched.begin(), touched.end(), false);
+		for (size_t v = 0; v < vertexCount; v++)
+			remap[v] = (unsigned int)v;
+		for (const Collapse& c : collapses)
+		{
+			if (removed >= trianglesToRemove)
+				break;
+			if (touched[c.from] || touched[c.to])
+				continue;
+
+			// reject collapses that flip a triangle around the removed vertex
+			bool flips = false;
+			size_t collapsedTriangles = 0;
+			const glm::vec3& target = vertices[c.to].Position;
+			for (unsigned int a = offsets[c.from]; a < offsets[c.from + 1] && !flips; a++)
+			{
+				const unsigned int* tri = &result[adjacency[a] * 3];
+				if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to)
+				{
+					collapsedTriangles++;
+					continue;
+				}
+				glm::vec3 p[3], q[3];
+				for (int k = 0; k < 3; k++)
+				{
+					p[k] = vertices[tri[k]].Position;
+					q[k] = tri[k] == c.from ? target : p[k];
+				}
+				flips = glm::dot(glm::cross(p[1] - p[0], p[2] - p[0]), glm::cross(q[1] - q[0], q[2] - q[0])) <= 0.0f;
+			}
+			if (flips)
+				continue;
+
+			remap[c.from] = c.to;
+			quadrics[c.to].add(quadrics[c.from]);
+			error = max(error, float(sqrt(max(c.cost, 0.0))));
+			removed += collapsedTriangles;
+			// the one-ring changed shape, leave it alone until the next pass
+			for (unsigned int a = offsets[c.from]; a < offsets[c.from + 1]; a++)
+				for (int k = 0; k < 3; k++)
+					touched[result[adjacency[a] * 3 + k]] = true;
+		}
+		if (removed == 0)
+			break;
+
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			unsigned int a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+	return result;
+}
+
+void generateLods(MeshData& mesh)
+{
+	mesh.lods.assign(1, { 0, (unsigned int)mesh.indices.size(), 0.0f });
+	if (mesh.indices.empty() || mesh.indices.size() % 3 != 0)
+		return;
+
+	// each level is simplified from the previous one and reordered for the vertex cache
+	vector<unsigned int> current = mesh.indices;
+	for (unsigned int level = 1; level < MAX_MESH_LODS; level++)
+	{
+		size_t target = current.size() / 6 * 3;
+		if (target < 3 * 16)
+			break;
+		float error;
+		vector<unsigned int> lod = simplifyMesh(mesh.vertices.data(), mesh.vertices.size(), current, target, error);
+		if (lod.empty() || lod.size() > current.size() * 9 / 10)
+			break;
+
+		vector<unsigned int> clusters;
+		lod = optimizeVertexCache(lod.data(), lod.size(), mesh.vertices.size(), clusters);
+		mesh.lods.push_back({ (unsigned int)mesh.indices.size(), (unsigned int)lod.size(), mesh.lods.back().error + error });
+		mesh.indices.insert(mesh.indices.end(), lod.begin(), lod.end());
+		current.swap(lod);
+	}
+}
@@ -0,0 +1,23 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <cstddef>
+#include <vector>
+
+#include "MeshCache.h"
+using namespace std;
+
+const unsigned int MAX_MESH_LODS = 5;
+
+// Quadric error edge collapse until at most targetIndexCount indices are left.
+// Vertices are only removed, never moved, so the result indexes the same vertex array.
+// Vertices on open borders and UV/normal seams are never collapsed, which keeps LODs crack-free.
+// error receives the largest collapse error, roughly a distance in model units.
+vector<unsigned int> simplifyMesh(const Vertex* vertices, size_t vertexCount, const vector<unsigned int>& indices,
+    size_t targetIndexCount, float& error);
+
+// Appends successively halved LODs to mesh.indices (up to MAX_MESH_LODS in total) and fills mesh.lods,
+// stops early once a mesh no longer simplifies
+void generateLods(MeshData& mesh);
+
+#endif
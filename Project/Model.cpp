@@ -1,68 +1,651 @@
 #include "Model.h"
+#include "GltfLoader.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "TextureRegistry.h"
+#include "TextureStreamer.h"
+#include "TextureUploader.h"
+#include "VirtualTexture.h"
+#include "VirtualFileSystem.h"
 
 #include <glad/glad.h> 
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
 #include "stb_image.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <unordered_map>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
 using namespace std;
 
-Model::Model(string const& path, bool isUV_flipped, bool gamma) : gammaCorrection(gamma)
+ImportStats Model::importStats;
+
+namespace
+{
+	// Serves Assimp's reads (the OBJ and the MTL files it references) out of the VirtualFileSystem
+	class AssetIOStream : public Assimp::IOStream
+	{
+	public:
+		AssetIOStream(AssetFile&& file) : file(move(file)), position(0) {}
+
+		size_t Read(void* buffer, size_t size, size_t count) override
+		{
+			if (size == 0)
+				return 0;
+			count = min(count, (file.size() - position) / size);
+			memcpy(buffer, file.data() + position, size * count);
+			position += size * count;
+			return count;
+		}
+
+		size_t Write(const void*, size_t, size_t) override { return 0; }
+
+		aiReturn Seek(size_t offset, aiOrigin origin) override
+		{
+			size_t target = origin == aiOrigin_SET ? offset : origin == aiOrigin_CUR ? position + offset : file.size() + offset;
+			if (target > file.size())
+				return aiReturn_FAILURE;
+			position = target;
+			return aiReturn_SUCCESS;
+		}
+
+		size_t Tell() const override { return position; }
+		size_t FileSize() const override { return file.size(); }
+		void Flush() override {}
+
+	private:
+		AssetFile file;
+		size_t position;
+	};
+
+	class AssetIOSystem : public Assimp::IOSystem
+	{
+	public:
+		bool Exists(const char* path) const override { return VirtualFileSystem::instance().exists(path); }
+		char getOsSeparator() const override { return '/'; }
+
+		Assimp::IOStream* Open(const char* path, const char* mode) override
+		{
+			AssetFile file;
+			if (strchr(mode, 'w') || strchr(mode, 'a') || !VirtualFileSystem::instance().open(path, file))
+				return nullptr;
+			return new AssetIOStream(move(file));
+		}
+
+		void Close(Assimp::IOStream* stream) override { delete stream; }
+	};
+
+	uint64_t hashMeshContent(const MeshData& mesh)
+	{
+		uint64_t hash = hashBytes(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+		hash = hashBytes(mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int), hash);
+		for (const TextureRef& texture : mesh.textures)
+			hash = hashBytes(texture.path.data(), texture.path.size(), hash);
+		return hash;
+	}
+
+	bool sameMeshContent(const MeshData& a, const MeshData& b)
+	{
+		if (a.vertices.size() != b.vertices.size() || a.indices != b.indices || a.textures.size() != b.textures.size())
+			return false;
+		for (size_t i = 0; i < a.textures.size(); i++)
+			if (a.textures[i].type != b.textures[i].type || a.textures[i].path != b.textures[i].path)
+				return false;
+		return a.vertices.empty() || memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size() * sizeof(Vertex)) == 0;
+	}
+
+	// a mirroring transform turns front faces into back faces
+	void flipWinding(MeshData& mesh)
+	{
+		for (size_t k = 0; k + 2 < mesh.indices.size(); k += 3)
+			swap(mesh.indices[k + 1], mesh.indices[k + 2]);
+	}
+
+	// moves a mesh with a single placement into model space, drawn like any unique mesh
+	void bakeTransform(MeshData& mesh, const glm::mat4& transform)
+	{
+		if (transform == glm::mat4(1.0f))
+			return;
+		glm::mat3 basis(transform);
+		glm::mat3 normalMatrix = glm::transpose(glm::inverse(basis));
+		for (Vertex& vertex : mesh.vertices)
+		{
+			vertex.Position = glm::vec3(transform * glm::vec4(vertex.Position, 1.0f));
+			if (glm::length(vertex.Normal) > 0.0f)
+				vertex.Normal = glm::normalize(normalMatrix * vertex.Normal);
+			vertex.Tangent = basis * vertex.Tangent;
+			vertex.Bitangent = basis * vertex.Bitangent;
+		}
+		if (glm::determinant(basis) < 0.0f)
+			flipWinding(mesh);
+	}
+
+	// appends the triangles of a baked mesh to merged, recorded as a part with its bounding sphere
+	void appendPart(MeshData& merged, const MeshData& mesh)
+	{
+		MeshPart part = { (unsigned int)merged.indices.size(), (unsigned int)mesh.indices.size(), 0, 0, glm::vec3(0.0f), 0.0f };
+		glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+		for (const Vertex& vertex : mesh.vertices)
+		{
+			lo = glm::min(lo, vertex.Position);
+			hi = glm::max(hi, vertex.Position);
+		}
+		part.center = (lo + hi) * 0.5f;
+		for (const Vertex& vertex : mesh.vertices)
+			part.radius = glm::max(part.radius, glm::length(vertex.Position - part.center));
+
+		unsigned int base = (unsigned int)merged.vertices.size();
+		merged.vertices.insert(merged.vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+		for (unsigned int index : mesh.indices)
+			merged.indices.push_back(base + index);
+		merged.parts.push_back(part);
+	}
+
+	// Instances placed by mirroring transforms: the shader rebuilds the bitangent as cross(N, T)
+	// of the transformed frame, which the mirror negates, so the stored handedness is negated too
+	void mirror(MeshData& mesh)
+	{
+		flipWinding(mesh);
+		for (Vertex& vertex : mesh.vertices)
+			vertex.Bitangent = -vertex.Bitangent;
+	}
+}
+
+// cache key flags for natively read glTF, never produced by the Assimp flag set
+const unsigned int GLTF_CACHE_FLAGS = 0;
+
+// levels the projected size has to move past a LOD boundary before switching
+const float LOD_HYSTERESIS = 0.25f;
+
+Model::Model(bool gamma)
+	: gammaCorrection(gamma), mergeByMaterial(true), center(0.0f), radius(0.0f), fullDetailPixels(512.0f), cullPixels(2.0f), currentLod(0), imported(false), resident(false), uploadCursor(0)
 {
-	loadModel(path, isUV_flipped);
+}
+
+Model::Model(string const& path, bool isUV_flipped, bool gamma)
+	: gammaCorrection(gamma), mergeByMaterial(true), center(0.0f), radius(0.0f), fullDetailPixels(512.0f), cullPixels(2.0f), currentLod(0), imported(false), resident(false), uploadCursor(0)
+{
+	ThreadPool pool;
+	import(path, pool, isUV_flipped);
+	upload();
+}
+
+Model::~Model()
+{
+	for (Mesh& mesh : meshes)
+		for (Texture& texture : mesh.textures)
+			TextureRegistry::instance().release(texture.id);
 }
 
 void Model::Draw(Shader* shader)
 {
+	if (!resident)
+		return;
 	for (unsigned int i = 0; i < meshes.size(); i++)
 		meshes[i].Draw(shader);
 }
 
-void Model::loadModel(string const& path, bool isUV_flipped)
+void Model::Draw(Shader* shader, const glm::mat4& model, const LodView& view)
 {
-	Assimp::Importer importer;
-	const aiScene* scene;
+	if (!imported)
+		return;
+	glm::vec3 worldCenter = glm::vec3(model * glm::vec4(center, 1.0f));
+	float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+	float worldRadius = radius * scale;
+	float distance = glm::length(worldCenter - view.cameraPosition);
+
+	// inside the sphere counts as full detail
+	float level = 0.0f;
+	if (distance > worldRadius)
+	{
+		float pixels = 2.0f * worldRadius * view.projectionScale / distance;
+		if (pixels < cullPixels)
+			return;
+		level = glm::max(log2f(fullDetailPixels / pixels), 0.0f);
+	}
+	if (!resident)
+	{
+		drawProxy(shader);
+		return;
+	}
+	if (level < currentLod - LOD_HYSTERESIS || level >= currentLod + 1.0f + LOD_HYSTERESIS)
+		currentLod = glm::min((unsigned int)level, MAX_MESH_LODS - 1);
+
+	// UV units one pixel spans on the nearest point of each mesh, picks the mips TextureStreamer keeps
+	for (const Mesh& mesh : meshes)
+	{
+		if (mesh.textures.empty() || (mesh.virtualTexture && mesh.virtualTexture->isReady()))
+			continue;
+		float meshDistance = glm::length(glm::vec3(model * glm::vec4(mesh.center, 1.0f)) - view.cameraPosition) - mesh.radius * scale;
+		float uvPerPixel = meshDistance > 0.0f ? mesh.uvDensity * meshDistance / (scale * view.projectionScale) : 0.0f;
+		for (const Texture& texture : mesh.textures)
+			TextureStreamer::instance().touch(texture.id, uvPerPixel);
+	}
+
+	if (!view.cullClusters || currentLod != 0)
+	{
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].Draw(shader, currentLod);
+		return;
+	}
+
+	// frustum planes of pv * model come out in model space
+	MeshletCulling culling;
+	culling.cameraPosition = glm::vec3(glm::inverse(model) * glm::vec4(view.cameraPosition, 1.0f));
+	glm::mat4 m = glm::transpose(view.viewProjection * model);
+	for (int i = 0; i < 3; i++)
+	{
+		culling.frustum[i * 2] = m[3] + m[i];
+		culling.frustum[i * 2 + 1] = m[3] - m[i];
+	}
+	for (glm::vec4& plane : culling.frustum)
+		plane /= glm::length(glm::vec3(plane));
+	for (unsigned int i = 0; i < meshes.size(); i++)
+		meshes[i].Draw(shader, currentLod, &culling);
+}
+
+void Model::import(string const& path, ThreadPool& pool, bool isUV_flipped)
+{
+	unsigned int importFlags = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace;
 	if (isUV_flipped)
-		scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace | aiProcess_FlipUVs);
+		importFlags |= aiProcess_FlipUVs;
+	directory = path.substr(0, path.find_last_of('/'));
+
+	// glTF is read natively, its manifest has to be parsed first to know which buffers key the cache
+	GltfScene gltf;
+	bool isGltf = path.size() > 5 && path.compare(path.size() - 5, 5, ".gltf") == 0;
+	if (isGltf)
+	{
+		auto start = chrono::steady_clock::now();
+		if (!gltf.open(path))
+		{
+			cout << "ERROR::GLTF:: " << gltf.error << endl;
+			return;
+		}
+		importStats.add(STAGE_PARSE, start);
+		importFlags = GLTF_CACHE_FLAGS;
+	}
+
+	// warm start: the cooked cache already holds the final vertex/index arrays
+	unsigned int importOptions = mergeByMaterial ? IMPORT_MERGE_BY_MATERIAL : 0;
+	if (importedCache.open(path, importFlags, importOptions, gltf.bufferPaths()))
+	{
+		for (unsigned int i = 0; i < importedCache.meshCount(); i++)
+			importedMeshes.push_back(importedCache.mesh(i));
+		nodes = importedCache.nodes();
+	}
+	else if (isGltf)
+	{
+		vector<glm::mat4> placements;
+		for (const GltfScene::Instance& instance : gltf.instances)
+			placements.push_back(instance.transform);
+		importedData.nodes = gltf.nodes;
+		convertMeshes(path, pool, placements, [&gltf](unsigned int i) { return gltf.convert(i); });
+	}
 	else
-		scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace);
-	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
 	{
-		cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+		auto start = chrono::steady_clock::now();
+		Assimp::Importer importer;
+		importer.SetIOHandler(new AssetIOSystem());
+		const aiScene* scene = importer.ReadFile(path, 0);
+		importStats.add(STAGE_PARSE, start);
+		if (scene)
+		{
+			start = chrono::steady_clock::now();
+			scene = importer.ApplyPostProcessing(importFlags);
+			importStats.add(STAGE_POST_PROCESS, start);
+		}
+		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+		{
+			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+			return;
+		}
+
+		vector<aiMesh*> sources;
+		vector<glm::mat4> placements;
+		processNode(scene->mRootNode, scene, -1, glm::mat4(1.0f), importedData, sources, placements);
+		convertMeshes(path, pool, placements, [this, &sources, scene](unsigned int i) { return processMesh(sources[i], scene); });
+	}
+	gltf.close();
+
+	// prepare every distinct image that isn't resident yet once, all at the same time
+	map<string, future<PreparedTexture>> decodes;
+	for (const MeshView& mesh : importedMeshes)
+		for (const TextureRef& ref : mesh.textures)
+			if (decodes.find(ref.path) == decodes.end())
+			{
+				string filename = directory + '/' + ref.path;
+				if (TextureRegistry::instance().contains(TextureRegistry::makeKey(filename, gammaCorrection)))
+					continue;
+				TextureUsage usage = textureUsage(ref);
+				bool gamma = gammaCorrection;
+				decodes[ref.path] = pool.submit([filename, usage, gamma]() {
+					auto start = chrono::steady_clock::now();
+					PreparedTexture texture = prepareTexture(filename, usage, gamma);
+					importStats.add(STAGE_DECODE, start);
+					return texture;
+				});
+			}
+	for (auto& decode : decodes)
+		importedImages[decode.first] = pool.wait(decode.second);
+
+	// bounding sphere of every placed vertex, the proxy and LOD selection only need this much
+	const vector<glm::mat4> baked(1, glm::mat4(1.0f));
+	glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+	for (const MeshView& mesh : importedMeshes)
+		for (const glm::mat4& placement : mesh.instances.empty() ? baked : mesh.instances)
+			for (const Vertex& vertex : mesh.vertices)
+			{
+				glm::vec3 position = glm::vec3(placement * glm::vec4(vertex.Position, 1.0f));
+				lo = glm::min(lo, position);
+				hi = glm::max(hi, position);
+			}
+	center = importedMeshes.empty() ? glm::vec3(0.0f) : (lo + hi) * 0.5f;
+	float radiusSquared = 0.0f;
+	for (const MeshView& mesh : importedMeshes)
+		for (const glm::mat4& placement : mesh.instances.empty() ? baked : mesh.instances)
+			for (const Vertex& vertex : mesh.vertices)
+			{
+				glm::vec3 offset = glm::vec3(placement * glm::vec4(vertex.Position, 1.0f)) - center;
+				radiusSquared = glm::max(radiusSquared, glm::dot(offset, offset));
+			}
+	radius = sqrtf(radiusSquared);
+	imported = true;
+}
+
+void Model::convertMeshes(const string& path, ThreadPool& pool, const vector<glm::mat4>& placements, const function<MeshData(unsigned int)>& convert)
+{
+	// every placement converts in its mesh's own space on the pool
+	vector<MeshData> sources(placements.size());
+	vector<uint64_t> hashes(placements.size());
+	vector<future<void>> conversions;
+	for (unsigned int i = 0; i < placements.size(); i++)
+	{
+		conversions.push_back(pool.submit([i, &convert, &sources, &hashes]() {
+			auto start = chrono::steady_clock::now();
+			sources[i] = convert(i);
+			hashes[i] = hashMeshContent(sources[i]);
+			importStats.add(STAGE_CONVERT, start);
+		}));
+	}
+	for (future<void>& conversion : conversions)
+		pool.wait(conversion);
+
+	// placements of the same content share one mesh, mirrored ones apart since their winding differs
+	vector<vector<unsigned int>> groups;
+	vector<unsigned int> groupOf(placements.size());
+	unordered_map<uint64_t, vector<unsigned int>> groupsByHash;
+	for (unsigned int i = 0; i < placements.size(); i++)
+	{
+		bool mirrored = glm::determinant(glm::mat3(placements[i])) < 0.0f;
+		vector<unsigned int>& candidates = groupsByHash[hashBytes(&mirrored, sizeof(mirrored), hashes[i])];
+		auto group = find_if(candidates.begin(), candidates.end(), [&](unsigned int g) { return sameMeshContent(sources[groups[g][0]], sources[i]); });
+		if (group == candidates.end())
+		{
+			candidates.push_back((unsigned int)groups.size());
+			groups.emplace_back();
+			group = candidates.end() - 1;
+		}
+		groups[*group].push_back(i);
+		groupOf[i] = *group;
+	}
+
+	unsigned int instanced = 0;
+	vector<MeshData> distinct(groups.size());
+	for (unsigned int g = 0; g < groups.size(); g++)
+	{
+		MeshData& mesh = distinct[g];
+		mesh = move(sources[groups[g][0]]);
+		if (groups[g].size() == 1)
+		{
+			bakeTransform(mesh, placements[groups[g][0]]);
+			continue;
+		}
+		for (unsigned int i : groups[g])
+			mesh.instances.push_back(placements[i]);
+		if (glm::determinant(glm::mat3(mesh.instances[0])) < 0.0f)
+			mirror(mesh);
+		instanced++;
+	}
+	sources.clear();
+
+	// every distinct mesh optimizes independently on the pool
+	conversions.clear();
+	vector<MeshOptimizeReport> reports(distinct.size());
+	for (unsigned int i = 0; i < distinct.size(); i++)
+	{
+		conversions.push_back(pool.submit([i, &distinct, &reports]() {
+			auto start = chrono::steady_clock::now();
+			reports[i] = optimizeMesh(distinct[i]);
+			importStats.add(STAGE_OPTIMIZE, start);
+		}));
+	}
+	for (future<void>& conversion : conversions)
+		pool.wait(conversion);
+
+	// Baked meshes binding the same textures (what Mesh::Draw sees of a material) merge into one
+	// buffer drawn in one call; each keeps its LOD 0 range as a part so it is still culled on its own.
+	// Instanced meshes stay apart, and so do point and line meshes.
+	vector<unsigned int> meshOf(distinct.size());
+	map<vector<string>, unsigned int> mergedByTextures;
+	unsigned int merged = 0;
+	for (unsigned int g = 0; g < distinct.size(); g++)
+	{
+		MeshData& mesh = distinct[g];
+		meshOf[g] = (unsigned int)importedData.meshes.size();
+		if (!mergeByMaterial || !mesh.instances.empty() || mesh.indices.empty() || mesh.indices.size() % 3 != 0)
+		{
+			importedData.meshes.push_back(move(mesh));
+			continue;
+		}
+		vector<string> material;
+		for (const TextureRef& texture : mesh.textures)
+			material.push_back(texture.type + ' ' + texture.path);
+		auto target = mergedByTextures.find(material);
+		if (target == mergedByTextures.end())
+		{
+			target = mergedByTextures.insert({ material, meshOf[g] }).first;
+			importedData.meshes.emplace_back();
+			importedData.meshes.back().textures = mesh.textures;
+		}
+		else
+			merged++;
+		meshOf[g] = target->second;
+		appendPart(importedData.meshes[target->second], mesh);
+		mesh = MeshData();
+	}
+	distinct.clear();
+	for (NodeData& node : importedData.nodes)
+	{
+		for (unsigned int& mesh : node.meshes)
+			mesh = meshOf[groupOf[mesh]];
+		sort(node.meshes.begin(), node.meshes.end());
+		node.meshes.erase(unique(node.meshes.begin(), node.meshes.end()), node.meshes.end());
+	}
+
+	// LODs simplify the merged buffers whole, meshlets are cut per part
+	conversions.clear();
+	for (unsigned int i = 0; i < importedData.meshes.size(); i++)
+	{
+		conversions.push_back(pool.submit([this, i]() {
+			auto start = chrono::steady_clock::now();
+			generateLods(importedData.meshes[i]);
+			buildMeshlets(importedData.meshes[i]);
+			importStats.add(STAGE_OPTIMIZE, start);
+		}));
+	}
+	for (future<void>& conversion : conversions)
+		pool.wait(conversion);
+	cout << "Vertex cache (ACMR / ATVR, FIFO " << VERTEX_CACHE_SIZE << ") for " << path << ":" << endl;
+	for (unsigned int i = 0; i < reports.size(); i++)
+		cout << "  mesh " << i << ": " << reports[i].before.acmr << " / " << reports[i].before.atvr
+			<< " -> " << reports[i].after.acmr << " / " << reports[i].after.atvr << endl;
+	cout << "Instancing for " << path << ": " << placements.size() << " placements in " << groups.size()
+		<< " meshes, " << instanced << " of them instanced" << endl;
+	cout << "Merging by material for " << path << ": " << groups.size() << " meshes in " << importedData.meshes.size()
+		<< " draws, " << merged << " merged into another" << endl;
+	importedCache.write(importedData);
+
+	for (MeshData& mesh : importedData.meshes)
+		importedMeshes.push_back({ mesh.vertices, mesh.indices, mesh.textures, mesh.lods, mesh.meshlets, mesh.parts, mesh.instances });
+	nodes = importedData.nodes;
+}
+
+void Model::upload()
+{
+	uploadStep(SIZE_MAX, true);
+}
+
+size_t Model::uploadBytes(const MeshView& mesh) const
+{
+	// textures only queue here, TextureUploader stages them under its own budget
+	return mesh.vertices.size * sizeof(PackedVertex) + mesh.indices.size * (mesh.vertices.size <= 65536 ? 2 : 4)
+		+ mesh.instances.size() * sizeof(glm::mat4);
+}
+
+size_t Model::uploadStep(size_t budget, bool force)
+{
+	if (resident)
+		return 0;
+	auto start = chrono::steady_clock::now();
+	size_t uploaded = 0;
+	meshes.reserve(importedMeshes.size());
+	while (uploadCursor < importedMeshes.size())
+	{
+		const MeshView& mesh = importedMeshes[uploadCursor];
+		size_t bytes = uploadBytes(mesh);
+		if (uploaded + bytes > budget && !(force && uploaded == 0))
+			break;
+		meshes.emplace_back(mesh.vertices, mesh.indices, loadMaterialTextures(mesh.textures), mesh.lods, mesh.meshlets, mesh.instances, mesh.parts);
+		// the texture is in the registry now, drop the decoded copy early
+		for (const TextureRef& ref : mesh.textures)
+			importedImages.erase(ref.path);
+		uploaded += bytes;
+		uploadCursor++;
+	}
+
+	if (uploadCursor == importedMeshes.size())
+	{
+		resident = true;
+		proxy.reset();
+		importedMeshes.clear();
+		importedImages.clear();
+		importedData = ModelData();
+		importedCache.close();
+	}
+	importStats.add(STAGE_UPLOAD, start);
+	return uploaded;
+}
+
+void Model::drawProxy(Shader* shader)
+{
+	if (radius <= 0.0f)
 		return;
+	// one neutral grey texture and a flat normal map, shared by every proxy
+	static unsigned int proxyTextures[2] = { 0, 0 };
+	if (!proxyTextures[0])
+	{
+		const unsigned char grey[4] = { 128, 128, 128, 255 }, flat[4] = { 128, 128, 255, 255 };
+		const unsigned char* pixels[2] = { grey, flat };
+		glGenTextures(2, proxyTextures);
+		for (int i = 0; i < 2; i++)
+		{
+			glBindTexture(GL_TEXTURE_2D, proxyTextures[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels[i]);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
 	}
-	directory = path.substr(0, path.find_last_of('/'));
 
-	processNode(scene->mRootNode, scene);
+	if (!proxy)
+	{
+		// a UV sphere in model space around the bounding sphere
+		const unsigned int rings = 12, segments = 24;
+		vector<Vertex> vertices;
+		vector<unsigned int> indices;
+		for (unsigned int r = 0; r <= rings; r++)
+			for (unsigned int s = 0; s <= segments; s++)
+			{
+				float theta = glm::pi<float>() * r / rings, phi = 2.0f * glm::pi<float>() * s / segments;
+				Vertex vertex = {};
+				vertex.Normal = glm::vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+				vertex.Position = center + vertex.Normal * radius;
+				vertex.TexCoords = glm::vec2(float(s) / segments, float(r) / rings);
+				vertex.Tangent = glm::vec3(-sinf(phi), 0.0f, cosf(phi));
+				vertex.Bitangent = glm::cross(vertex.Normal, vertex.Tangent);
+				vertices.push_back(vertex);
+			}
+		for (unsigned int r = 0; r < rings; r++)
+			for (unsigned int s = 0; s < segments; s++)
+			{
+				unsigned int a = r * (segments + 1) + s, b = a + segments + 1;
+				indices.insert(indices.end(), { a, a + 1, b, b, a + 1, b + 1 });
+			}
+		vector<Texture> textures = { { proxyTextures[0], "texture_diffuse", "" }, { proxyTextures[1], "texture_normal", "" } };
+		proxy.reset(new Mesh(move(vertices), move(indices), move(textures)));
+		proxy->releaseCpuCopy();
+	}
+	proxy->Draw(shader);
 }
 
-void Model::processNode(aiNode* node, const aiScene* scene)
+void Model::processNode(aiNode* node, const aiScene* scene, int parent, const glm::mat4& parentTransform, ModelData& data,
+	vector<aiMesh*>& sources, vector<glm::mat4>& placements)
 {
+	NodeData nodeData;
+	nodeData.name = node->mName.C_Str();
+	nodeData.transform = glm::transpose(glm::make_mat4(&node->mTransformation.a1));
+	nodeData.parent = parent;
+	glm::mat4 world = parentTransform * nodeData.transform;
 	for (unsigned int i = 0; i < node->mNumMeshes; i++)
 	{
 		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		meshes.push_back(processMesh(mesh, scene));
+		nodeData.meshes.push_back((unsigned int)sources.size());
+		sources.push_back(mesh);
+		placements.push_back(world);
 	}
+	int index = (int)data.nodes.size();
+	data.nodes.push_back(nodeData);
 	for (unsigned int i = 0; i < node->mNumChildren; i++)
 	{
-		processNode(node->mChildren[i], scene);
+		processNode(node->mChildren[i], scene, index, world, data, sources, placements);
 	}
 
 }
 
-Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene)
+MeshData Model::processMesh(aiMesh* mesh, const aiScene* scene)
 {
-	vector<Vertex> vertices;
-	vector<unsigned int> indices;
-	vector<Texture> textures;
+	MeshData data;
+	vector<Vertex>& vertices = data.vertices;
+	vector<unsigned int>& indices = data.indices;
+	vector<TextureRef>& textures = data.textures;
+	vertices.reserve(mesh->mNumVertices);
+	indices.reserve(mesh->mNumFaces * 3);
 	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
 	{	
-		Vertex vertex;
+		Vertex vertex = {};
 		glm::vec3 vector;
 		// positions
 		vector.x = mesh->mVertices[i].x;
@@ -109,87 +692,284 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene)
 	aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
 
 	// 1. diffuse maps
-	vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
+	vector<TextureRef> diffuseMaps = materialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
 	textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
 	// 2. specular maps
-	vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
+	vector<TextureRef> specularMaps = materialTextures(material, aiTextureType_SPECULAR, "texture_specular");
 	textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
 	// 3. normal maps
-	std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
+	std::vector<TextureRef> normalMaps = materialTextures(material, aiTextureType_HEIGHT, "texture_normal");
 	textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
 	// 4. height maps
-	std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
+	std::vector<TextureRef> heightMaps = materialTextures(material, aiTextureType_AMBIENT, "texture_height");
 	textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
-	return Mesh(vertices, indices, textures);
+	return data;
 }
 
-vector<Texture> Model::loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
+void Model::releaseCpuCopies()
 {
-	vector<Texture> textures;
-	for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+	for (Mesh& mesh : meshes)
+		mesh.releaseCpuCopy();
+}
+
+size_t Model::cpuBytes() const
+{
+	size_t bytes = meshes.capacity() * sizeof(Mesh) + nodes.capacity() * sizeof(NodeData);
+	for (const Mesh& mesh : meshes)
+		bytes += mesh.cpuBytes() + mesh.textures.capacity() * sizeof(Texture);
+	for (const NodeData& node : nodes)
+		bytes += node.name.capacity() + node.meshes.capacity() * sizeof(unsigned int);
+	return bytes;
+}
+
+// sums the mip levels the driver reports for the texture, from the base level streaming left it at
+static size_t textureBytes(unsigned int id)
+{
+	size_t bytes = 0;
+	glBindTexture(GL_TEXTURE_2D, id);
+	GLint base = 0;
+	glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, &base);
+	for (GLint level = base;; level++)
 	{
-		aiString str;
-		mat->GetTexture(type, i, &str);
-		bool skip = false;
-		for (unsigned int j = 0; j < textures_loaded.size(); j++)
+		GLint width = 0, height = 0, compressed = 0;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+		if (width == 0 || height == 0)
+			break;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED, &compressed);
+		if (compressed)
 		{
-			if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
+			GLint size = 0;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+			bytes += size;
+		}
+		else
+		{
+			GLint bits = 0;
+			const GLenum channels[] = { GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE, GL_TEXTURE_ALPHA_SIZE };
+			for (GLenum channel : channels)
 			{
-				textures.push_back(textures_loaded[j]);
-				skip = true;
-				break;
+				GLint channelBits = 0;
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, level, channel, &channelBits);
+				bits += channelBits;
 			}
+			bytes += size_t(width) * height * bits / 8;
 		}
-		if (!skip)
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return bytes;
+}
+
+size_t Model::gpuBytes() const
+{
+	size_t bytes = 0;
+	vector<unsigned int> seen;
+	for (const Mesh& mesh : meshes)
+	{
+		bytes += mesh.gpuBytes();
+		for (const Texture& texture : mesh.textures)
+			if (find(seen.begin(), seen.end(), texture.id) == seen.end())
+			{
+				seen.push_back(texture.id);
+				bytes += textureBytes(texture.id);
+			}
+	}
+	return bytes;
+}
+
+void Model::printMemoryReport(const string& name) const
+{
+	size_t placements = 0;
+	for (const Mesh& mesh : meshes)
+		placements += !mesh.instances.empty() ? mesh.instances.size() : max(mesh.parts.size(), size_t(1));
+	cout << name << ": " << meshes.size() << " meshes in " << placements << " placements, CPU " << cpuBytes() / 1024.0 << " KiB, GPU "
+		<< gpuBytes() / 1024.0 << " KiB" << endl;
+}
+
+vector<VirtualTextureLayer> Model::virtualTextureLayers() const
+{
+	for (const Mesh& mesh : meshes)
+	{
+		const Texture* diffuse = nullptr;
+		const Texture* normal = nullptr;
+		for (const Texture& texture : mesh.textures)
+			if (texture.type == "texture_diffuse" && !diffuse)
+				diffuse = &texture;
+			else if (texture.type == "texture_normal" && !normal)
+				normal = &texture;
+		if (diffuse && normal)
+			return { { directory + '/' + diffuse->path, TextureUsage::Color, gammaCorrection },
+				{ directory + '/' + normal->path, TextureUsage::Normal, false } };
+	}
+	return {};
+}
+
+vector<TextureRef> Model::importedTextures() const
+{
+	vector<TextureRef> refs;
+	for (const MeshView& mesh : importedMeshes)
+		for (const TextureRef& ref : mesh.textures)
 		{
-			Texture texture;
-			texture.id = TextureFromFile(str.C_Str(), this->directory);
-			texture.type = typeName;
-			texture.path = str.C_Str();
-			textures.push_back(texture);
-			textures_loaded.push_back(texture);
+			TextureRef texture = { ref.type, directory + '/' + ref.path };
+			if (find_if(refs.begin(), refs.end(), [&](const TextureRef& r) { return r.path == texture.path; }) == refs.end())
+				refs.push_back(texture);
 		}
+	return refs;
+}
+
+void Model::setVirtualTexture(VirtualTexture* texture)
+{
+	vector<VirtualTextureLayer> layers = virtualTextureLayers();
+	if (layers.empty())
+		return;
+	for (Mesh& mesh : meshes)
+		for (const Texture& diffuse : mesh.textures)
+			if (diffuse.type == "texture_diffuse" && directory + '/' + diffuse.path == layers[0].source)
+				mesh.virtualTexture = texture;
+}
+
+vector<TextureRef> Model::materialTextures(aiMaterial* mat, aiTextureType type, string typeName)
+{
+	vector<TextureRef> refs;
+	for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+	{
+		aiString str;
+		mat->GetTexture(type, i, &str);
+		refs.push_back({ typeName, str.C_Str() });
 	}
-	return textures;
+	return refs;
 }
 
-unsigned int TextureFromFile(const char* path, const string& directory, bool gamma)
+vector<Texture> Model::loadMaterialTextures(const vector<TextureRef>& refs)
 {
-	string filename = string(path);
-	filename = directory + '/' + filename;
+	vector<Texture> textures;
+	for (const TextureRef& ref : refs)
+	{
+		Texture texture;
+		texture.id = TextureRegistry::instance().acquire(TextureRegistry::makeKey(directory + '/' + ref.path, gammaCorrection), [&]() {
+			TextureUsage usage = textureUsage(ref);
+			auto decoded = importedImages.find(ref.path);
+			if (decoded == importedImages.end())
+				return TextureFromFile(ref.path.c_str(), this->directory, gammaCorrection, usage, true);
+			return uploadPreparedTexture(decoded->second, directory + '/' + ref.path, gammaCorrection, true);
+		});
+		texture.type = ref.type;
+		texture.path = ref.path;
+		textures.push_back(texture);
+	}
+	return textures;
+}
 
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
+ImageData::ImageData(ImageData&& other) noexcept
+	: pixels(other.pixels), width(other.width), height(other.height), components(other.components)
+{
+	other.pixels = nullptr;
+}
 
-	int width, height, nrComponents;
-	unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (data)
+ImageData& ImageData::operator=(ImageData&& other) noexcept
+{
+	if (this != &other)
 	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
+		stbi_image_free(pixels);
+		pixels = other.pixels;
+		width = other.width;
+		height = other.height;
+		components = other.components;
+		other.pixels = nullptr;
+	}
+	return *this;
+}
 
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
+ImageData::~ImageData()
+{
+	stbi_image_free(pixels);
+}
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+ImportStats::ImportStats()
+{
+	for (int i = 0; i < STAGE_COUNT; i++)
+		microseconds[i] = 0;
+}
 
-		stbi_image_free(data);
-	}
-	else
+void ImportStats::add(ImportStage stage, chrono::steady_clock::time_point start)
+{
+	microseconds[stage] += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// high-water mark of the process working set
+static size_t peakResidentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return size_t(usage.ru_maxrss);
+#else
+	return size_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+void ImportStats::print(double wallSeconds) const
+{
+	static const char* names[STAGE_COUNT] = { "parse", "post-process", "convert", "optimize", "decode", "upload" };
+	cout << "Import finished in " << wallSeconds * 1000.0 << " ms (stage times summed over threads):" << endl;
+	for (int i = 0; i < STAGE_COUNT; i++)
+		cout << "  " << names[i] << ": " << microseconds[i] / 1000.0 << " ms" << endl;
+	cout << "  peak RSS: " << peakResidentBytes() / (1024.0 * 1024.0) << " MiB" << endl;
+}
+
+ImageData decodeImage(const string& filename)
+{
+	ImageData image;
+	AssetFile file;
+	if (VirtualFileSystem::instance().open(filename, file))
+		image.pixels = stbi_load_from_memory(file.data(), (int)file.size(), &image.width, &image.height, &image.components, 0);
+	return image;
+}
+
+TextureUsage textureUsage(const TextureRef& ref)
+{
+	return ref.type == "texture_normal" ? TextureUsage::Normal : TextureUsage::Color;
+}
+
+PreparedTexture prepareTexture(const string& filename, TextureUsage usage, bool gamma)
+{
+	PreparedTexture texture;
+	texture.compressed = loadCookedTexture(filename, usage, gamma);
+	if (!texture.compressed)
+		texture.image = decodeImage(filename);
+	return texture;
+}
+
+unsigned int uploadPreparedTexture(PreparedTexture& texture, const string& filename, bool gamma, bool streamed)
+{
+	if (texture.compressed)
 	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
+		unsigned int textureID = streamed ? TextureStreamer::instance().add(move(texture.compressed))
+			: TextureUploader::instance().upload(move(texture.compressed));
+		if (textureID)
+			return textureID;
+		// the driver lacks the block format, fall back to the source pixels
+		texture.image = decodeImage(filename);
 	}
+	if (!texture.image.pixels)
+		cout << "Texture failed to load at path: " << filename << endl;
+	return TextureUploader::instance().upload(move(texture.image), gamma);
+}
 
-	return textureID;
-}
\ No newline at end of file
+unsigned int TextureFromFile(const char* path, const string& directory, bool gamma, TextureUsage usage, bool streamed)
+{
+	string filename = string(path);
+	filename = directory + '/' + filename;
+
+	PreparedTexture texture = prepareTexture(filename, usage, gamma);
+	return uploadPreparedTexture(texture, filename, gamma, streamed);
+}
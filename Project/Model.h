@@ -2,7 +2,15 @@
 #define MODEL_H
 
 #include "Mesh.h"
+#include "MeshCache.h"
 #include "Shader.h"
+#include "TextureCook.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -10,24 +18,135 @@
 using namespace std;
 
 
+// Decoded pixels waiting for upload, frees them on destruction
+struct ImageData {
+    unsigned char* pixels;
+    int width, height, components;
+
+    ImageData() : pixels(nullptr), width(0), height(0), components(0) {}
+    ImageData(ImageData&& other) noexcept;
+    ImageData& operator=(ImageData&& other) noexcept;
+    ImageData(const ImageData&) = delete;
+    ImageData& operator=(const ImageData&) = delete;
+    ~ImageData();
+};
+
+// A texture ready for upload: the cooked block-compressed chain, or raw pixels if cooking failed
+struct PreparedTexture {
+    unique_ptr<CompressedTexture> compressed;
+    ImageData image;
+};
+
+enum ImportStage { STAGE_PARSE, STAGE_POST_PROCESS, STAGE_CONVERT, STAGE_OPTIMIZE, STAGE_DECODE, STAGE_UPLOAD, STAGE_COUNT };
+
+// Time spent per import stage, summed over all threads
+struct ImportStats {
+    atomic<long long> microseconds[STAGE_COUNT];
+
+    ImportStats();
+    void add(ImportStage stage, chrono::steady_clock::time_point start);
+    void print(double wallSeconds) const;
+};
+
+// Camera terms Model::Draw needs to size a model on screen and cull its meshlets
+struct LodView {
+    glm::vec3 cameraPosition;
+    float projectionScale;  // viewport height / (2 * tan(fovy / 2))
+    // meshlet culling against the pass's frustum, off for passes that see more than the camera
+    glm::mat4 viewProjection;
+    bool cullClusters;
+};
+
 class Model
 {
 public:
-    vector<Texture> textures_loaded;
     vector<Mesh> meshes;
+    vector<NodeData> nodes;
     string directory;
     bool gammaCorrection;
+    // import option: baked meshes with the same textures share one buffer and one draw, set before import()
+    bool mergeByMaterial;
+    // bounding sphere of all meshes in model space
+    glm::vec3 center;
+    float radius;
+    // full detail while the bounding sphere covers at least fullDetailPixels,
+    // one LOD coarser per halving, not drawn at all below cullPixels
+    float fullDetailPixels;
+    float cullPixels;
 
+    static ImportStats importStats;
+
+    Model(bool gamma = false);
     Model(string const& path, bool isUV_flipped = true, bool gamma = false);
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+    ~Model();
+    // always the most detailed LOD
     void Draw(Shader* shader);
+    // picks the LOD from the projected size of the bounding sphere, model is the matrix the shader got
+    void Draw(Shader* shader, const glm::mat4& model, const LodView& view);
+
+    // CPU half of loading (parse, convert, decode), safe to run on a worker.
+    // .gltf files are read natively, anything else goes through Assimp.
+    // Also sets the bounding sphere, so the proxy can be drawn as soon as it returns.
+    void import(string const& path, ThreadPool& pool, bool isUV_flipped = true);
+    // GL half of loading, must run on the thread owning the context
+    void upload();
+    // Uploads meshes (with the textures they bring in) until about budget bytes went to the GPU,
+    // the first one regardless when force is set. Returns the bytes uploaded.
+    size_t uploadStep(size_t budget, bool force);
+    // every mesh is on the GPU; until then Draw shows a bounding-sphere proxy
+    bool isResident() const { return resident; }
+
+    // frees the CPU vertex/index copies of every mesh
+    void releaseCpuCopies();
+    // bytes held on the CPU and GPU; textures shared with other models count for each of them
+    size_t cpuBytes() const;
+    size_t gpuBytes() const;
+    void printMemoryReport(const string& name) const;
+
+    // albedo and normal of the first mesh that has both, as the layers of a virtual texture
+    vector<VirtualTextureLayer> virtualTextureLayers() const;
+    // tags the meshes sampling those textures; they switch over once texture is ready
+    void setVirtualTexture(VirtualTexture* texture);
+    // every texture the imported meshes reference, paths relative to the working directory
+    vector<TextureRef> importedTextures() const;
 
 private:
-    void loadModel(string const& path, bool isUV_flipped);
-    void processNode(aiNode* node, const aiScene* scene);
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene);
-    vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName);
+    unsigned int currentLod;
+    // set by import() once the bounding sphere is known, read by Draw on the GL thread
+    atomic<bool> imported;
+    bool resident;
+    size_t uploadCursor;
+    unique_ptr<Mesh> proxy;
+
+    // results of import() kept until upload()
+    ModelData importedData;
+    MeshCache importedCache;
+    vector<MeshView> importedMeshes;
+    map<string, PreparedTexture> importedImages;
+
+    size_t uploadBytes(const MeshView& mesh) const;
+    void drawProxy(Shader* shader);
+    // Converts placement i with convert(i) on the pool, in its mesh's own space. Placements with the same
+    // content become one mesh drawn instanced, the others get their transform baked in.
+    // Then optimizes the distinct meshes, merges them by material when mergeByMaterial is set
+    // and caches the result; node mesh indices are remapped to the final meshes.
+    void convertMeshes(const string& path, ThreadPool& pool, const vector<glm::mat4>& placements, const function<MeshData(unsigned int)>& convert);
+    void processNode(aiNode* node, const aiScene* scene, int parent, const glm::mat4& parentTransform, ModelData& data,
+        vector<aiMesh*>& sources, vector<glm::mat4>& placements);
+    MeshData processMesh(aiMesh* mesh, const aiScene* scene);
+    vector<TextureRef> materialTextures(aiMaterial* mat, aiTextureType type, string typeName);
+    vector<Texture> loadMaterialTextures(const vector<TextureRef>& refs);
 };
 
-unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false);
+ImageData decodeImage(const string& filename);
+// normal maps cook to BC5, every other material texture is colour
+TextureUsage textureUsage(const TextureRef& ref);
+PreparedTexture prepareTexture(const string& filename, TextureUsage usage, bool gamma = false);
+// Hands the data to TextureUploader, the texture fills in over the next frames.
+// streamed cooked textures are left to TextureStreamer, which keeps the mips their draws need.
+unsigned int uploadPreparedTexture(PreparedTexture& texture, const string& filename, bool gamma = false, bool streamed = false);
+unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false, TextureUsage usage = TextureUsage::Color, bool streamed = false);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,195 @@
+#include "ProgramCache.h"
+#include "MappedFile.h"
+#include "VirtualFileSystem.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+	const char PROGRAM_MAGIC[4] = { 'P', 'R', 'G', 'B' };
+
+	uint64_t hashString(const string& text, uint64_t seed)
+	{
+		// the terminating zero keeps the boundary between stages in the hash
+		return hashBytes(text.c_str(), text.size() + 1, seed);
+	}
+
+	string glString(GLenum name)
+	{
+		const char* text = (const char*)glGetString(name);
+		return text ? text : "";
+	}
+}
+
+ProgramCache::ProgramCache() : checked(false), getProgramBinary(nullptr), programBinary(nullptr), programParameteri(nullptr),
+	driverHash(0), loaded(0), compiled(0), rejected(0), loadSeconds(0), compileSeconds(0), savedSeconds(0)
+{
+}
+
+ProgramCache& ProgramCache::instance()
+{
+	static ProgramCache cache;
+	return cache;
+}
+
+bool ProgramCache::supported()
+{
+	if (checked)
+		return getProgramBinary != nullptr;
+	checked = true;
+
+	GLint major = 0, minor = 0, formats = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (major > 4 || (major == 4 && minor >= 1) || hasGLExtension("GL_ARB_get_program_binary"))
+	{
+		getProgramBinary = (PFNGLGETPROGRAMBINARYPROC)getGLProcAddress("glGetProgramBinary");
+		programBinary = (PFNGLPROGRAMBINARYPROC)getGLProcAddress("glProgramBinary");
+		programParameteri = (PFNGLPROGRAMPARAMETERIPROC)getGLProcAddress("glProgramParameteri");
+	}
+	// some drivers export the calls but take no binary format at all
+	if (getProgramBinary)
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (!getProgramBinary || !programBinary || !programParameteri || formats == 0)
+	{
+		getProgramBinary = nullptr;
+		return false;
+	}
+
+	driverHash = hashBytes(&PROGRAM_CACHE_VERSION, sizeof(PROGRAM_CACHE_VERSION));
+	driverHash = hashString(glString(GL_VENDOR), driverHash);
+	driverHash = hashString(glString(GL_RENDERER), driverHash);
+	driverHash = hashString(glString(GL_VERSION), driverHash);
+	return true;
+}
+
+uint64_t ProgramCache::key(const string& vertex, const string& fragment, const string& geometry)
+{
+	if (!supported())
+		return 0;
+	uint64_t hash = hashString(vertex, driverHash);
+	hash = hashString(fragment, hash);
+	return hashString(geometry, hash);
+}
+
+string ProgramCache::cachePath(uint64_t key)
+{
+	ostringstream path;
+	path << "cache/shaders/" << hex << setw(16) << setfill('0') << key << ".bin";
+	return path.str();
+}
+
+bool ProgramCache::load(uint64_t key, unsigned int program, double& compileSeconds)
+{
+	if (!supported())
+		return false;
+	string path = cachePath(key);
+	AssetFile file;
+	if (!VirtualFileSystem::instance().open(path, file) || file.size() < sizeof(ProgramFileHeader))
+		return false;
+
+	const ProgramFileHeader* header = reinterpret_cast<const ProgramFileHeader*>(file.data());
+	if (memcmp(header->magic, PROGRAM_MAGIC, 4) != 0 || header->version != PROGRAM_CACHE_VERSION
+		|| header->key != key || file.size() != sizeof(ProgramFileHeader) + header->length)
+	{
+		file.close();
+		finishLoad(key, false, 0.0, 0.0);
+		return false;
+	}
+	// the link status waits for the driver, it is asked for when the program is needed
+	programBinary(program, header->format, file.data() + sizeof(ProgramFileHeader), header->length);
+	compileSeconds = header->compileSeconds;
+	return true;
+}
+
+void ProgramCache::finishLoad(uint64_t key, bool linked, double seconds, double compileTime)
+{
+	// a driver may turn down binaries of its own older builds; this one is replaced by the next store()
+	if (!linked)
+	{
+		error_code ec;
+		filesystem::remove(cachePath(key), ec);
+		rejected++;
+		return;
+	}
+	loaded++;
+	loadSeconds += seconds;
+	savedSeconds += compileTime - seconds;
+}
+
+void ProgramCache::prepare(unsigned int program)
+{
+	if (supported())
+		programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+void ProgramCache::store(uint64_t key, unsigned int program, double seconds)
+{
+	compiled++;
+	compileSeconds += seconds;
+	if (!supported())
+		return;
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	vector<char> buffer(sizeof(ProgramFileHeader) + length);
+	ProgramFileHeader* header = reinterpret_cast<ProgramFileHeader*>(buffer.data());
+	memcpy(header->magic, PROGRAM_MAGIC, 4);
+	header->version = PROGRAM_CACHE_VERSION;
+	header->key = key;
+	header->compileSeconds = seconds;
+	GLsizei written = 0;
+	GLenum format = 0;
+	getProgramBinary(program, length, &written, &format, buffer.data() + sizeof(ProgramFileHeader));
+	if (written <= 0)
+		return;
+	header->format = format;
+	header->length = (uint32_t)written;
+	buffer.resize(sizeof(ProgramFileHeader) + written);
+
+	// write to a temporary name first so a crash never leaves a torn binary behind
+	string path = cachePath(key);
+	string tmpPath = path + ".tmp";
+	error_code ec;
+	filesystem::create_directories(filesystem::path(path).parent_path(), ec);
+	{
+		ofstream out(tmpPath, ios::binary | ios::trunc);
+		if (!out.write(buffer.data(), buffer.size()))
+		{
+			cout << "ERROR::PROGRAM_CACHE:: Couldn't write " << tmpPath << endl;
+			return;
+		}
+	}
+	filesystem::rename(tmpPath, path, ec);
+	if (ec)
+	{
+		cout << "ERROR::PROGRAM_CACHE:: Couldn't write " << path << ": " << ec.message() << endl;
+		filesystem::remove(tmpPath, ec);
+	}
+}
+
+void ProgramCache::printReport() const
+{
+	if (!getProgramBinary)
+	{
+		cout << "Program cache: no program binaries on this driver, " << compiled << " programs compiled in "
+			<< compileSeconds * 1000.0 << " ms" << endl;
+		return;
+	}
+	cout << "Program cache: " << loaded << " of " << loaded + compiled << " programs from binaries in "
+		<< loadSeconds * 1000.0 << " ms, saved " << savedSeconds * 1000.0 << " ms against compiling them; "
+		<< compiled << " compiled in " << compileSeconds * 1000.0 << " ms";
+	if (rejected)
+		cout << ", " << rejected << " binaries rejected";
+	cout << endl;
+}
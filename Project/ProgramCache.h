@@ -0,0 +1,65 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "GLExtensions.h"
+using namespace std;
+
+const uint32_t PROGRAM_CACHE_VERSION = 2;
+
+// cache/shaders/<key>.bin: this header, then the driver's binary
+struct ProgramFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;            // binaryFormat glGetProgramBinary reported
+    uint32_t length;
+    double compileSeconds;      // submission to link status when built from source, to report what loading saves
+};
+
+// Linked programs saved with glGetProgramBinary and restored with glProgramBinary on the next start.
+// Keys cover the stage sources as compiled (header and defines included) and the driver's vendor,
+// renderer and version, so a driver update never sees an old binary. A binary the driver rejects is
+// deleted and the caller compiles from source. Times run from submitting a program until its link
+// status is known, so they include the driver's compiler threads; a program finished late (after the
+// startup loads) counts the wait too. Does nothing without GL 4.1 or ARB_get_program_binary.
+// GL thread only.
+class ProgramCache
+{
+public:
+    static ProgramCache& instance();
+
+    bool supported();
+    // key of a program built from these stages, geometry may be empty
+    uint64_t key(const string& vertex, const string& fragment, const string& geometry);
+    // Hands the cached binary to program (made by glCreateProgram), false when there is none. The
+    // driver may still reject it: once the link status is known the caller reports it to finishLoad().
+    bool load(uint64_t key, unsigned int program, double& compileSeconds);
+    // Outcome of a load(); a rejected binary is deleted, the caller then compiles from source
+    void finishLoad(uint64_t key, bool linked, double seconds, double compileSeconds);
+    // Before glLinkProgram, so the driver keeps what store() reads back
+    void prepare(unsigned int program);
+    // Saves a successfully linked program along with what compiling it took
+    void store(uint64_t key, unsigned int program, double compileSeconds);
+
+    // "n of m programs from binaries in x ms, saved y ms against compiling them"
+    void printReport() const;
+
+private:
+    bool checked;
+    PFNGLGETPROGRAMBINARYPROC getProgramBinary;
+    PFNGLPROGRAMBINARYPROC programBinary;
+    PFNGLPROGRAMPARAMETERIPROC programParameteri;
+    uint64_t driverHash;
+
+    size_t loaded, compiled, rejected;
+    double loadSeconds, compileSeconds, savedSeconds;
+
+    ProgramCache();
+    static string cachePath(uint64_t key);
+};
+
+#endif
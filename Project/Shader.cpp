@@ -1,142 +1,570 @@
 #include "Shader.h"
+#include "GLExtensions.h"
+#include "MappedFile.h"
+#include "ProgramCache.h"
+#include "VirtualFileSystem.h"
 #include <glm\gtc\type_ptr.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace
+{
+	const GLint UNRESOLVED_UNIFORM = -2;
+
+	// handle ids are indices into names, registered from any thread (meshes are built on workers)
+	struct UniformRegistry {
+		std::mutex mutex;
+		std::vector<std::string> names;
+		std::unordered_map<std::string, unsigned int> ids;
+	};
+
+	// handles at namespace scope in other files register during static initialization
+	UniformRegistry& uniformRegistry()
+	{
+		static UniformRegistry registry;
+		return registry;
+	}
+
+	unsigned int frameStringLookups = 0;
+	unsigned int previousFrameStringLookups = 0;
+
+	std::string sourceHeader;
+	std::vector<std::pair<std::string, unsigned int>> blockBindings;
+
+	// submitted and not finished yet, in submission order
+	std::vector<Shader*> pendingPrograms;
+	// 0 not asked yet, 1 no parallel compile, 2 the driver reports completion
+	int parallelCompile = 0;
+
+	bool parallelCompileAvailable()
+	{
+		if (parallelCompile)
+			return parallelCompile == 2;
+		parallelCompile = 1;
+		const char* setThreads = nullptr;
+		if (hasGLExtension("GL_KHR_parallel_shader_compile"))
+			setThreads = "glMaxShaderCompilerThreadsKHR";
+		else if (hasGLExtension("GL_ARB_parallel_shader_compile"))
+			setThreads = "glMaxShaderCompilerThreadsARB";
+		if (setThreads)
+		{
+			// as many compiler threads as the driver wants to use
+			PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)getGLProcAddress(setThreads);
+			if (maxThreads)
+				maxThreads(0xFFFFFFFFu);
+			parallelCompile = 2;
+		}
+		return parallelCompile == 2;
+	}
+
+	double secondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// the global header in place of #version, then the variant's defines
+	void prepareSource(std::string& source, const ShaderDefines& defines)
+	{
+		size_t version = source.find("#version");
+		if (version == std::string::npos)
+			return;
+		size_t end = source.find('\n', version);
+		end = end == std::string::npos ? source.size() : end + 1;
+		if (!sourceHeader.empty())
+		{
+			source.replace(version, end - version, sourceHeader);
+			end = version + sourceHeader.size();
+		}
+		source.insert(end, defines.source());
+	}
+
+	// samplers take their unit as an int, bools may be set through ints and the other way round
+	bool uniformTypeMatches(GLenum active, GLenum wanted)
+	{
+		if (active == wanted)
+			return true;
+		if (wanted == GL_INT || wanted == GL_BOOL)
+			return active == GL_INT || active == GL_BOOL || active == GL_SAMPLER_2D || active == GL_SAMPLER_3D
+				|| active == GL_SAMPLER_CUBE || active == GL_SAMPLER_2D_ARRAY || active == GL_SAMPLER_2D_SHADOW
+				|| active == GL_SAMPLER_CUBE_SHADOW;
+		return false;
+	}
+}
+
+unsigned int registerUniformName(const std::string& name)
+{
+	UniformRegistry& registry = uniformRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	auto found = registry.ids.find(name);
+	if (found != registry.ids.end())
+		return found->second;
+	unsigned int id = (unsigned int)registry.names.size();
+	registry.names.push_back(name);
+	registry.ids[name] = id;
+	return id;
+}
+
+// through the asset pack when one is mounted
+static bool readShaderSource(const char* path, std::string& source)
+{
+	AssetFile file;
+	if (!VirtualFileSystem::instance().open(path, file))
+		return false;
+	source.assign(reinterpret_cast<const char*>(file.data()), file.size());
+	return true;
+}
+
+// #include "name" lines in place of the file next to the stage's, one level deep; a #line after each
+// keeps the compiler's line numbers those of the stage file
+static bool expandIncludes(const char* path, std::string& source)
+{
+	std::string directory = path;
+	size_t slash = directory.find_last_of("/\\");
+	directory = slash == std::string::npos ? "" : directory.substr(0, slash + 1);
+
+	bool expanded = true;
+	std::string result;
+	size_t copied = 0, lineNumber = 1;
+	size_t line = source.find("#include \"");
+	while (line != std::string::npos)
+	{
+		size_t nameStart = line + 10;
+		size_t nameEnd = source.find('"', nameStart);
+		size_t end = source.find('\n', line);
+		end = end == std::string::npos ? source.size() : end + 1;
+		if (nameEnd == std::string::npos || nameEnd >= end)
+			break;
+		std::string name = source.substr(nameStart, nameEnd - nameStart);
+		std::string included;
+		if (!readShaderSource((directory + name).c_str(), included))
+		{
+			std::cout << "ERROR::SHADER::INCLUDE_NOT_FOUND " << directory + name << " in " << path << std::endl;
+			expanded = false;
+		}
+		if (!included.empty() && included.back() != '\n')
+			included += '\n';
+		lineNumber += std::count(source.begin() + copied, source.begin() + end, '\n');
+		result.append(source, copied, line - copied);
+		result += included + "#line " + std::to_string(lineNumber) + "\n";
+		copied = end;
+		line = source.find("#include \"", end);
+	}
+	if (copied == 0)
+		return expanded;
+	result.append(source, copied, std::string::npos);
+	source.swap(result);
+	return expanded;
+}
+
 unsigned int Shader::ID()
 {
 	return programID;
 }
 
-Shader::Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath)
+ShaderDefines::ShaderDefines() : hash(hashBytes("", 0))
 {
-	const char* vShaderCode;
-	const char* fShaderCode;
-	std::string geometryCode;
+}
+
+ShaderDefines::ShaderDefines(std::initializer_list<std::string> names) : defines(names), hash(hashBytes("", 0))
+{
+	std::sort(defines.begin(), defines.end());
+	defines.erase(std::unique(defines.begin(), defines.end()), defines.end());
+	// the terminating zero keeps {"AB"} and {"A", "B"} apart
+	for (const std::string& define : defines)
+		hash = hashBytes(define.c_str(), define.size() + 1, hash);
+}
 
-	std::string vTempString;
-	std::string fTempString;
-	std::ifstream gShaderFile;
+bool ShaderDefines::has(const std::string& name) const
+{
+	return std::binary_search(defines.begin(), defines.end(), name);
+}
 
-	std::ifstream vShaderFile;
-	std::ifstream fShaderFile;
-	vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-	fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-	gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+std::string ShaderDefines::source() const
+{
+	std::string lines;
+	for (const std::string& define : defines)
+		lines += "#define " + define + "\n";
+	return lines;
+}
+
+// what a program needs until its link status is known
+struct Shader::PendingProgram {
+	std::string sources[3];     // vertex, fragment, geometry (empty without one)
+	unsigned int stages[3];     // 0 where there is no stage
+	bool fromBinary;
+	// when the binary or the sources went to the driver; the time until the link status is known
+	// includes the driver's compiler threads, which thread time on this side misses
+	std::chrono::steady_clock::time_point submitted;
+	double compileSeconds;      // recorded with the binary
+};
+
+Shader::Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath, const ShaderDefines& defines)
+	: programID(0), cacheKey(0), pending(new PendingProgram()), uniformCount(0)
+{
+	parallelCompileAvailable();
+	std::string* sources = pending->sources;
 
-	try
+	bool loaded = readShaderSource(vertexPath, sources[0]) && readShaderSource(fragmentPath, sources[1]);
+	//      ,    
+	if (geometryPath != nullptr)
+		loaded = readShaderSource(geometryPath, sources[2]) && loaded;
+	loaded = loaded && expandIncludes(vertexPath, sources[0]) && expandIncludes(fragmentPath, sources[1])
+		&& (geometryPath == nullptr || expandIncludes(geometryPath, sources[2]));
+	if (!loaded)
+		std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+	for (std::string& source : pending->sources)
+		prepareSource(source, defines);
+
+	// a binary from an earlier run skips compiling and linking altogether
+	programID = glCreateProgram();
+	cacheKey = ProgramCache::instance().key(sources[0], sources[1], sources[2]);
+	pending->submitted = std::chrono::steady_clock::now();
+	pending->fromBinary = ProgramCache::instance().load(cacheKey, programID, pending->compileSeconds);
+	if (!pending->fromBinary)
+		compileSources();
+	pendingPrograms.push_back(this);
+}
+
+void Shader::compileSources()
+{
+	// a rejected binary's time doesn't count towards building from source
+	pending->submitted = std::chrono::steady_clock::now();
+	const GLenum types[3] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER };
+	for (int i = 0; i < 3; i++)
 	{
-		std::stringstream vShaderStream;
-		vShaderFile.open(vertexPath);
-		vShaderStream << vShaderFile.rdbuf();
-		vShaderFile.close();
-		vTempString = vShaderStream.str();
-		vShaderCode = vTempString.c_str();
+		pending->stages[i] = 0;
+		if (i == 2 && pending->sources[i].empty())
+			continue;
+		const char* code = pending->sources[i].c_str();
+		pending->stages[i] = glCreateShader(types[i]);
+		glShaderSource(pending->stages[i], 1, &code, NULL);
+		glCompileShader(pending->stages[i]);
+		glAttachShader(programID, pending->stages[i]);
+	}
+	ProgramCache::instance().prepare(programID);
+	// no status queries here, each one would wait for the driver
+	glLinkProgram(programID);
+	pending->fromBinary = false;
+}
 
-		std::stringstream fShaderStream;
-		fShaderFile.open(fragmentPath);
-		fShaderStream << fShaderFile.rdbuf();
-		fShaderFile.close();
-		fTempString = fShaderStream.str();
-		fShaderCode = fTempString.c_str();
-		//      ,    
-		if (geometryPath != nullptr)
+bool Shader::linkComplete() const
+{
+	// without parallel compile there's nothing to ask, finishing waits
+	if (!parallelCompileAvailable())
+		return true;
+	GLint complete = GL_FALSE;
+	glGetProgramiv(programID, GL_COMPLETION_STATUS_KHR, &complete);
+	return complete == GL_TRUE;
+}
+
+void Shader::finishLink()
+{
+	GLint linked = GL_FALSE;
+	glGetProgramiv(programID, GL_LINK_STATUS, &linked);
+	double seconds = secondsSince(pending->submitted);
+	if (pending->fromBinary)
+	{
+		ProgramCache::instance().finishLoad(cacheKey, linked == GL_TRUE, seconds, pending->compileSeconds);
+		if (!linked)
 		{
-			gShaderFile.open(geometryPath);
-			std::stringstream gShaderStream;
-			gShaderStream << gShaderFile.rdbuf();
-			gShaderFile.close();
-			geometryCode = gShaderStream.str();
+			compileSources();
+			return;
 		}
 	}
-	catch (std::ifstream::failure& e)
+	else
 	{
-		std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+		const char* names[3] = { "VERTEX", "FRAGMENT", "GEOMETRY" };
+		for (int i = 0; i < 3; i++)
+			if (pending->stages[i])
+				checkCompileErrors(pending->stages[i], names[i]);
+		checkCompileErrors(programID, "PROGRAM");
+		if (linked)
+			ProgramCache::instance().store(cacheKey, programID, seconds);
+		for (unsigned int stage : pending->stages)
+			if (stage)
+				glDeleteShader(stage);
 	}
+	reflectUniforms();
+	bindUniformBlocks();
+	pending.reset();
+	pendingPrograms.erase(std::find(pendingPrograms.begin(), pendingPrograms.end(), this));
+}
 
-	unsigned int vertex;
-	vertex = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertex, 1, &vShaderCode, NULL);
-	glCompileShader(vertex);
-	checkCompileErrors(vertex, "VERTEX");
+bool Shader::ready()
+{
+	if (pending && linkComplete())
+		finishLink();
+	return !pending;
+}
 
-	unsigned int fragment;
-	fragment = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragment, 1, &fShaderCode, NULL);
-	glCompileShader(fragment);
-	checkCompileErrors(fragment, "FRAGMENT");
+void Shader::wait()
+{
+	// a rejected binary goes around again, compiled from source
+	while (pending)
+		finishLink();
+}
 
-	unsigned int geometry;
-	if (geometryPath != nullptr)
+void Shader::finishPending()
+{
+	while (!pendingPrograms.empty())
 	{
-		const char* gShaderCode = geometryCode.c_str();
-		geometry = glCreateShader(GL_GEOMETRY_SHADER);
-		glShaderSource(geometry, 1, &gShaderCode, NULL);
-		glCompileShader(geometry);
-		checkCompileErrors(geometry, "GEOMETRY");
+		// finishing takes a program off the list
+		std::vector<Shader*> programs = pendingPrograms;
+		bool progress = false;
+		for (Shader* shader : programs)
+			progress = shader->ready() || progress;
+		if (!progress)
+			std::this_thread::yield();
 	}
-	programID = glCreateProgram();
-	glAttachShader(programID, vertex);
-	glAttachShader(programID, fragment);
-	if (geometryPath != nullptr)
-		glAttachShader(programID, geometry);
-	glLinkProgram(programID);
-	checkCompileErrors(programID, "PROGRAM");
-
-	glDeleteShader(vertex);
-	glDeleteShader(fragment);
-	if (geometryPath != nullptr)
-		glDeleteShader(geometry);
 }
 
 Shader::~Shader()
 {
+	if (pending)
+	{
+		for (unsigned int stage : pending->stages)
+			if (stage)
+				glDeleteShader(stage);
+		pendingPrograms.erase(std::find(pendingPrograms.begin(), pendingPrograms.end(), this));
+	}
 	glDeleteProgram(programID);
 }
 
 void Shader::use()
 {
+	if (pending)
+		wait();
 	glUseProgram(programID);
 }
 
+void Shader::set(const UniformHandle<bool>& uniform, bool value) const
+{
+	glUniform1i(handleLocation(uniform.id, GL_BOOL), (int)value);
+}
+
+void Shader::set(const UniformHandle<int>& uniform, int value) const
+{
+	glUniform1i(handleLocation(uniform.id, GL_INT), value);
+}
+
+void Shader::set(const UniformHandle<float>& uniform, float value) const
+{
+	glUniform1f(handleLocation(uniform.id, GL_FLOAT), value);
+}
+
+void Shader::set(const UniformHandle<glm::vec3>& uniform, const glm::vec3& vec) const
+{
+	glUniform3f(handleLocation(uniform.id, GL_FLOAT_VEC3), vec[0], vec[1], vec[2]);
+}
+
+void Shader::set(const UniformHandle<glm::vec4>& uniform, const glm::vec4& vec) const
+{
+	glUniform4f(handleLocation(uniform.id, GL_FLOAT_VEC4), vec[0], vec[1], vec[2], vec[3]);
+}
+
+void Shader::set(const UniformHandle<glm::mat4>& uniform, const glm::mat4& m) const
+{
+	glUniformMatrix4fv(handleLocation(uniform.id, GL_FLOAT_MAT4), 1, GL_FALSE, glm::value_ptr(m));
+}
+
 void Shader::setBool(const std::string& name, bool value) const
 {
-	glUniform1i(glGetUniformLocation(programID, name.c_str()), (int)value);
+	glUniform1i(nameLocation(name), (int)value);
 }
 
 void Shader::setInt(const std::string& name, int value) const
 {
-	glUniform1i(glGetUniformLocation(programID, name.c_str()), value);
+	glUniform1i(nameLocation(name), value);
 }
 
 void Shader::setFloat(const std::string& name, float value) const
 {
-	glUniform1f(glGetUniformLocation(programID, name.c_str()), value);
+	glUniform1f(nameLocation(name), value);
 }
 
 void Shader::setFloatVec(const std::string& name, float* vec, int vec_size) const
 {
 	switch (vec_size)
 	{
-	case 1: glUniform1f(glGetUniformLocation(programID, name.c_str()), vec[0]); break;
-	case 2: glUniform2f(glGetUniformLocation(programID, name.c_str()), vec[0], vec[1]); break;
-	case 3: glUniform3f(glGetUniformLocation(programID, name.c_str()), vec[0], vec[1], vec[2]); break;
-	case 4: glUniform4f(glGetUniformLocation(programID, name.c_str()), vec[0], vec[1], vec[2], vec[3]); break;
+	case 1: glUniform1f(nameLocation(name), vec[0]); break;
+	case 2: glUniform2f(nameLocation(name), vec[0], vec[1]); break;
+	case 3: glUniform3f(nameLocation(name), vec[0], vec[1], vec[2]); break;
+	case 4: glUniform4f(nameLocation(name), vec[0], vec[1], vec[2], vec[3]); break;
 	default: std::cout << "SHADER FAILURE! NO SUCH UNIFORM VECTOR SIZE!" << std::endl;
 	}
 }
 
 void Shader::setVec3(const std::string& name, glm::vec3 vec) const
 {
-	glUniform3f(glGetUniformLocation(programID, name.c_str()), vec[0], vec[1], vec[2]);
+	glUniform3f(nameLocation(name), vec[0], vec[1], vec[2]);
 }
 
 void Shader::setVec4(const std::string& name, glm::vec4 vec) const
 {
-	glUniform4f(glGetUniformLocation(programID, name.c_str()), vec[0], vec[1], vec[2], vec[3]);
+	glUniform4f(nameLocation(name), vec[0], vec[1], vec[2], vec[3]);
 }
 
 void Shader::setMatrix4F(const std::string& name, glm::mat4& m)
 {
-	glUniformMatrix4fv(glGetUniformLocation(programID, name.c_str()), 1, GL_FALSE, glm::value_ptr(m));
+	glUniformMatrix4fv(nameLocation(name), 1, GL_FALSE, glm::value_ptr(m));
+}
+
+void Shader::endFrame()
+{
+	previousFrameStringLookups = frameStringLookups;
+	frameStringLookups = 0;
+}
+
+unsigned int Shader::lastFrameStringLookups()
+{
+	return previousFrameStringLookups;
+}
+
+void Shader::setSourceHeader(const std::string& header)
+{
+	sourceHeader = header;
+}
+
+void Shader::setBlockBinding(const std::string& block, unsigned int binding)
+{
+	for (auto& existing : blockBindings)
+		if (existing.first == block)
+		{
+			existing.second = binding;
+			return;
+		}
+	blockBindings.push_back({ block, binding });
+}
+
+void Shader::bindUniformBlocks()
+{
+	for (const auto& block : blockBindings)
+	{
+		GLuint index = glGetUniformBlockIndex(programID, block.first.c_str());
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(programID, index, block.second);
+	}
+}
+
+void Shader::reflectUniforms()
+{
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(programID, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(programID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	size_t capacity = 8;
+	while (capacity < size_t(count) * 2)
+		capacity *= 2;
+	uniformTable.assign(capacity, { 0, std::string(), -1, 0 });
+	uniformCount = 0;
+
+	std::vector<char> buffer(std::max(maxLength, 1));
+	for (GLint i = 0; i < count; i++)
+	{
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(programID, GLuint(i), GLsizei(buffer.size()), &length, &size, &type, buffer.data());
+		std::string name(buffer.data(), length);
+		GLint location = glGetUniformLocation(programID, name.c_str());
+		// members of uniform blocks have no location
+		if (location < 0)
+			continue;
+		insertUniform(name, location, type);
+
+		// arrays of plain types come as name[0], their elements may not be contiguous locations in 3.3
+		if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+		{
+			std::string base = name.substr(0, name.size() - 3);
+			insertUniform(base, location, type);
+			for (GLint element = 1; element < size; element++)
+			{
+				std::string elementName = base + "[" + std::to_string(element) + "]";
+				insertUniform(elementName, glGetUniformLocation(programID, elementName.c_str()), type);
+			}
+		}
+	}
+}
+
+void Shader::insertUniform(const std::string& name, GLint location, GLenum type)
+{
+	// the table was sized for the active uniforms, array elements may outgrow it
+	if ((uniformCount + 1) * 2 > uniformTable.size())
+	{
+		std::vector<UniformSlot> old;
+		old.swap(uniformTable);
+		uniformTable.assign(old.size() * 2, { 0, std::string(), -1, 0 });
+		uniformCount = 0;
+		for (const UniformSlot& slot : old)
+			if (!slot.name.empty())
+				insertUniform(slot.name, slot.location, slot.type);
+	}
+
+	uint64_t hash = hashBytes(name.data(), name.size());
+	size_t mask = uniformTable.size() - 1;
+	for (size_t i = size_t(hash) & mask;; i = (i + 1) & mask)
+	{
+		UniformSlot& slot = uniformTable[i];
+		if (slot.name.empty() || (slot.hash == hash && slot.name == name))
+		{
+			uniformCount += slot.name.empty();
+			slot = { hash, name, location, type };
+			return;
+		}
+	}
+}
+
+const Shader::UniformSlot* Shader::findUniform(const std::string& name) const
+{
+	frameStringLookups++;
+	uint64_t hash = hashBytes(name.data(), name.size());
+	size_t mask = uniformTable.size() - 1;
+	for (size_t i = size_t(hash) & mask;; i = (i + 1) & mask)
+	{
+		const UniformSlot& slot = uniformTable[i];
+		if (slot.name.empty())
+			return nullptr;
+		if (slot.hash == hash && slot.name == name)
+			return &slot;
+	}
+}
+
+GLint Shader::handleLocation(unsigned int id, GLenum type) const
+{
+	if (id < handleLocations.size() && handleLocations[id] != UNRESOLVED_UNIFORM)
+		return handleLocations[id];
+	// nothing is known before linking, and nothing is remembered either
+	if (pending)
+		return -1;
+	if (id >= handleLocations.size())
+		handleLocations.resize(id + 1, UNRESOLVED_UNIFORM);
+
+	std::string name;
+	{
+		UniformRegistry& registry = uniformRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		name = registry.names[id];
+	}
+	// inactive uniforms are normal (optimized out, or meant for another program) and stay -1
+	const UniformSlot* slot = findUniform(name);
+	GLint location = -1;
+	if (slot && uniformTypeMatches(slot->type, type))
+		location = slot->location;
+	else if (slot)
+		std::cout << "ERROR::SHADER:: Uniform " << name << " is set with the wrong type" << std::endl;
+	handleLocations[id] = location;
+	return location;
+}
+
+GLint Shader::nameLocation(const std::string& name) const
+{
+	if (pending)
+		return -1;
+	const UniformSlot* slot = findUniform(name);
+	return slot ? slot->location : -1;
 }
 
 void Shader::checkCompileErrors(unsigned int shader, std::string type)
@@ -163,3 +591,31 @@ void Shader::checkCompileErrors(unsigned int shader, std::string type)
 	}
 }
 
+ShaderVariants::ShaderVariants(const char* vertexPath, const char* fragmentPath, const char* geometryPath)
+	: vertexPath(vertexPath), fragmentPath(fragmentPath), geometryPath(geometryPath ? geometryPath : "")
+{
+}
+
+void ShaderVariants::submit(const ShaderDefines& defines)
+{
+	Variant& variant = variants[defines.key()];
+	if (variant.shader)
+		return;
+	bool geometry = !geometryPath.empty() && !defines.has(SHADER_NO_GEOMETRY);
+	variant.shader.reset(new Shader(vertexPath.c_str(), fragmentPath.c_str(), geometry ? geometryPath.c_str() : nullptr, defines));
+	variant.setUp = false;
+}
+
+Shader* ShaderVariants::variant(const ShaderDefines& defines)
+{
+	submit(defines);
+	Variant& variant = variants[defines.key()];
+	if (!variant.setUp)
+	{
+		variant.shader->use();
+		if (setup)
+			setup(variant.shader.get());
+		variant.setUp = true;
+	}
+	return variant.shader.get();
+}
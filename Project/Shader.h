@@ -3,17 +3,81 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
 
+// Index of a uniform name in the process-wide registry, the same name always gets the same id
+unsigned int registerUniformName(const std::string& name);
+
+// Typed uniform name, usable with any Shader. The name is registered once when the handle is made;
+// each program resolves it to a location (and checks the GLSL type) the first time it is set, and
+// after that a set is an array index and the glUniform call. Keep handles around, don't make them per draw.
+template<class T>
+class UniformHandle
+{
+public:
+    explicit UniformHandle(const std::string& name) : id(registerUniformName(name)) {}
+    unsigned int id;
+};
+
+// Left out of a variant's defines by ShaderVariants, the geometry stage is then skipped and the
+// other stages see the define
+const char* const SHADER_NO_GEOMETRY = "NO_GEOMETRY_SHADER";
+
+// Preprocessor defines of one shader variant, "NAME" or "NAME value". Order doesn't matter, the
+// hash is taken over the sorted set once, so keep these around instead of building them per frame.
+class ShaderDefines
+{
+public:
+    ShaderDefines();
+    ShaderDefines(std::initializer_list<std::string> defines);
+
+    const std::vector<std::string>& names() const { return defines; }
+    bool has(const std::string& name) const;
+    uint64_t key() const { return hash; }
+    // the #define lines that go right after #version
+    std::string source() const;
+
+private:
+    std::vector<std::string> defines;
+    uint64_t hash;
+};
+
+// A program is submitted to the driver when constructed (a cached binary, or compile and link) and
+// finished the first time it is needed: link status, error log, uniform table. Until then the driver
+// can build it on its own threads while this one loads assets. Stages may #include "name" files
+// from their own directory.
 class Shader
 {
 public:
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr);
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr,
+        const ShaderDefines& defines = ShaderDefines());
     ~Shader();
+    // waits for the program when it isn't linked yet
     void use();
+
+    // True once linked, without waiting where the driver reports completion (parallel shader
+    // compile); elsewhere there's no asking, so this waits
+    bool ready();
+    void wait();
+    // Waits for every submitted program, finishing each as the driver completes it
+    static void finishPending();
+
+    void set(const UniformHandle<bool>& uniform, bool value) const;
+    void set(const UniformHandle<int>& uniform, int value) const;
+    void set(const UniformHandle<float>& uniform, float value) const;
+    void set(const UniformHandle<glm::vec3>& uniform, const glm::vec3& vec) const;
+    void set(const UniformHandle<glm::vec4>& uniform, const glm::vec4& vec) const;
+    void set(const UniformHandle<glm::mat4>& uniform, const glm::mat4& m) const;
+
+    // by name, a hash table lookup per call: fine for setup, use handles in the frame loop
     void setBool(const std::string& name, bool value) const;
     void setInt(const std::string& name, int value) const;
     void setFloat(const std::string& name, float value) const;
@@ -23,7 +87,71 @@ public:
     void setMatrix4F(const std::string& name, glm::mat4& m);
     unsigned int ID();
 
+    // Uniform lookups by string (set by name, first use of a handle) over all programs this
+    // frame; endFrame() moves the count to lastFrameStringLookups() and starts over
+    static void endFrame();
+    static unsigned int lastFrameStringLookups();
+
+    // Text that replaces the #version line of every stage compiled from now on, e.g. a newer
+    // version and the defines that select features in the sources
+    static void setSourceHeader(const std::string& header);
+    // Uniform blocks named block are bound to binding in every program linked from now on
+    static void setBlockBinding(const std::string& block, unsigned int binding);
+
 private:
+    struct PendingProgram;
+
+    // an active uniform as glGetActiveUniform reports it, arrays also under name[i] for every i
+    struct UniformSlot {
+        uint64_t hash;
+        std::string name;   // empty when the slot is free
+        GLint location;
+        GLenum type;
+    };
+
     unsigned int programID;
+    uint64_t cacheKey;
+    std::unique_ptr<PendingProgram> pending;       // null once linked
+    std::vector<UniformSlot> uniformTable;          // open addressing, power of two
+    size_t uniformCount;
+    mutable std::vector<GLint> handleLocations;     // handle id -> location, UNRESOLVED_UNIFORM until first use
+
     void checkCompileErrors(unsigned int shader, std::string type);
-};
\ No newline at end of file
+    void compileSources();
+    bool linkComplete() const;
+    // reads the link status (waiting for the driver), falls back to the sources on a rejected binary
+    void finishLink();
+    void reflectUniforms();
+    void bindUniformBlocks();
+    void insertUniform(const std::string& name, GLint location, GLenum type);
+    const UniformSlot* findUniform(const std::string& name) const;
+    // location of a handle, -1 (ignored by glUniform) when inactive or of another type
+    GLint handleLocation(unsigned int id, GLenum type) const;
+    GLint nameLocation(const std::string& name) const;
+};
+
+// One set of stage sources compiled under different defines. A variant is compiled the first time
+// it is asked for and kept under the hash of its defines, so callers choose features (no geometry
+// stage, no shadows) per draw instead of branching on uniforms inside the shaders.
+class ShaderVariants
+{
+public:
+    // Runs on every variant once it is linked, for uniforms that never change (sampler units)
+    std::function<void(Shader*)> setup;
+
+    ShaderVariants(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr);
+    // Starts building a variant that will be needed soon, without waiting for it
+    void submit(const ShaderDefines& defines);
+    // The linked variant, built (and waited for) here when it wasn't submitted before
+    Shader* variant(const ShaderDefines& defines);
+    size_t variantCount() const { return variants.size(); }
+
+private:
+    struct Variant {
+        std::unique_ptr<Shader> shader;
+        bool setUp;
+    };
+
+    std::string vertexPath, fragmentPath, geometryPath;
+    std::unordered_map<uint64_t, Variant> variants;
+};
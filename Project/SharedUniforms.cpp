@@ -0,0 +1,123 @@
+#include "SharedUniforms.h"
+#include "Shader.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+	// light buffers start with room for this many and double
+	const size_t INITIAL_STORAGE_LIGHTS = 16;
+
+	unsigned int createBuffer(GLenum target, size_t bytes)
+	{
+		unsigned int id;
+		glGenBuffers(1, &id);
+		glBindBuffer(target, id);
+		glBufferData(target, bytes, nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(target, 0);
+		return id;
+	}
+
+	// replaces the whole buffer so the driver can hand out new memory while last frame still reads the old
+	void uploadBuffer(GLenum target, unsigned int id, const void* data, size_t bytes)
+	{
+		glBindBuffer(target, id);
+		glBufferData(target, bytes, nullptr, GL_DYNAMIC_DRAW);
+		glBufferSubData(target, 0, bytes, data);
+		glBindBuffer(target, 0);
+	}
+}
+
+SharedUniforms::SharedUniforms() : frameBuffer(0), cameraBuffer(0), lightsBuffer(0), storageLights(false), lightsCapacity(0)
+{
+}
+
+SharedUniforms& SharedUniforms::instance()
+{
+	static SharedUniforms uniforms;
+	return uniforms;
+}
+
+void SharedUniforms::init()
+{
+	if (frameBuffer)
+		return;
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	// storage blocks need GLSL 4.30, the shaders declare the lights as a buffer block under this define
+	storageLights = major > 4 || (major == 4 && minor >= 3);
+	if (storageLights)
+		Shader::setSourceHeader("#version 430 core\n#define LIGHTS_IN_STORAGE_BUFFER\n");
+
+	frameBuffer = createBuffer(GL_UNIFORM_BUFFER, sizeof(FrameBlock));
+	cameraBuffer = createBuffer(GL_UNIFORM_BUFFER, sizeof(CameraBlock));
+	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_FRAME, frameBuffer);
+	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_CAMERA, cameraBuffer);
+	Shader::setBlockBinding("Frame", UNIFORM_BINDING_FRAME);
+	Shader::setBlockBinding("Camera", UNIFORM_BINDING_CAMERA);
+
+	lightsCapacity = storageLights ? INITIAL_STORAGE_LIGHTS : MAX_BLOCK_LIGHTS;
+	GLenum target = storageLights ? GL_SHADER_STORAGE_BUFFER : GL_UNIFORM_BUFFER;
+	lightsBuffer = createBuffer(target, sizeof(LightsHeader) + lightsCapacity * sizeof(LightData));
+	glBindBufferBase(target, storageLights ? STORAGE_BINDING_LIGHTS : (unsigned int)UNIFORM_BINDING_LIGHTS, lightsBuffer);
+	// the storage block states its binding in the shader, 3.3 has no layout(binding) for uniform blocks
+	if (!storageLights)
+		Shader::setBlockBinding("Lights", UNIFORM_BINDING_LIGHTS);
+}
+
+void SharedUniforms::setFrame(float farPlane)
+{
+	FrameBlock block = {};
+	block.farPlane = farPlane;
+	uploadBuffer(GL_UNIFORM_BUFFER, frameBuffer, &block, sizeof(block));
+}
+
+void SharedUniforms::setCamera(const glm::mat4& pv, const glm::vec3& viewPos)
+{
+	CameraBlock block = {};
+	block.pv = pv;
+	block.viewPos = viewPos;
+	uploadBuffer(GL_UNIFORM_BUFFER, cameraBuffer, &block, sizeof(block));
+}
+
+int SharedUniforms::setLights(const vector<Light*>& lights)
+{
+	vector<LightData> data;
+	for (const Light* light : lights)
+	{
+		if (!light->active || light->type == LightType::None)
+			continue;
+		if (!storageLights && data.size() == MAX_BLOCK_LIGHTS)
+			break;
+		LightData entry = {};
+		entry.type = int32_t(light->type);
+		entry.position = light->position;
+		entry.direction = light->direction;
+		entry.cutOff = light->cutOff;
+		entry.ambient = light->ambient;
+		entry.diffuse = light->diffuse;
+		entry.specular = light->specular;
+		entry.constant = light->constant;
+		entry.linear = light->linear;
+		entry.quadratic = light->quadratic;
+		data.push_back(entry);
+	}
+
+	GLenum target = storageLights ? GL_SHADER_STORAGE_BUFFER : GL_UNIFORM_BUFFER;
+	// the uniform block is always its full declared size, the storage buffer as large as the scene
+	while (data.size() > lightsCapacity)
+		lightsCapacity *= 2;
+	LightsHeader header = {};
+	header.count = int32_t(data.size());
+	lightsStaging.assign(sizeof(LightsHeader) + lightsCapacity * sizeof(LightData), 0);
+	memcpy(lightsStaging.data(), &header, sizeof(header));
+	if (!data.empty())
+		memcpy(lightsStaging.data() + sizeof(header), data.data(), data.size() * sizeof(LightData));
+	uploadBuffer(target, lightsBuffer, lightsStaging.data(), lightsStaging.size());
+	// a buffer that grew is a new store but the same name, the binding still holds
+	return header.count;
+}
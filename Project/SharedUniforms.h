@@ -0,0 +1,92 @@
+#ifndef SHARED_UNIFORMS_H
+#define SHARED_UNIFORMS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "GLExtensions.h"
+#include "Light.h"
+using namespace std;
+
+// Binding points of the blocks every lit program declares (see model.frag)
+enum UniformBinding { UNIFORM_BINDING_FRAME = 0, UNIFORM_BINDING_CAMERA = 1, UNIFORM_BINDING_LIGHTS = 2 };
+// The light array as a shader storage buffer, where the driver has them
+const unsigned int STORAGE_BINDING_LIGHTS = 0;
+// Array size of the light block without storage buffers, MAX_LIGHTS in the shaders
+const unsigned int MAX_BLOCK_LIGHTS = 4;
+
+// std140 mirrors of the blocks, field for field; the padding is where std140 puts it
+struct FrameBlock {
+    float farPlane;
+    float pad[3];
+};
+
+struct CameraBlock {
+    glm::mat4 pv;
+    glm::vec3 viewPos;
+    float pad;
+};
+
+// struct Light of the shaders, the same under std140 and std430 (vec3s align to 16 in both)
+struct LightData {
+    int32_t type;
+    float pad0[3];
+    glm::vec3 position;
+    float pad1;
+    glm::vec3 direction;
+    float cutOff;
+    glm::vec3 ambient;
+    float pad2;
+    glm::vec3 diffuse;
+    float pad3;
+    glm::vec3 specular;
+    float constant;
+    float linear;
+    float quadratic;
+    float pad4[2];
+};
+
+// lights_count, then the array from offset 16
+struct LightsHeader {
+    int32_t count;
+    int32_t pad[3];
+};
+
+static_assert(sizeof(FrameBlock) == 16, "Frame block is not std140");
+static_assert(offsetof(CameraBlock, viewPos) == 64 && sizeof(CameraBlock) == 80, "Camera block is not std140");
+static_assert(offsetof(LightData, position) == 16 && offsetof(LightData, direction) == 32 && offsetof(LightData, cutOff) == 44
+    && offsetof(LightData, ambient) == 48 && offsetof(LightData, diffuse) == 64 && offsetof(LightData, specular) == 80
+    && offsetof(LightData, constant) == 92 && offsetof(LightData, linear) == 96 && offsetof(LightData, quadratic) == 100
+    && sizeof(LightData) == 112, "Light struct is not std140");
+static_assert(sizeof(LightsHeader) == 16, "Light array must start at offset 16");
+
+// Frame, camera and light data shared by every program: each block is one buffer on a fixed
+// binding point, uploaded once per frame however many programs read it. With GL 4.3 the lights go
+// to a storage buffer that grows with the scene instead of a MAX_BLOCK_LIGHTS array. GL thread only.
+class SharedUniforms
+{
+public:
+    static SharedUniforms& instance();
+
+    // Creates the buffers and tells Shader the bindings and the light layout; call before the first Shader
+    void init();
+    bool lightsInStorage() const { return storageLights; }
+
+    void setFrame(float farPlane);
+    void setCamera(const glm::mat4& pv, const glm::vec3& viewPos);
+    // Packs the lights that are on, returns how many the shaders see
+    int setLights(const vector<Light*>& lights);
+
+private:
+    unsigned int frameBuffer, cameraBuffer, lightsBuffer;
+    bool storageLights;
+    size_t lightsCapacity;  // lights the buffer holds
+    vector<unsigned char> lightsStaging;
+
+    SharedUniforms();
+};
+
+#endif
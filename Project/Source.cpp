@@ -15,9 +15,20 @@
 #include <string>
 #include <vector>
 #include "Shader.h"
+#include "SharedUniforms.h"
 #include "Camera.h"
+#include "CookManifest.h"
+#include "AssetStreamer.h"
+#include "GeometryArena.h"
 #include "Model.h"
+#include "ProgramCache.h"
+#include "EnvironmentLighting.h"
 #include "Light.h"
+#include "TextureRegistry.h"
+#include "TextureStreamer.h"
+#include "TextureUploader.h"
+#include "VirtualTexture.h"
+#include "VirtualFileSystem.h"
 
 //ctrl+m ctrl +l
 
@@ -56,8 +67,19 @@ bool meteorAlarm = false, meteorEarthCollide = false, meteorMoonCollide = false,
 float cameraAngleX, cameraAngleY;
 double mouseX = SCR_WIDTH / 2, mouseY = SCR_HEIGHT / 2, mouseXtmp = 0, mouseYtmp = 0;
 
+// a cubemap on its way in: cooked BC1 faces with their mip chains, the decoded sources as the fallback
+struct CubemapLoad {
+	TextureKey key;
+	future<unique_ptr<CompressedTexture>> cook;
+	vector<future<ImageData>> decodes;
+	vector<std::string> faces;
+};
+
 void UpdatePolygoneMode();
-unsigned int loadCubemap(vector<std::string> faces);
+// The texture when it is already resident, otherwise 0 and the faces load on the pool
+unsigned int requestCubemap(CubemapLoad& load, const vector<std::string>& faces, ThreadPool& pool);
+// Once per frame on the GL thread until it returns the texture
+unsigned int finishCubemap(CubemapLoad& load, ThreadPool& pool);
 void processInput(GLFWwindow* win, double dt);
 void OnKeyAction(GLFWwindow* win, int key, int scancode, int action, int mods);
 void OnMouseKeyAction(GLFWwindow* win, int button, int action, int mods);
@@ -74,8 +96,20 @@ ModelTransform meteorTrans;
 ModelTransform earthTrans;
 ModelTransform moonTrans;
 
-int main()
+int main(int argc, char** argv)
 {
+	// "--pack" bundles res/ and shaders/ into the asset pack and exits, rerun it after editing assets
+	if (argc > 1 && std::string(argv[1]) == "--pack")
+		return writeAssetPack("assets.pak", { "res", "shaders" }) ? 0 : 1;
+	// when present every asset is read from the pack instead of hundreds of loose files
+	VirtualFileSystem::instance().mount("assets.pak");
+	// cooked data the offline cooker vouches for skips the per-asset staleness checks
+	if (CookManifest::instance().load(COOK_MANIFEST_PATH))
+		std::cout << "Cook manifest: " << CookManifest::instance().validate() << " of " << CookManifest::instance().all().size()
+			<< " assets current, the rest cook on first use" << std::endl;
+	else
+		std::cout << "No cook manifest, every asset checks its own cooked data; run the cooker to skip that" << std::endl;
+
 #pragma region WINDOW INITIALIZATION
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -204,23 +238,32 @@ int main()
 #pragma endregion
 
 #pragma region SHADERS INITIALIZATION
-	Shader* basic_shader = new Shader("shaders/basic.vert", "shaders/basic.frag");
+	// frame, camera and light blocks, before the programs so they link against the bindings
+	SharedUniforms::instance().init();
+	// lit programs come in variants, each draw picks the features it needs through defines
+	ShaderVariants basic_shaders("shaders/basic.vert", "shaders/basic.frag");
 	Shader* light_shader = new Shader("shaders/light.vert", "shaders/light.frag");
-	Shader* model_shader = new Shader("shaders/model.vert", "shaders/model.frag");
-	Shader* model_exp_shader = new Shader("shaders/model.vert", "shaders/model_exp.frag", "shaders/explode.geom");
+	ShaderVariants model_shaders("shaders/model.vert", "shaders/model.frag");
+	ShaderVariants model_exp_shaders("shaders/model.vert", "shaders/model_exp.frag", "shaders/explode.geom");
 	Shader* skybox_shader = new Shader("shaders/skybox.vert", "shaders/skybox.frag");
 	Shader* shaderBlur = new Shader("shaders/blur.vert", "shaders/blur.frag");
 	Shader* shaderBloomFinal = new Shader("shaders/bloom_final.vert", "shaders/bloom_final.frag");
 	Shader* simpleDepthShader = new Shader("shaders/point_shadows_depth.vert", "shaders/point_shadows_depth.frag", "shaders/point_shadows_depth.geom");
+	Shader* vtFeedbackShader = new Shader("shaders/model.vert", "shaders/vt_feedback.frag");
 
-	basic_shader->use();
-	basic_shader->setInt("ourTexture", 0);
-	basic_shader->setInt("depthMap", 1);
-	shaderBlur->use();
-	shaderBlur->setInt("image", 0);
-	shaderBloomFinal->use();
-	shaderBloomFinal->setInt("scene", 0);
-	shaderBloomFinal->setInt("bloomBlur", 1);
+	basic_shaders.setup = [](Shader* shader) {
+		shader->setInt("ourTexture", 0);
+		shader->setInt("depthMap", 1);
+	};
+	const ShaderDefines moonDefines, earthDefines{ "BLOOM" }, boxDefines{ "SHADOWS" };
+	const ShaderDefines issDefines, issIntactDefines{ SHADER_NO_GEOMETRY };
+	// every variant the frame loop draws with, the exploding ISS too so its first frame doesn't stall
+	model_shaders.submit(moonDefines);
+	model_shaders.submit(earthDefines);
+	model_exp_shaders.submit(issIntactDefines);
+	model_exp_shaders.submit(issDefines);
+	basic_shaders.submit(boxDefines);
+	// nothing above waited for the driver, the programs build while the objects below load
 #pragma endregion
 
 #pragma region OBJECTS INITIALIZATION
@@ -255,29 +298,36 @@ int main()
 
 	unsigned int box_texture = loadTexture("res\\images\\box.png", true);
 #pragma endregion
-	Model ISS("res/models/ISS/ISS.obj", true);
+	// models stream in on a worker pool and upload a slice per frame, only GL calls stay on this thread
+	ThreadPool importPool;
+	Model ISS, moon, earth, meteor;
+	AssetStreamer streamer(importPool);
+	streamer.request(ISS, "res/models/ISS/scene.gltf", "ISS");
+	streamer.request(moon, "res/models/Moon/scene.gltf", "moon");
+	streamer.request(earth, "res/models/earth/scene.gltf", "earth");
+	// the meteor is only requested once SPACE sets meteorAlarm
+	bool meteorRequested = false;
+	// the earth surface is tiled and streamed by what the camera sees once the model is in
+	VirtualTexture earthVirtual(importPool);
+	bool earthVirtualRequested = false;
 
 	ModelTransform ISSTrans = {
 	glm::vec3(-0.45f, 0.3f, 0.f),		// position
 	glm::vec3(0.f, 0.f, 90.f),		// rotation
 	glm::vec3(0.01f, 0.01f, 0.01f) };	// scale
 
-	Model moon("res/models/moon/moon.obj", true);
-
 	moonTrans = {
 	glm::vec3(0.f, 0.2f, 0.f),		// position
 	glm::vec3(0.f, 0.f, 0.f),		// rotation
 	glm::vec3(0.2f, 0.2f, 0.2f) };		// scale
 
 	//earth
-	Model earth("res/models/earth/earth.obj", true);
-
 	earthTrans = {
 	glm::vec3(0.f, 0.f, 0.f),		// position
 	glm::vec3(0.f, 0.f, -10.f),		// rotation
 	glm::vec3(0.1f, 0.1f, 0.1f) };		// scale
-
-	Model meteor("res/models/meteorite/meteoriteobj.obj", true);
+	// the earth glTF node hierarchy is 1000x the size earthTrans (and the earth box) was tuned for
+	const float EARTH_GLTF_SCALE = 0.001f;
 
 	meteorTrans = {
 	glm::vec3(-0.5f, 0.f, -0.5f),		// position
@@ -295,13 +345,32 @@ int main()
 		"res\\skyboxes\\space\\front.jpg",
 		"res\\skyboxes\\space\\back.jpg"
 	};
-	unsigned int cubemapTexture = loadCubemap(skyboxTexFaces);
+	// drawn once its faces are in, the GL thread doesn't wait for them
+	CubemapLoad skyboxLoad;
+	unsigned int cubemapTexture = requestCubemap(skyboxLoad, skyboxTexFaces, importPool);
+	// the skybox also lights the scene, prefiltered on the pool (cached after the first run)
+	EnvironmentLighting environment(importPool);
+	environment.open(skyboxTexFaces);
+	// above the mesh and virtual texture units
+	const unsigned int ENVIRONMENT_UNIT = 8;
+
+	// whatever the driver hasn't finished during the loads above is waited for here
+	auto shaderWait = chrono::steady_clock::now();
+	Shader::finishPending();
+	std::cout << "Shader programs linked, " << chrono::duration<double, milli>(chrono::steady_clock::now() - shaderWait).count()
+		<< " ms of waiting left after the startup loads" << std::endl;
+	ProgramCache::instance().printReport();
+	shaderBlur->use();
+	shaderBlur->setInt("image", 0);
+	shaderBloomFinal->use();
+	shaderBloomFinal->setInt("scene", 0);
+	shaderBloomFinal->setInt("bloomBlur", 1);
+
 #pragma endregion
 
 #pragma region LIGHT INITIALIZATION
 
 	vector<Light*> lights;
-	int active_lights = 0;
 
 	sunLight = new Light("Sun", true);
 	sunLight->initLikePointLight(
@@ -329,6 +398,19 @@ int main()
 	glm::vec3(.5f, .5f, .5f) };		// scale
 #pragma endregion
 
+	// everything the frame loop sets goes through handles, resolved once per program
+	struct FrameUniforms {
+		UniformHandle<glm::mat4> pv{ "pv" }, model{ "model" };
+		UniformHandle<glm::vec3> lightPos{ "lightPos" }, lightColor{ "lightColor" };
+		UniformHandle<float> blow{ "blow" };
+		UniformHandle<bool> horizontal{ "horizontal" };
+		UniformHandle<glm::vec3> materialAmbient{ "material.ambient" }, materialDiffuse{ "material.diffuse" }, materialSpecular{ "material.specular" };
+		UniformHandle<float> materialShininess{ "material.shininess" };
+	} uniforms;
+	vector<UniformHandle<glm::mat4>> shadowMatrixUniforms;
+	for (unsigned int i = 0; i < 6; ++i)
+		shadowMatrixUniforms.emplace_back("shadowMatrices[" + std::to_string(i) + "]");
+
 	double oldTime = glfwGetTime(), newTime, deltaTime;
 	while (!glfwWindowShouldClose(win))
 	{
@@ -339,6 +421,24 @@ int main()
 
 		processInput(win, deltaTime);
 
+		if (meteorAlarm && !meteorRequested)
+		{
+			streamer.request(meteor, "res/models/Meteorite/scene.gltf", "meteor");
+			meteorRequested = true;
+		}
+		streamer.update();
+		if (earth.isResident() && !earthVirtualRequested)
+		{
+			earthVirtual.open(earth.virtualTextureLayers());
+			earth.setVirtualTexture(&earthVirtual);
+			earthVirtualRequested = true;
+		}
+		earthVirtual.update();
+		environment.update();
+		if (!cubemapTexture)
+			cubemapTexture = finishCubemap(skyboxLoad, importPool);
+		TextureUploader::instance().update();
+
 		//flashLight->position = camera.Position - camera.Up * 0.01f;
 		//flashLight->direction = camera.Front;
 
@@ -408,13 +508,28 @@ int main()
 		glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
 		glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
 		glClear(GL_DEPTH_BUFFER_BIT);
+		SharedUniforms::instance().setFrame(far_plane);
 		simpleDepthShader->use();
 		for (unsigned int i = 0; i < 6; ++i)
-			simpleDepthShader->setMatrix4F("shadowMatrices[" + std::to_string(i) + "]", shadowTransforms[i]);
-		simpleDepthShader->setFloat("far_plane", far_plane);
+			simpleDepthShader->set(shadowMatrixUniforms[i], shadowTransforms[i]);
 		for (int i = 0; i < lights.size(); i++)
-			simpleDepthShader->setVec3("lightPos", lights[i]->position);
+			simpleDepthShader->set(uniforms.lightPos, lights[i]->position);
 		glm::mat4 model;
+		glm::mat4 p = camera.GetProjectionMatrix();
+		glm::mat4 v = camera.GetViewMatrix();
+		if (cameraRotationMode) {
+			v = glm::rotate(v, glm::radians(cameraAngleX), glm::vec3(0.f, 1.f, 0.f));
+			v = glm::rotate(v, glm::radians(cameraAngleY), glm::vec3(0.f, 1.f, 0.f));
+		}
+		glm::mat4 pv = p * v;
+		// the lit programs (and the feedback pass) read these from the shared blocks
+		SharedUniforms::instance().setCamera(pv, camera.Position);
+		SharedUniforms::instance().setLights(lights);
+
+		// every pass sizes the models for the main camera, only the main pass culls clusters
+		LodView lodView = { glm::vec3(glm::inverse(v)[3]), SCR_HEIGHT / (2.0f * tanf(glm::radians(camera.Fov) / 2.0f)), pv, true };
+		LodView shadowView = lodView;
+		shadowView.cullClusters = false;
 
 		// DRAWING MOON
 		model = glm::mat4(1.0f);
@@ -424,11 +539,11 @@ int main()
 		model = glm::rotate(model, glm::radians(moonTrans.rotation.z), glm::vec3(0.f, 0.f, 1.f));
 		model = glm::scale(model, moonTrans.scale);
 
-		simpleDepthShader->setMatrix4F("model", model);
-		moon.Draw(simpleDepthShader);
+		simpleDepthShader->set(uniforms.model, model);
+		moon.Draw(simpleDepthShader, model, shadowView);
 
 		//model = glm::scale(model, glm::vec3(0.7f, 0.7f, 0.7f));
-		//simpleDepthShader->setMatrix4F("model", model);
+		//simpleDepthShader->set(uniforms.model, model);
 		//renderCube();
 
 		// DRAWING ISS
@@ -439,8 +554,8 @@ int main()
 		model = glm::rotate(model, glm::radians(ISSTrans.rotation.z), glm::vec3(0.f, 0.f, 1.f));
 		model = glm::scale(model, ISSTrans.scale);
 
-		simpleDepthShader->setMatrix4F("model", model);
-		ISS.Draw(simpleDepthShader);
+		simpleDepthShader->set(uniforms.model, model);
+		ISS.Draw(simpleDepthShader, model, shadowView);
 
 
 		// DRAWING EARTH
@@ -453,13 +568,13 @@ int main()
 
 		if (!boxMode)
 		{
-			model = glm::scale(model, glm::vec3(3.f, 3.f, 3.f));
-			simpleDepthShader->setMatrix4F("model", model);
-			earth.Draw(simpleDepthShader);
+			model = glm::scale(model, glm::vec3(3.f, 3.f, 3.f) * EARTH_GLTF_SCALE);
+			simpleDepthShader->set(uniforms.model, model);
+			earth.Draw(simpleDepthShader, model, shadowView);
 		}
 		else {
 			model = glm::scale(model, glm::vec3(3.f, 3.f, 3.f));
-			simpleDepthShader->setMatrix4F("model", model);
+			simpleDepthShader->set(uniforms.model, model);
 			renderCube();
 		}
 		if (meteorAlarm)
@@ -472,8 +587,8 @@ int main()
 			model = glm::rotate(model, glm::radians(meteorTrans.rotation.z), glm::vec3(0.f, 0.f, 1.f));
 			model = glm::scale(model, meteorTrans.scale);
 
-			simpleDepthShader->setMatrix4F("model", model);
-			meteor.Draw(simpleDepthShader);
+			simpleDepthShader->set(uniforms.model, model);
+			meteor.Draw(simpleDepthShader, model, shadowView);
 		}
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 #pragma endregion
@@ -485,14 +600,6 @@ int main()
 		glClearColor(0.2f, 0.2f, 0.2f, 1.f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		glm::mat4 p = camera.GetProjectionMatrix();
-		glm::mat4 v = camera.GetViewMatrix();
-		if (cameraRotationMode) {
-			v = glm::rotate(v, glm::radians(cameraAngleX), glm::vec3(0.f, 1.f, 0.f));
-			v = glm::rotate(v, glm::radians(cameraAngleY), glm::vec3(0.f, 1.f, 0.f));
-		}
-		glm::mat4 pv = p * v;
-
 		// DRAWING MOON
 		model = glm::mat4(1.0f);
 		model = glm::translate(model, moonTrans.position);
@@ -503,41 +610,26 @@ int main()
 
 		if (!boxMode)
 		{
+			Shader* model_shader = model_shaders.variant(moonDefines);
 			model_shader->use();
-			model_shader->setMatrix4F("pv", pv);
-			model_shader->setMatrix4F("model", model);
-			model_shader->setVec3("viewPos", camera.Position);
-
-			active_lights = 0;
-			for (int i = 0; i < lights.size(); i++)
-				active_lights += lights[i]->putInShader(model_shader, active_lights);
-			model_shader->setInt("lights_count", active_lights);
-
-			model_shader->setFloat("far_plane", far_plane);
-			model_shader->setBool("shadows", true);
-			model_shader->setBool("blur", false);
+			model_shader->set(uniforms.model, model);
+			environment.bind(model_shader, ENVIRONMENT_UNIT);
 
 
-			moon.Draw(model_shader);
+			moon.Draw(model_shader, model, lodView);
 		}
 		else
 		{
 			// DRAWING MOON-BOX
+			Shader* basic_shader = basic_shaders.variant(boxDefines);
 			basic_shader->use();
-			basic_shader->setMatrix4F("pv", pv);
-			basic_shader->setVec3("viewPos", camera.Position);
-			active_lights = 0;
-			for (int i = 0; i < lights.size(); i++)
-				active_lights += lights[i]->putInShader(basic_shader, active_lights);
 			model = glm::scale(model, glm::vec3(0.7f, 0.7f, 0.7f));
-			basic_shader->setInt("lights_count", active_lights);
-			basic_shader->setMatrix4F("model", model);
-			basic_shader->setFloat("far_plane", far_plane);
-			basic_shader->setVec3("material.ambient", cubeMaterials[cubeMat].ambient);
-			basic_shader->setVec3("material.diffuse", cubeMaterials[cubeMat].diffuse);
-			basic_shader->setVec3("material.specular", cubeMaterials[cubeMat].specular);
-			basic_shader->setFloat("material.shininess", cubeMaterials[cubeMat].shininess);
-			basic_shader->setBool("shadows", true);
+			basic_shader->set(uniforms.model, model);
+			basic_shader->set(uniforms.materialAmbient, cubeMaterials[cubeMat].ambient);
+			basic_shader->set(uniforms.materialDiffuse, cubeMaterials[cubeMat].diffuse);
+			basic_shader->set(uniforms.materialSpecular, cubeMaterials[cubeMat].specular);
+			basic_shader->set(uniforms.materialShininess, cubeMaterials[cubeMat].shininess);
+			environment.bind(basic_shader, ENVIRONMENT_UNIT);
 			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, box_texture);
 			renderCube();
@@ -551,31 +643,22 @@ int main()
 		model = glm::rotate(model, glm::radians(ISSTrans.rotation.z), glm::vec3(0.f, 0.f, 1.f));
 		model = glm::scale(model, ISSTrans.scale);
 
+		// the explode stage only runs while the station is coming apart
+		Shader* model_exp_shader = model_exp_shaders.variant(ISScolapse ? issDefines : issIntactDefines);
 		model_exp_shader->use();
-		model_exp_shader->setMatrix4F("pv", pv);
-		model_exp_shader->setMatrix4F("model", model);
-		model_exp_shader->setVec3("viewPos", camera.Position);
-
-		active_lights = 0;
-		for (int i = 0; i < lights.size(); i++)
-			active_lights += lights[i]->putInShader(model_exp_shader, active_lights);
-		model_exp_shader->setInt("lights_count", active_lights);
-
-		model_exp_shader->setFloat("far_plane", far_plane);
-		model_exp_shader->setBool("shadows", true);
-		model_exp_shader->setBool("blur", false);
-		model_exp_shader->setBool("collapse", ISScolapse);
+		model_exp_shader->set(uniforms.model, model);
+		environment.bind(model_exp_shader, ENVIRONMENT_UNIT);
 		static float blow = 0;
 		if (ISScolapse)
 		{
 			if (blow < glm::pi<float>() / 2)
 				blow += 0.005f;
-			model_exp_shader->setFloat("blow", blow);
+			model_exp_shader->set(uniforms.blow, blow);
 		}
 		else
 			blow = 0;
 
-		ISS.Draw(model_exp_shader);
+		ISS.Draw(model_exp_shader, model, lodView);
 
 		// DRAWING EARTH
 		model = glm::mat4(1.0f);
@@ -588,21 +671,15 @@ int main()
 		if (boxMode)
 		{
 			// DRAWING EARTH-BOX
+			Shader* basic_shader = basic_shaders.variant(boxDefines);
 			basic_shader->use();
-			basic_shader->setMatrix4F("pv", pv);
-			basic_shader->setVec3("viewPos", camera.Position);
-			active_lights = 0;
-			for (int i = 0; i < lights.size(); i++)
-				active_lights += lights[i]->putInShader(basic_shader, active_lights);
 			model = glm::scale(model, glm::vec3(3.f, 3.f, 3.f));
-			basic_shader->setInt("lights_count", active_lights);
-			basic_shader->setMatrix4F("model", model);
-			basic_shader->setFloat("far_plane", far_plane);
-			basic_shader->setVec3("material.ambient", cubeMaterials[cubeMat].ambient);
-			basic_shader->setVec3("material.diffuse", cubeMaterials[cubeMat].diffuse);
-			basic_shader->setVec3("material.specular", cubeMaterials[cubeMat].specular);
-			basic_shader->setFloat("material.shininess", cubeMaterials[cubeMat].shininess);
-			basic_shader->setBool("shadows", true);
+			basic_shader->set(uniforms.model, model);
+			basic_shader->set(uniforms.materialAmbient, cubeMaterials[cubeMat].ambient);
+			basic_shader->set(uniforms.materialDiffuse, cubeMaterials[cubeMat].diffuse);
+			basic_shader->set(uniforms.materialSpecular, cubeMaterials[cubeMat].specular);
+			basic_shader->set(uniforms.materialShininess, cubeMaterials[cubeMat].shininess);
+			environment.bind(basic_shader, ENVIRONMENT_UNIT);
 			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, box_texture);
 			glActiveTexture(GL_TEXTURE1);
@@ -612,23 +689,28 @@ int main()
 
 		if (!boxMode || meteorAlarm)
 		{
+			Shader* model_shader = model_shaders.variant(earthDefines);
 			model_shader->use();
-			model_shader->setMatrix4F("pv", pv);
-			model_shader->setMatrix4F("model", model);
-			model_shader->setVec3("viewPos", camera.Position);
-
-			active_lights = 0;
-			for (int i = 0; i < lights.size(); i++)
-				active_lights += lights[i]->putInShader(model_shader, active_lights);
-
-			model_shader->setInt("lights_count", active_lights);
-
-			model_shader->setFloat("far_plane", far_plane);
-			model_shader->setBool("shadows", true);
-			model_shader->setBool("blur", true);
+			model_shader->set(uniforms.model, model);
+			environment.bind(model_shader, ENVIRONMENT_UNIT);
 
 			if (!boxMode)
-				earth.Draw(model_shader);
+			{
+				model = glm::scale(model, glm::vec3(EARTH_GLTF_SCALE));
+				model_shader->set(uniforms.model, model);
+				earth.Draw(model_shader, model, lodView);
+
+				// the tiles the earth samples this frame, read back a couple of frames later
+				if (earthVirtual.wantsFeedback())
+				{
+					earthVirtual.beginFeedback();
+					vtFeedbackShader->use();
+					vtFeedbackShader->set(uniforms.model, model);
+					earth.Draw(vtFeedbackShader, model, lodView);
+					earthVirtual.endFeedback();
+					model_shader->use();
+				}
+			}
 
 			// DRAWING METEORITE
 			if (meteorAlarm)
@@ -654,8 +736,8 @@ int main()
 				}
 				model = glm::scale(model, meteorTrans.scale);
 
-				model_shader->setMatrix4F("model", model);
-				meteor.Draw(model_shader);
+				model_shader->set(uniforms.model, model);
+				meteor.Draw(model_shader, model, lodView);
 			}
 		}
 #pragma region BACKGROUND
@@ -669,20 +751,23 @@ int main()
 			v = glm::rotate(v, glm::radians(cameraAngleY), glm::vec3(0.f, 1.f, 0.f));
 		}
 		pv = p * v;
-		skybox_shader->use();
-		skybox_shader->setMatrix4F("pv", pv);
+		if (cubemapTexture)
+		{
+			skybox_shader->use();
+			skybox_shader->set(uniforms.pv, pv);
 
-		// skybox cube
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-		renderCube();
+			// skybox cube
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+			renderCube();
+		}
 		glCullFace(GL_BACK);
 
 		if (boxMode)
 		{
 			// DRAWING LAMPS
 			light_shader->use();
-			light_shader->setMatrix4F("pv", pv);
+			light_shader->set(uniforms.pv, pv);
 
 			// Sun
 			lightTrans.position = sunLight->position;
@@ -691,8 +776,8 @@ int main()
 			//model = glm::rotate(model, glm::radians(lightTrans.rotation.y >= 360 ? lightTrans.rotation.y -= 360.f - 10.f : lightTrans.rotation.y += 10.f), glm::vec3(0.f, 1.f, 0.f));
 
 			model = glm::scale(model, lightTrans.scale);
-			light_shader->setMatrix4F("model", model);
-			light_shader->setVec3("lightColor", glm::vec3(1.f, 1.f, 1.f));
+			light_shader->set(uniforms.model, model);
+			light_shader->set(uniforms.lightColor, glm::vec3(1.f, 1.f, 1.f));
 			renderCube();
 		}
 
@@ -711,7 +796,7 @@ int main()
 		for (unsigned int i = 0; i < amount; i++)
 		{
 			glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[horizontal]);
-			shaderBlur->setInt("horizontal", horizontal);
+			shaderBlur->set(uniforms.horizontal, horizontal);
 			glBindTexture(GL_TEXTURE_2D, first_iteration ? colorBuffers[1] : pingpongColorbuffers[!horizontal]);  // ïðèâÿçêà òåêñòóðû äðóãîãî ôðåéìáóôåðà (èëè ñöåíû, åñëè ýòî - ïåðâàÿ èòåðàöèÿ)
 			renderQuad();
 			horizontal = !horizontal;
@@ -733,18 +818,23 @@ int main()
 		renderQuad();
 #pragma endregion
 
+		// the draws above reported how large every model texture appeared
+		TextureStreamer::instance().update();
+
 		glfwSwapBuffers(win);
 		glfwPollEvents();
+		Shader::endFrame();
 	}
 
-	delete basic_shader;
 	delete light_shader;
-	delete model_shader;
-	delete model_exp_shader;
 	delete skybox_shader;
 	delete shaderBlur;
 	delete shaderBloomFinal;
 	delete simpleDepthShader;
+	delete vtFeedbackShader;
+
+	TextureRegistry::instance().release(box_texture);
+	TextureRegistry::instance().release(cubemapTexture);
 }
 
 
@@ -816,6 +906,11 @@ void OnKeyAction(GLFWwindow* win, int key, int scancode, int action, int mods)
 		case GLFW_KEY_C:
 			ISScolapse = !ISScolapse;
 			break;
+		case GLFW_KEY_M:
+			TextureStreamer::instance().printStats();
+			GeometryArena::instance().printReport();
+			cout << "Uniform string lookups last frame: " << Shader::lastFrameStringLookups() << endl;
+			break;
 		case GLFW_KEY_SPACE:
 			do
 			{
@@ -911,82 +1006,83 @@ void OnMouseMoutionAction(GLFWwindow* win, double x, double y)
 	}
 }
 
-unsigned int loadCubemap(vector<std::string> faces)
+unsigned int requestCubemap(CubemapLoad& load, const vector<std::string>& faces, ThreadPool& pool)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-	int width, height, nrChannels;
-	for (unsigned int i = 0; i < faces.size(); i++)
-	{
-		unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-		if (data)
-		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-				0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
-			);
-			stbi_image_free(data);
-		}
-		else
-		{
-			std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-			stbi_image_free(data);
-		}
-	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-	return textureID;
+	load.key = TextureRegistry::makeCubemapKey(faces);
+	if (unsigned int resident = TextureRegistry::instance().acquire(load.key))
+		return resident;
+
+	load.faces = faces;
+	load.cook = pool.submit([faces]() {
+		auto start = chrono::steady_clock::now();
+		unique_ptr<CompressedTexture> cooked = loadCookedCubemap(faces);
+		Model::importStats.add(STAGE_DECODE, start);
+		return cooked;
+	});
+	return 0;
 }
 
-unsigned int loadTexture(char const* path, bool gammaCorrection)
+unsigned int finishCubemap(CubemapLoad& load, ThreadPool& pool)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 0);
-	if (data)
+	if (load.cook.valid())
 	{
-		GLenum internalFormat = 0;
-		GLenum dataFormat = 0;
-		if (nrComponents == 1)
-		{
-			internalFormat = dataFormat = GL_RED;
-		}
-		else if (nrComponents == 3)
+		if (load.cook.wait_for(chrono::seconds(0)) != future_status::ready)
+			return 0;
+		unique_ptr<CompressedTexture> cooked = load.cook.get();
+		if (cooked)
 		{
-			internalFormat = gammaCorrection ? GL_SRGB : GL_RGB;
-			dataFormat = GL_RGB;
+			auto start = chrono::steady_clock::now();
+			unsigned int textureID = TextureUploader::instance().upload(move(cooked));
+			Model::importStats.add(STAGE_UPLOAD, start);
+			if (textureID)
+				return TextureRegistry::instance().acquire(load.key, [textureID]() { return textureID; });
 		}
-		else if (nrComponents == 4)
+
+		// no cooked faces (or no BC1 on this driver), decode the sources
+		for (const string& face : load.faces)
 		{
-			internalFormat = gammaCorrection ? GL_SRGB_ALPHA : GL_RGBA;
-			dataFormat = GL_RGBA;
+			load.decodes.push_back(pool.submit([face]() {
+				auto start = chrono::steady_clock::now();
+				ImageData image = decodeImage(face);
+				Model::importStats.add(STAGE_DECODE, start);
+				return image;
+			}));
 		}
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, dataFormat, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
+		return 0;
 	}
-	else
+	if (load.decodes.empty())
+		return 0;
+	for (future<ImageData>& decode : load.decodes)
+		if (decode.wait_for(chrono::seconds(0)) != future_status::ready)
+			return 0;
+
+	vector<ImageData> images;
+	for (unsigned int i = 0; i < load.faces.size(); i++)
 	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
+		images.push_back(load.decodes[i].get());
+		if (!images.back().pixels)
+			std::cout << "Cubemap texture failed to load at path: " << load.faces[i] << std::endl;
 	}
+	load.decodes.clear();
+	auto start = chrono::steady_clock::now();
+	unsigned int textureID = TextureUploader::instance().uploadCubemap(move(images));
+	Model::importStats.add(STAGE_UPLOAD, start);
+
+	return TextureRegistry::instance().acquire(load.key, [textureID]() { return textureID; });
+}
 
-	return textureID;
+unsigned int loadTexture(char const* path, bool gammaCorrection)
+{
+	return TextureRegistry::instance().acquire(TextureRegistry::makeKey(path, gammaCorrection), [&]() {
+		auto start = chrono::steady_clock::now();
+		PreparedTexture texture = prepareTexture(path, TextureUsage::Color, gammaCorrection);
+		Model::importStats.add(STAGE_DECODE, start);
+
+		start = chrono::steady_clock::now();
+		unsigned int textureID = uploadPreparedTexture(texture, path, gammaCorrection);
+		Model::importStats.add(STAGE_UPLOAD, start);
+		return textureID;
+	});
 }
 
 void renderCube()
@@ -1068,6 +1164,7 @@ void renderCube()
 	glBindVertexArray(cubeVAO);
 	glDrawArrays(GL_TRIANGLES, 0, 36);
 	glBindVertexArray(0);
+	GeometryArena::instance().forgetBinding();
 }
 
 void renderQuad()
@@ -1099,6 +1196,7 @@ void renderQuad()
 	glBindVertexArray(quadVAO);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 	glBindVertexArray(0);
+	GeometryArena::instance().forgetBinding();
 
 	if (wireframeMode)
 		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
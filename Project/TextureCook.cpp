@@ -0,0 +1,1031 @@
+#include "TextureCook.h"
+#include "CookManifest.h"
+#include "GLExtensions.h"
+#include "VirtualFileSystem.h"
+#include "stb_image.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+namespace
+{
+	const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+	const uint32_t KTX_ENDIANNESS = 0x04030201;
+	const char TILE_FILE_MAGIC[4] = { 'V', 'T', 'E', 'X' };
+	// the feedback pass stores tile coordinates in 8 bits, 256 tiles across
+	const unsigned int VT_MAX_SIZE = 256 * VT_TILE_SIZE;
+	const char ENVIRONMENT_MAGIC[4] = { 'E', 'N', 'V', 'L' };
+	// GGX importance samples per prefiltered texel
+	const unsigned int ENVIRONMENT_SAMPLES = 128;
+	const float PI = 3.14159265f;
+
+	struct KtxHeader {
+		unsigned char identifier[12];
+		uint32_t endianness;
+		uint32_t glType;
+		uint32_t glTypeSize;
+		uint32_t glFormat;
+		uint32_t glInternalFormat;
+		uint32_t glBaseInternalFormat;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t numberOfArrayElements;
+		uint32_t numberOfFaces;
+		uint32_t numberOfMipmapLevels;
+		uint32_t bytesOfKeyValueData;
+	};
+
+	enum class BlockFormat { BC1, BC3, BC5 };
+
+	// RGBA in linear float (unpacked -1..1 vectors for normal maps), used for mip generation
+	struct FloatImage {
+		int width, height;
+		vector<float> texels;
+	};
+
+	float srgbToLinear(float c)
+	{
+		return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+	}
+
+	float linearToSrgb(float c)
+	{
+		return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+	}
+
+	FloatImage toFloat(const unsigned char* pixels, int width, int height, TextureUsage usage, bool gamma)
+	{
+		FloatImage image = { width, height, vector<float>(size_t(width) * height * 4) };
+		for (size_t i = 0; i < image.texels.size(); i++)
+		{
+			float c = pixels[i] / 255.0f;
+			if (i % 4 == 3)
+				image.texels[i] = c;
+			else if (usage == TextureUsage::Normal)
+				image.texels[i] = c * 2.0f - 1.0f;
+			else
+				image.texels[i] = gamma ? srgbToLinear(c) : c;
+		}
+		return image;
+	}
+
+	vector<unsigned char> toBytes(const FloatImage& image, TextureUsage usage, bool gamma)
+	{
+		vector<unsigned char> pixels(image.texels.size());
+		for (size_t i = 0; i < pixels.size(); i++)
+		{
+			float c = image.texels[i];
+			if (i % 4 != 3)
+			{
+				if (usage == TextureUsage::Normal)
+					c = c * 0.5f + 0.5f;
+				else if (gamma)
+					c = linearToSrgb(c);
+			}
+			pixels[i] = (unsigned char)(min(max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+		}
+		return pixels;
+	}
+
+	// 2x2 box filter, edges clamp for odd sizes
+	FloatImage downsample(const FloatImage& src, TextureUsage usage)
+	{
+		FloatImage dst = { max(1, src.width / 2), max(1, src.height / 2), {} };
+		dst.texels.resize(size_t(dst.width) * dst.height * 4);
+		for (int y = 0; y < dst.height; y++)
+			for (int x = 0; x < dst.width; x++)
+			{
+				int x0 = min(x * 2, src.width - 1), x1 = min(x * 2 + 1, src.width - 1);
+				int y0 = min(y * 2, src.height - 1), y1 = min(y * 2 + 1, src.height - 1);
+				float* out = &dst.texels[(size_t(y) * dst.width + x) * 4];
+				for (int c = 0; c < 4; c++)
+					out[c] = 0.25f * (src.texels[(size_t(y0) * src.width + x0) * 4 + c] + src.texels[(size_t(y0) * src.width + x1) * 4 + c]
+						+ src.texels[(size_t(y1) * src.width + x0) * 4 + c] + src.texels[(size_t(y1) * src.width + x1) * 4 + c]);
+				if (usage == TextureUsage::Normal)
+				{
+					float length = sqrtf(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+					if (length > 1e-6f)
+						for (int c = 0; c < 3; c++)
+							out[c] /= length;
+				}
+			}
+		return dst;
+	}
+
+	// bilinear with clamped edges, brings every layer of a virtual texture to one size
+	FloatImage resample(const FloatImage& src, int width, int height, TextureUsage usage)
+	{
+		if (src.width == width && src.height == height)
+			return src;
+		FloatImage dst = { width, height, vector<float>(size_t(width) * height * 4) };
+		for (int y = 0; y < height; y++)
+			for (int x = 0; x < width; x++)
+			{
+				float sx = max((x + 0.5f) * src.width / width - 0.5f, 0.0f), sy = max((y + 0.5f) * src.height / height - 0.5f, 0.0f);
+				int x0 = min(int(sx), src.width - 1), y0 = min(int(sy), src.height - 1);
+				int x1 = min(x0 + 1, src.width - 1), y1 = min(y0 + 1, src.height - 1);
+				float fx = sx - x0, fy = sy - y0;
+				float* out = &dst.texels[(size_t(y) * width + x) * 4];
+				for (int c = 0; c < 4; c++)
+				{
+					float top = src.texels[(size_t(y0) * src.width + x0) * 4 + c] * (1.0f - fx) + src.texels[(size_t(y0) * src.width + x1) * 4 + c] * fx;
+					float bottom = src.texels[(size_t(y1) * src.width + x0) * 4 + c] * (1.0f - fx) + src.texels[(size_t(y1) * src.width + x1) * 4 + c] * fx;
+					out[c] = top * (1.0f - fy) + bottom * fy;
+				}
+				if (usage == TextureUsage::Normal)
+				{
+					float length = sqrtf(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+					if (length > 1e-6f)
+						for (int c = 0; c < 3; c++)
+							out[c] /= length;
+				}
+			}
+		return dst;
+	}
+
+	// one tile and its border, wrapping around the level like a GL_REPEAT sampler
+	vector<unsigned char> cutTile(const vector<unsigned char>& level, int width, int height, int tileX, int tileY)
+	{
+		int slot = VT_TILE_SIZE + 2 * VT_TILE_BORDER;
+		vector<unsigned char> tile(size_t(slot) * slot * 4);
+		for (int y = 0; y < slot; y++)
+			for (int x = 0; x < slot; x++)
+			{
+				int sx = ((tileX * int(VT_TILE_SIZE) + x - int(VT_TILE_BORDER)) % width + width) % width;
+				int sy = ((tileY * int(VT_TILE_SIZE) + y - int(VT_TILE_BORDER)) % height + height) % height;
+				memcpy(&tile[(size_t(y) * slot + x) * 4], &level[(size_t(sy) * width + sx) * 4], 4);
+			}
+		return tile;
+	}
+
+	size_t tileCount(const TileFileHeader& header)
+	{
+		size_t count = 0;
+		for (uint32_t level = 0; level < header.levels; level++)
+			count += size_t(max(1u, (header.width >> level) / header.tileSize)) * max(1u, (header.height >> level) / header.tileSize);
+		return count;
+	}
+
+	uint16_t packRgb565(const float color[3])
+	{
+		int r = int(min(max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+		int g = int(min(max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+		int b = int(min(max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+		return uint16_t((r << 11) | (g << 5) | b);
+	}
+
+	void unpackRgb565(uint16_t c, int out[3])
+	{
+		int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+		out[0] = (r << 3) | (r >> 2);
+		out[1] = (g << 2) | (g >> 4);
+		out[2] = (b << 3) | (b >> 2);
+	}
+
+	// Picks the closest palette entry per texel in four-colour mode, returns the squared error
+	int fitColorIndices(const unsigned char block[16][4], uint16_t& c0, uint16_t& c1, uint32_t& indices)
+	{
+		if (c0 < c1)
+			swap(c0, c1);
+		int palette[4][3];
+		unpackRgb565(c0, palette[0]);
+		unpackRgb565(c1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		int error = 0;
+		indices = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, bestDistance = INT32_MAX;
+			for (int p = 0; p < 4; p++)
+			{
+				int dr = block[i][0] - palette[p][0], dg = block[i][1] - palette[p][1], db = block[i][2] - palette[p][2];
+				int distance = dr * dr + dg * dg + db * db;
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					best = p;
+				}
+			}
+			error += bestDistance;
+			indices |= uint32_t(best) << (2 * i);
+		}
+		// equal endpoints decode in three-colour mode, index 0 is still exact there
+		if (c0 == c1)
+			indices = 0;
+		return error;
+	}
+
+	// BC1 colour block: endpoints on the principal axis, refined by a least-squares pass
+	void encodeColorBlock(const unsigned char block[16][4], unsigned char* out)
+	{
+		float mean[3] = { 0, 0, 0 };
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < 3; c++)
+				mean[c] += block[i][c] / 16.0f;
+
+		float cov[6] = { 0, 0, 0, 0, 0, 0 };
+		for (int i = 0; i < 16; i++)
+		{
+			float d[3] = { block[i][0] - mean[0], block[i][1] - mean[1], block[i][2] - mean[2] };
+			cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+			cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+		}
+		float axis[3] = { 1.0f, 1.0f, 1.0f };
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[3] = {
+				cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+				cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+				cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2] };
+			float length = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+			if (length < 1e-6f)
+				break;
+			for (int c = 0; c < 3; c++)
+				axis[c] = next[c] / length;
+		}
+
+		float minT = FLT_MAX, maxT = -FLT_MAX;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = (block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1] + (block[i][2] - mean[2]) * axis[2];
+			minT = min(minT, t);
+			maxT = max(maxT, t);
+		}
+		// inset the endpoints a little, the extremes are rarely worth an exact match
+		float inset = (maxT - minT) / 16.0f;
+		float e0[3], e1[3];
+		for (int c = 0; c < 3; c++)
+		{
+			e0[c] = mean[c] + axis[c] * (maxT - inset);
+			e1[c] = mean[c] + axis[c] * (minT + inset);
+		}
+
+		uint16_t c0 = packRgb565(e0), c1 = packRgb565(e1);
+		uint32_t indices;
+		int error = fitColorIndices(block, c0, c1, indices);
+
+		// least-squares endpoints for the chosen indices
+		static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+		float aa = 0, bb = 0, ab = 0, ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+		for (int i = 0; i < 16; i++)
+		{
+			float a = weights[(indices >> (2 * i)) & 3], b = 1.0f - a;
+			aa += a * a; bb += b * b; ab += a * b;
+			for (int c = 0; c < 3; c++)
+			{
+				ax[c] += a * block[i][c];
+				bx[c] += b * block[i][c];
+			}
+		}
+		float det = aa * bb - ab * ab;
+		if (fabsf(det) > 1e-6f)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				e0[c] = (ax[c] * bb - bx[c] * ab) / det;
+				e1[c] = (bx[c] * aa - ax[c] * ab) / det;
+			}
+			uint16_t r0 = packRgb565(e0), r1 = packRgb565(e1);
+			uint32_t refined;
+			if (fitColorIndices(block, r0, r1, refined) < error)
+			{
+				c0 = r0;
+				c1 = r1;
+				indices = refined;
+			}
+		}
+
+		out[0] = c0 & 0xFF; out[1] = c0 >> 8;
+		out[2] = c1 & 0xFF; out[3] = c1 >> 8;
+		for (int i = 0; i < 4; i++)
+			out[4 + i] = (indices >> (8 * i)) & 0xFF;
+	}
+
+	// BC4 single channel block, eight-value mode
+	void encodeChannelBlock(const unsigned char values[16], unsigned char* out)
+	{
+		int lo = 255, hi = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			lo = min(lo, int(values[i]));
+			hi = max(hi, int(values[i]));
+		}
+		out[0] = (unsigned char)hi;
+		out[1] = (unsigned char)lo;
+
+		uint64_t bits = 0;
+		if (hi != lo)
+		{
+			int palette[8] = { hi, lo };
+			for (int i = 2; i < 8; i++)
+				palette[i] = ((8 - i) * hi + (i - 1) * lo) / 7;
+			for (int i = 0; i < 16; i++)
+			{
+				int best = 0, bestDistance = INT32_MAX;
+				for (int p = 0; p < 8; p++)
+				{
+					int distance = abs(values[i] - palette[p]);
+					if (distance < bestDistance)
+					{
+						bestDistance = distance;
+						best = p;
+					}
+				}
+				bits |= uint64_t(best) << (3 * i);
+			}
+		}
+		for (int i = 0; i < 6; i++)
+			out[2 + i] = (bits >> (8 * i)) & 0xFF;
+	}
+
+	vector<unsigned char> encodeLevel(const vector<unsigned char>& pixels, int width, int height, BlockFormat format)
+	{
+		size_t blockBytes = format == BlockFormat::BC1 ? 8 : 16;
+		int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+		vector<unsigned char> out(size_t(blocksX) * blocksY * blockBytes);
+		unsigned char* dst = out.data();
+		for (int by = 0; by < blocksY; by++)
+			for (int bx = 0; bx < blocksX; bx++, dst += blockBytes)
+			{
+				unsigned char block[16][4];
+				for (int i = 0; i < 16; i++)
+				{
+					int x = min(bx * 4 + i % 4, width - 1), y = min(by * 4 + i / 4, height - 1);
+					memcpy(block[i], &pixels[(size_t(y) * width + x) * 4], 4);
+				}
+				unsigned char channel[16];
+				switch (format)
+				{
+				case BlockFormat::BC1:
+					encodeColorBlock(block, dst);
+					break;
+				case BlockFormat::BC3:
+					for (int i = 0; i < 16; i++)
+						channel[i] = block[i][3];
+					encodeChannelBlock(channel, dst);
+					encodeColorBlock(block, dst + 8);
+					break;
+				case BlockFormat::BC5:
+					for (int i = 0; i < 16; i++)
+						channel[i] = block[i][0];
+					encodeChannelBlock(channel, dst);
+					for (int i = 0; i < 16; i++)
+						channel[i] = block[i][1];
+					encodeChannelBlock(channel, dst + 8);
+					break;
+				}
+			}
+		return out;
+	}
+
+	void glFormats(BlockFormat format, bool gamma, uint32_t& internalFormat, uint32_t& baseFormat)
+	{
+		switch (format)
+		{
+		case BlockFormat::BC1:
+			internalFormat = gamma ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+			baseFormat = GL_RGB;
+			break;
+		case BlockFormat::BC3:
+			internalFormat = gamma ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+			baseFormat = GL_RGBA;
+			break;
+		case BlockFormat::BC5:
+			internalFormat = GL_COMPRESSED_RG_RGTC2;
+			baseFormat = GL_RG;
+			break;
+		}
+	}
+
+	bool writeCookedFile(const string& cooked, const vector<unsigned char>& file)
+	{
+		// cooks may race on worker threads, so each writes its own temporary
+		string tmpPath = cooked + ".tmp" + to_string(hash<thread::id>()(this_thread::get_id()));
+		error_code ec;
+		filesystem::create_directories(filesystem::path(cooked).parent_path(), ec);
+		{
+			ofstream out(tmpPath, ios::binary | ios::trunc);
+			if (!out.write((const char*)file.data(), file.size()))
+			{
+				cout << "ERROR::TEXTURE_COOK:: Couldn't write " << tmpPath << endl;
+				return false;
+			}
+		}
+		filesystem::rename(tmpPath, cooked, ec);
+		if (ec)
+		{
+			filesystem::remove(tmpPath, ec);
+			return filesystem::exists(cooked);
+		}
+		return true;
+	}
+
+	// Builds the whole mip chain of every face and writes it as KTX 1.1
+	bool writeKtx(const string& cooked, const vector<unsigned char*>& faces, int width, int height,
+		BlockFormat format, TextureUsage usage, bool gamma)
+	{
+		KtxHeader header = {};
+		memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+		header.endianness = KTX_ENDIANNESS;
+		header.glTypeSize = 1;
+		glFormats(format, gamma, header.glInternalFormat, header.glBaseInternalFormat);
+		header.pixelWidth = width;
+		header.pixelHeight = height;
+		header.numberOfFaces = (uint32_t)faces.size();
+
+		vector<vector<vector<unsigned char>>> levels(faces.size());
+		for (size_t f = 0; f < faces.size(); f++)
+		{
+			FloatImage image = toFloat(faces[f], width, height, usage, gamma);
+			for (;;)
+			{
+				levels[f].push_back(encodeLevel(toBytes(image, usage, gamma), image.width, image.height, format));
+				if (image.width == 1 && image.height == 1)
+					break;
+				image = downsample(image, usage);
+			}
+		}
+		header.numberOfMipmapLevels = (uint32_t)levels[0].size();
+
+		vector<unsigned char> file(sizeof(header));
+		memcpy(file.data(), &header, sizeof(header));
+		for (uint32_t level = 0; level < header.numberOfMipmapLevels; level++)
+		{
+			uint32_t imageSize = (uint32_t)levels[0][level].size();
+			file.insert(file.end(), (unsigned char*)&imageSize, (unsigned char*)&imageSize + 4);
+			// block sizes are multiples of 8, so no cube or mip padding is ever needed
+			for (size_t f = 0; f < faces.size(); f++)
+				file.insert(file.end(), levels[f][level].begin(), levels[f][level].end());
+		}
+
+		return writeCookedFile(cooked, file);
+	}
+
+	bool isUpToDate(const string& cooked, const vector<string>& sources)
+	{
+		if (CookManifest::instance().vouchesFor(cooked))
+			return true;
+		// sources may live in the asset pack, which keeps their original timestamps
+		int64_t cookedTime, sourceTime;
+		if (!VirtualFileSystem::instance().modifiedTime(cooked, cookedTime))
+			return false;
+		for (const string& source : sources)
+			if (!VirtualFileSystem::instance().modifiedTime(source, sourceTime) || sourceTime > cookedTime)
+				return false;
+		return true;
+	}
+
+	unsigned char* loadPixels(const string& path, int& width, int& height, int& components)
+	{
+		AssetFile file;
+		if (!VirtualFileSystem::instance().open(path, file))
+			return nullptr;
+		return stbi_load_from_memory(file.data(), (int)file.size(), &width, &height, &components, 4);
+	}
+
+	unique_ptr<CompressedTexture> loadKtx(const string& path)
+	{
+		unique_ptr<CompressedTexture> texture(new CompressedTexture());
+		if (!VirtualFileSystem::instance().open(path, texture->file) || texture->file.size() < sizeof(KtxHeader))
+			return nullptr;
+
+		const unsigned char* data = texture->file.data();
+		const unsigned char* end = data + texture->file.size();
+		KtxHeader header;
+		memcpy(&header, data, sizeof(header));
+		if (memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0 || header.endianness != KTX_ENDIANNESS
+			|| header.glType != 0 || (header.numberOfFaces != 1 && header.numberOfFaces != 6) || header.numberOfMipmapLevels == 0)
+			return nullptr;
+
+		texture->internalFormat = header.glInternalFormat;
+		texture->width = header.pixelWidth;
+		texture->height = header.pixelHeight;
+		texture->faces = header.numberOfFaces;
+		texture->levels = header.numberOfMipmapLevels;
+
+		const unsigned char* cursor = data + sizeof(header) + header.bytesOfKeyValueData;
+		for (uint32_t level = 0; level < header.numberOfMipmapLevels; level++)
+		{
+			if (cursor + 4 > end)
+				return nullptr;
+			uint32_t imageSize;
+			memcpy(&imageSize, cursor, 4);
+			cursor += 4;
+			for (uint32_t f = 0; f < header.numberOfFaces; f++)
+			{
+				if (cursor + imageSize > end)
+					return nullptr;
+				texture->images.push_back(cursor);
+				texture->imageSizes.push_back(imageSize);
+				cursor += (imageSize + 3) & ~3u;
+			}
+		}
+		return texture;
+	}
+	// One level of a cubemap in float RGB, texel (x, y) of face f at (f * size + y) * size + x
+	struct CubeLevel {
+		int size;
+		vector<glm::vec3> texels;
+	};
+
+	// Direction through face f at s, t in -1..1 with t going down the rows, as GL addresses cubemaps
+	glm::vec3 cubeDirection(int face, float s, float t)
+	{
+		switch (face)
+		{
+		case 0: return glm::vec3(1.0f, -t, -s);
+		case 1: return glm::vec3(-1.0f, -t, s);
+		case 2: return glm::vec3(s, 1.0f, t);
+		case 3: return glm::vec3(s, -1.0f, -t);
+		case 4: return glm::vec3(s, -t, 1.0f);
+		default: return glm::vec3(-s, -t, -1.0f);
+		}
+	}
+
+	// Inverse of cubeDirection, s and t come back in 0..1
+	int cubeFace(const glm::vec3& d, float& s, float& t)
+	{
+		glm::vec3 a = glm::abs(d);
+		int face;
+		float sc, tc, ma;
+		if (a.x >= a.y && a.x >= a.z)
+		{
+			face = d.x > 0.0f ? 0 : 1;
+			sc = d.x > 0.0f ? -d.z : d.z;
+			tc = -d.y;
+			ma = a.x;
+		}
+		else if (a.y >= a.z)
+		{
+			face = d.y > 0.0f ? 2 : 3;
+			sc = d.x;
+			tc = d.y > 0.0f ? d.z : -d.z;
+			ma = a.y;
+		}
+		else
+		{
+			face = d.z > 0.0f ? 4 : 5;
+			sc = d.z > 0.0f ? d.x : -d.x;
+			tc = -d.y;
+			ma = a.z;
+		}
+		s = (sc / ma + 1.0f) * 0.5f;
+		t = (tc / ma + 1.0f) * 0.5f;
+		return face;
+	}
+
+	// bilinear within the face the direction hits, no filtering across face edges
+	glm::vec3 sampleCube(const CubeLevel& level, const glm::vec3& d)
+	{
+		float s, t;
+		int face = cubeFace(d, s, t);
+		float x = glm::clamp(s * level.size - 0.5f, 0.0f, level.size - 1.0f);
+		float y = glm::clamp(t * level.size - 0.5f, 0.0f, level.size - 1.0f);
+		int x0 = int(x), y0 = int(y);
+		int x1 = min(x0 + 1, level.size - 1), y1 = min(y0 + 1, level.size - 1);
+		float fx = x - x0, fy = y - y0;
+		const glm::vec3* texels = level.texels.data() + size_t(face) * level.size * level.size;
+		glm::vec3 top = glm::mix(texels[y0 * level.size + x0], texels[y0 * level.size + x1], fx);
+		glm::vec3 bottom = glm::mix(texels[y1 * level.size + x0], texels[y1 * level.size + x1], fx);
+		return glm::mix(top, bottom, fy);
+	}
+
+	// solid angle of a texel at s, t in -1..1 of a face size texels wide
+	float texelSolidAngle(float s, float t, int size)
+	{
+		float texel = 2.0f / size;
+		return texel * texel / powf(1.0f + s * s + t * t, 1.5f);
+	}
+
+	float radicalInverse(uint32_t bits)
+	{
+		bits = (bits << 16u) | (bits >> 16u);
+		bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+		bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+		bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+		bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+		return float(bits) * 2.3283064365386963e-10f;
+	}
+
+	// Averages face sourceFace of source into face of a (size x size) level, mip texels map to
+	// blocks of whole source texels
+	void boxFace(const CubeLevel& source, int sourceFace, CubeLevel& target, int face)
+	{
+		for (int y = 0; y < target.size; y++)
+			for (int x = 0; x < target.size; x++)
+			{
+				int x0 = x * source.size / target.size, x1 = max((x + 1) * source.size / target.size, x0 + 1);
+				int y0 = y * source.size / target.size, y1 = max((y + 1) * source.size / target.size, y0 + 1);
+				glm::vec3 sum(0.0f);
+				for (int sy = y0; sy < y1; sy++)
+					for (int sx = x0; sx < x1; sx++)
+						sum += source.texels[(size_t(sourceFace) * source.size + sy) * source.size + sx];
+				target.texels[(size_t(face) * target.size + y) * target.size + x] = sum / float((x1 - x0) * (y1 - y0));
+			}
+	}
+
+	// Radiance around one face of a prefiltered level: GGX lobes with n = v = r, each sample read
+	// from the pyramid level whose texels match its share of the lobe (filtered importance sampling)
+	void prefilterFace(const vector<CubeLevel>& pyramid, CubeLevel& target, int face, float roughness)
+	{
+		float alpha = roughness * roughness;
+		float texelAngle = 4.0f * PI / (6.0f * pyramid[0].size * pyramid[0].size);
+		for (int y = 0; y < target.size; y++)
+			for (int x = 0; x < target.size; x++)
+			{
+				glm::vec3 n = glm::normalize(cubeDirection(face, 2.0f * (x + 0.5f) / target.size - 1.0f, 2.0f * (y + 0.5f) / target.size - 1.0f));
+				glm::vec3 up = fabs(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+				glm::vec3 tangent = glm::normalize(glm::cross(up, n));
+				glm::vec3 bitangent = glm::cross(n, tangent);
+
+				glm::vec3 sum(0.0f);
+				float weight = 0.0f;
+				for (uint32_t i = 0; i < ENVIRONMENT_SAMPLES; i++)
+				{
+					float phi = 2.0f * PI * (i + 0.5f) / ENVIRONMENT_SAMPLES;
+					float u = radicalInverse(i);
+					float cosTheta = sqrtf((1.0f - u) / (1.0f + (alpha * alpha - 1.0f) * u));
+					float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+					glm::vec3 h = tangent * (sinTheta * cosf(phi)) + bitangent * (sinTheta * sinf(phi)) + n * cosTheta;
+					glm::vec3 l = 2.0f * glm::dot(n, h) * h - n;
+					float nDotL = glm::dot(n, l);
+					if (nDotL <= 0.0f)
+						continue;
+
+					// pdf of l is D(h) / 4 when n = v
+					float d = alpha * alpha / (PI * powf(cosTheta * cosTheta * (alpha * alpha - 1.0f) + 1.0f, 2.0f));
+					float sampleAngle = 1.0f / (ENVIRONMENT_SAMPLES * d * 0.25f + 1e-6f);
+					float mip = glm::clamp(0.5f * log2f(sampleAngle / texelAngle) + 1.0f, 0.0f, float(pyramid.size() - 1));
+					int lower = int(mip), upper = min(lower + 1, int(pyramid.size()) - 1);
+					glm::vec3 radiance = glm::mix(sampleCube(pyramid[lower], l), sampleCube(pyramid[upper], l), mip - lower);
+					sum += radiance * nDotL;
+					weight += nDotL;
+				}
+				target.texels[(size_t(face) * target.size + y) * target.size + x] = weight > 0.0f ? sum / weight : glm::vec3(0.0f);
+			}
+	}
+
+	size_t environmentBytes(uint32_t size, uint32_t levels)
+	{
+		size_t bytes = 0;
+		for (uint32_t level = 0; level < levels; level++)
+			bytes += 6 * size_t(max(size >> level, 1u)) * max(size >> level, 1u) * 3 * sizeof(uint16_t);
+		return bytes;
+	}
+}
+
+string cookedTexturePath(const string& source, TextureUsage usage, bool gamma)
+{
+	string tag = usage == TextureUsage::Normal ? ".normal" : gamma ? ".srgb" : ".color";
+	string path = "cache/" + source + tag + ".ktx";
+	replace(path.begin(), path.end(), '\\', '/');
+	return path;
+}
+
+string cookedCubemapPath(const vector<string>& faces)
+{
+	string path = "cache/" + faces[0] + ".cube.ktx";
+	replace(path.begin(), path.end(), '\\', '/');
+	return path;
+}
+
+bool cookTexture(const string& source, const string& cooked, TextureUsage usage, bool gamma)
+{
+	int width, height, components;
+	unsigned char* pixels = loadPixels(source, width, height, components);
+	if (!pixels)
+		return false;
+
+	BlockFormat format = BlockFormat::BC5;
+	if (usage == TextureUsage::Color)
+	{
+		format = BlockFormat::BC1;
+		for (size_t i = 3; components == 4 && i < size_t(width) * height * 4; i += 4)
+			if (pixels[i] != 255)
+			{
+				format = BlockFormat::BC3;
+				break;
+			}
+	}
+	bool written = writeKtx(cooked, { pixels }, width, height, format, usage, gamma);
+	stbi_image_free(pixels);
+	return written;
+}
+
+bool cookCubemap(const vector<string>& faces, const string& cooked)
+{
+	vector<unsigned char*> pixels;
+	int width = 0, height = 0;
+	bool loaded = true;
+	for (const string& face : faces)
+	{
+		int faceWidth, faceHeight, components;
+		unsigned char* data = loadPixels(face, faceWidth, faceHeight, components);
+		if (!data || (!pixels.empty() && (faceWidth != width || faceHeight != height)))
+		{
+			stbi_image_free(data);
+			loaded = false;
+			break;
+		}
+		width = faceWidth;
+		height = faceHeight;
+		pixels.push_back(data);
+	}
+	bool written = loaded && writeKtx(cooked, pixels, width, height, BlockFormat::BC1, TextureUsage::Color, false);
+	for (unsigned char* data : pixels)
+		stbi_image_free(data);
+	return written;
+}
+
+string cookedVirtualTexturePath(const vector<VirtualTextureLayer>& layers)
+{
+	string path = "cache/" + layers[0].source + ".vt";
+	replace(path.begin(), path.end(), '\\', '/');
+	return path;
+}
+
+bool cookVirtualTexture(const vector<VirtualTextureLayer>& layers, const string& cooked)
+{
+	if (layers.empty() || layers.size() > VIRTUAL_TEXTURE_MAX_LAYERS)
+		return false;
+	vector<FloatImage> images;
+	unsigned int width = VT_TILE_SIZE, height = 1;
+	for (const VirtualTextureLayer& layer : layers)
+	{
+		int layerWidth, layerHeight, components;
+		unsigned char* pixels = loadPixels(layer.source, layerWidth, layerHeight, components);
+		if (!pixels)
+		{
+			cout << "ERROR::TEXTURE_COOK:: Couldn't read virtual texture layer " << layer.source << endl;
+			return false;
+		}
+		images.push_back(toFloat(pixels, layerWidth, layerHeight, layer.usage, layer.gamma));
+		stbi_image_free(pixels);
+		while (width < unsigned(layerWidth) && width < VT_MAX_SIZE)
+			width <<= 1;
+		while (height < unsigned(layerHeight) && height < VT_MAX_SIZE)
+			height <<= 1;
+	}
+
+	TileFileHeader header = {};
+	memcpy(header.magic, TILE_FILE_MAGIC, 4);
+	header.version = VIRTUAL_TEXTURE_VERSION;
+	header.width = width;
+	header.height = height;
+	header.tileSize = VT_TILE_SIZE;
+	header.border = VT_TILE_BORDER;
+	header.levels = 1;
+	while (max(width, height) >> (header.levels - 1) > VT_TILE_SIZE)
+		header.levels++;
+	header.layerCount = (uint32_t)layers.size();
+	unsigned int blocks = (VT_TILE_SIZE + 2 * VT_TILE_BORDER) / 4;
+	size_t tileBytes = 0;
+	for (size_t i = 0; i < layers.size(); i++)
+	{
+		uint32_t baseFormat;
+		glFormats(layers[i].usage == TextureUsage::Normal ? BlockFormat::BC5 : BlockFormat::BC1, layers[i].gamma, header.formats[i], baseFormat);
+		header.layerBytes[i] = blocks * blocks * (layers[i].usage == TextureUsage::Normal ? 16 : 8);
+		tileBytes += header.layerBytes[i];
+	}
+
+	vector<unsigned char> file(sizeof(header) + tileCount(header) * tileBytes);
+	memcpy(file.data(), &header, sizeof(header));
+	size_t layerOffset = 0;
+	for (size_t i = 0; i < layers.size(); i++)
+	{
+		const VirtualTextureLayer& layer = layers[i];
+		BlockFormat format = layer.usage == TextureUsage::Normal ? BlockFormat::BC5 : BlockFormat::BC1;
+		FloatImage image = resample(images[i], width, height, layer.usage);
+		images[i] = FloatImage();
+		size_t tile = 0;
+		for (uint32_t level = 0; level < header.levels; level++)
+		{
+			vector<unsigned char> pixels = toBytes(image, layer.usage, layer.gamma);
+			int tilesX = max(1, image.width / int(VT_TILE_SIZE)), tilesY = max(1, image.height / int(VT_TILE_SIZE));
+			for (int y = 0; y < tilesY; y++)
+				for (int x = 0; x < tilesX; x++, tile++)
+				{
+					int slot = VT_TILE_SIZE + 2 * VT_TILE_BORDER;
+					vector<unsigned char> blockData = encodeLevel(cutTile(pixels, image.width, image.height, x, y), slot, slot, format);
+					memcpy(file.data() + sizeof(header) + tile * tileBytes + layerOffset, blockData.data(), blockData.size());
+				}
+			if (level + 1 < header.levels)
+				image = downsample(image, layer.usage);
+		}
+		layerOffset += header.layerBytes[i];
+	}
+	return writeCookedFile(cooked, file);
+}
+
+string cookedEnvironmentPath(const vector<string>& faces)
+{
+	string path = "cache/" + faces[0] + ".env";
+	replace(path.begin(), path.end(), '\\', '/');
+	return path;
+}
+
+bool cookEnvironment(const vector<string>& faces, const string& cooked, ThreadPool& pool)
+{
+	if (faces.size() != 6)
+		return false;
+
+	// every face averaged down to the base size, in the units the skybox shader draws them
+	int size = (int)ENVIRONMENT_SIZE;
+	vector<CubeLevel> pyramid(1, { size, vector<glm::vec3>(size_t(6) * size * size) });
+	vector<future<bool>> jobs;
+	for (int f = 0; f < 6; f++)
+		jobs.push_back(pool.submit([&faces, &pyramid, f]() {
+			int width, height, components;
+			unsigned char* pixels = loadPixels(faces[f], width, height, components);
+			if (!pixels || width != height)
+			{
+				cout << "ERROR::TEXTURE_COOK:: Environment face " << faces[f] << " is missing or not square" << endl;
+				stbi_image_free(pixels);
+				return false;
+			}
+			// just this face, as face 0 of a level of its own
+			CubeLevel face = { width, vector<glm::vec3>(size_t(width) * width) };
+			for (size_t i = 0; i < face.texels.size(); i++)
+				face.texels[i] = glm::vec3(pixels[i * 4], pixels[i * 4 + 1], pixels[i * 4 + 2]) / 255.0f;
+			stbi_image_free(pixels);
+			boxFace(face, 0, pyramid[0], f);
+			return true;
+		}));
+	bool loaded = true;
+	for (future<bool>& job : jobs)
+		loaded = pool.wait(job) && loaded;
+	if (!loaded)
+		return false;
+	while (pyramid.back().size > 1)
+	{
+		int next = pyramid.back().size / 2;
+		pyramid.push_back({ next, vector<glm::vec3>(size_t(6) * next * next) });
+		for (int f = 0; f < 6; f++)
+			boxFace(pyramid[pyramid.size() - 2], f, pyramid.back(), f);
+	}
+
+	// irradiance: radiance projected on the first nine SH basis functions, weighted by solid angle
+	vector<future<vector<glm::vec3>>> projections;
+	for (int f = 0; f < 6; f++)
+		projections.push_back(pool.submit([&pyramid, f, size]() {
+			vector<glm::vec3> sh(9, glm::vec3(0.0f));
+			for (int y = 0; y < size; y++)
+				for (int x = 0; x < size; x++)
+				{
+					float s = 2.0f * (x + 0.5f) / size - 1.0f, t = 2.0f * (y + 0.5f) / size - 1.0f;
+					glm::vec3 d = glm::normalize(cubeDirection(f, s, t));
+					glm::vec3 radiance = pyramid[0].texels[(size_t(f) * size + y) * size + x] * texelSolidAngle(s, t, size);
+					float basis[9] = { 0.282095f, 0.488603f * d.y, 0.488603f * d.z, 0.488603f * d.x,
+						1.092548f * d.x * d.y, 1.092548f * d.y * d.z, 0.315392f * (3.0f * d.z * d.z - 1.0f),
+						1.092548f * d.x * d.z, 0.546274f * (d.x * d.x - d.y * d.y) };
+					for (int i = 0; i < 9; i++)
+						sh[i] += radiance * basis[i];
+				}
+			return sh;
+		}));
+	vector<glm::vec3> sh(9, glm::vec3(0.0f));
+	for (future<vector<glm::vec3>>& projection : projections)
+	{
+		vector<glm::vec3> faceSh = pool.wait(projection);
+		for (int i = 0; i < 9; i++)
+			sh[i] += faceSh[i];
+	}
+
+	EnvironmentFileHeader header = {};
+	memcpy(header.magic, ENVIRONMENT_MAGIC, 4);
+	header.version = ENVIRONMENT_VERSION;
+	header.size = ENVIRONMENT_SIZE;
+	header.levels = ENVIRONMENT_LEVELS;
+	// convolved with the clamped cosine (Ramamoorthi and Hanrahan), over pi for a Lambertian albedo,
+	// times the constant of each basis function so the shader only multiplies by the polynomials
+	const float band[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+	const float constant[9] = { 0.282095f, 0.488603f, 0.488603f, 0.488603f, 1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f };
+	for (int i = 0; i < 9; i++)
+		for (int c = 0; c < 3; c++)
+			header.sh[i][c] = sh[i][c] * band[i] * constant[i];
+
+	// the sharpest level is the mirror reflection, the rest prefilter one job per face
+	vector<CubeLevel> levels(ENVIRONMENT_LEVELS);
+	levels[0] = pyramid[0];
+	vector<future<void>> filters;
+	for (unsigned int level = 1; level < ENVIRONMENT_LEVELS; level++)
+	{
+		int levelSize = max(size >> level, 1);
+		levels[level] = { levelSize, vector<glm::vec3>(size_t(6) * levelSize * levelSize) };
+		float roughness = float(level) / (ENVIRONMENT_LEVELS - 1);
+		for (int f = 0; f < 6; f++)
+			filters.push_back(pool.submit([&pyramid, &levels, level, f, roughness]() {
+				prefilterFace(pyramid, levels[level], f, roughness);
+			}));
+	}
+	for (future<void>& filter : filters)
+		pool.wait(filter);
+
+	vector<unsigned char> file(sizeof(header) + environmentBytes(header.size, header.levels));
+	memcpy(file.data(), &header, sizeof(header));
+	uint16_t* out = reinterpret_cast<uint16_t*>(file.data() + sizeof(header));
+	for (const CubeLevel& level : levels)
+		for (const glm::vec3& texel : level.texels)
+			for (int c = 0; c < 3; c++)
+				*out++ = glm::packHalf1x16(texel[c]);
+	return writeCookedFile(cooked, file);
+}
+
+unique_ptr<CompressedTexture> loadCookedTexture(const string& source, TextureUsage usage, bool gamma)
+{
+	string cooked = cookedTexturePath(source, usage, gamma);
+	if (!isUpToDate(cooked, { source }) && !cookTexture(source, cooked, usage, gamma))
+		return nullptr;
+	return loadKtx(cooked);
+}
+
+unique_ptr<CompressedTexture> loadCookedCubemap(const vector<string>& faces)
+{
+	string cooked = cookedCubemapPath(faces);
+	if (!isUpToDate(cooked, faces) && !cookCubemap(faces, cooked))
+		return nullptr;
+	unique_ptr<CompressedTexture> texture = loadKtx(cooked);
+	if (texture && texture->faces != 6)
+		return nullptr;
+	return texture;
+}
+
+bool loadCookedVirtualTexture(const vector<VirtualTextureLayer>& layers, AssetFile& file, const TileFileHeader*& header)
+{
+	if (layers.empty())
+		return false;
+	string cooked = cookedVirtualTexturePath(layers);
+	vector<string> sources;
+	for (const VirtualTextureLayer& layer : layers)
+		sources.push_back(layer.source);
+	if (!isUpToDate(cooked, sources) && !cookVirtualTexture(layers, cooked))
+		return false;
+	if (!VirtualFileSystem::instance().open(cooked, file) || file.size() < sizeof(TileFileHeader))
+		return false;
+
+	header = reinterpret_cast<const TileFileHeader*>(file.data());
+	size_t tileBytes = 0;
+	for (uint32_t i = 0; i < header->layerCount && i < VIRTUAL_TEXTURE_MAX_LAYERS; i++)
+		tileBytes += header->layerBytes[i];
+	if (memcmp(header->magic, TILE_FILE_MAGIC, 4) != 0 || header->version != VIRTUAL_TEXTURE_VERSION
+		|| header->layerCount != layers.size() || header->tileSize != VT_TILE_SIZE || header->border != VT_TILE_BORDER
+		|| file.size() != sizeof(TileFileHeader) + tileCount(*header) * tileBytes)
+	{
+		cout << "ERROR::TEXTURE_COOK:: " << cooked << " is not a version " << VIRTUAL_TEXTURE_VERSION << " tile file" << endl;
+		file.close();
+		return false;
+	}
+	return true;
+}
+
+bool loadCookedEnvironment(const vector<string>& faces, ThreadPool& pool, AssetFile& file, const EnvironmentFileHeader*& header)
+{
+	string cooked = cookedEnvironmentPath(faces);
+	if (!isUpToDate(cooked, faces) && !cookEnvironment(faces, cooked, pool))
+		return false;
+	if (!VirtualFileSystem::instance().open(cooked, file) || file.size() < sizeof(EnvironmentFileHeader))
+		return false;
+
+	header = reinterpret_cast<const EnvironmentFileHeader*>(file.data());
+	if (memcmp(header->magic, ENVIRONMENT_MAGIC, 4) != 0 || header->version != ENVIRONMENT_VERSION
+		|| header->size != ENVIRONMENT_SIZE || header->levels != ENVIRONMENT_LEVELS
+		|| file.size() != sizeof(EnvironmentFileHeader) + environmentBytes(header->size, header->levels))
+	{
+		cout << "ERROR::TEXTURE_COOK:: " << cooked << " is not a version " << ENVIRONMENT_VERSION << " environment" << endl;
+		file.close();
+		return false;
+	}
+	return true;
+}
+
+bool supportsCompressedFormat(unsigned int internalFormat)
+{
+	switch (internalFormat)
+	{
+	case GL_COMPRESSED_RG_RGTC2:
+		return true;
+	case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+		return hasGLExtension("GL_EXT_texture_compression_s3tc") && hasGLExtension("GL_EXT_texture_sRGB");
+	default:
+		return hasGLExtension("GL_EXT_texture_compression_s3tc");
+	}
+}
@@ -0,0 +1,95 @@
+#ifndef TEXTURE_COOK_H
+#define TEXTURE_COOK_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ThreadPool.h"
+#include "VirtualFileSystem.h"
+using namespace std;
+
+// Picks the block format: Color -> BC1 (BC3 with alpha), Normal -> BC5
+enum class TextureUsage { Color, Normal };
+
+// Bump whenever the block encoders or the KTX layout change, keys the cooker's manifest
+const uint32_t TEXTURE_COOK_VERSION = 1;
+
+// A KTX file holding a block-compressed mip chain, mapped or inside the asset pack
+struct CompressedTexture {
+    AssetFile file;
+    unsigned int internalFormat;
+    unsigned int width, height;
+    unsigned int faces;     // 6 for cubemaps
+    unsigned int levels;
+    // face f of mip level l is images[l * faces + f]
+    vector<const unsigned char*> images;
+    vector<unsigned int> imageSizes;
+};
+
+// One source image of a virtual texture, every layer shares the tile layout
+struct VirtualTextureLayer {
+    string source;
+    TextureUsage usage;
+    bool gamma;
+};
+
+const uint32_t VIRTUAL_TEXTURE_VERSION = 1;
+const unsigned int VIRTUAL_TEXTURE_MAX_LAYERS = 4;
+const unsigned int VT_TILE_SIZE = 128;
+const unsigned int VT_TILE_BORDER = 4;  // texels copied from the neighbouring tiles for filtering
+
+// Tiled cook output: the header, then every tile of level 0 row by row, then level 1 and so on.
+// A tile holds its layers one after another, each a (TILE_SIZE + 2 * BORDER)^2 block-compressed square.
+struct TileFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t width, height;     // powers of two, every layer is resampled to them
+    uint32_t tileSize, border;
+    uint32_t levels;            // down to the level that fits in one tile
+    uint32_t layerCount;
+    uint32_t formats[VIRTUAL_TEXTURE_MAX_LAYERS];       // GL internal format per layer
+    uint32_t layerBytes[VIRTUAL_TEXTURE_MAX_LAYERS];    // compressed size of one tile of the layer
+};
+
+const uint32_t ENVIRONMENT_VERSION = 1;
+const unsigned int ENVIRONMENT_SIZE = 128;      // face size of the sharpest specular level
+const unsigned int ENVIRONMENT_LEVELS = 6;      // 128 down to 4, GGX roughness 0 to 1 in even steps
+
+// Image-based light of a cubemap: the header, then the GGX-prefiltered specular chain as RGB half
+// floats, level by level with the six faces of a level in cubemap order
+struct EnvironmentFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t size;      // face size of level 0
+    uint32_t levels;
+    // order 2 spherical harmonics of irradiance / pi with the basis constants folded in, so the
+    // diffuse light at n is sh0 + sh1 y + sh2 z + sh3 x + sh4 xy + sh5 yz + sh6 (3z^2 - 1) + sh7 xz + sh8 (x^2 - y^2)
+    float sh[9][3];
+};
+
+string cookedTexturePath(const string& source, TextureUsage usage, bool gamma);
+string cookedCubemapPath(const vector<string>& faces);
+
+// Offline step: encodes the source image(s) with a CPU-built mip chain into a KTX file
+bool cookTexture(const string& source, const string& cooked, TextureUsage usage, bool gamma);
+bool cookCubemap(const vector<string>& faces, const string& cooked);
+bool cookVirtualTexture(const vector<VirtualTextureLayer>& layers, const string& cooked);
+string cookedVirtualTexturePath(const vector<VirtualTextureLayer>& layers);
+// Projects the faces into spherical harmonics and prefilters the specular chain, spread over pool
+bool cookEnvironment(const vector<string>& faces, const string& cooked, ThreadPool& pool);
+string cookedEnvironmentPath(const vector<string>& faces);
+
+// Maps the cooked data, cooking it first if it is missing or older than the source.
+// Safe to call from worker threads, returns nullptr if the source can't be read.
+unique_ptr<CompressedTexture> loadCookedTexture(const string& source, TextureUsage usage, bool gamma);
+unique_ptr<CompressedTexture> loadCookedCubemap(const vector<string>& faces);
+// Opens the tile file, cooking it first when stale; header points into file on success
+bool loadCookedVirtualTexture(const vector<VirtualTextureLayer>& layers, AssetFile& file, const TileFileHeader*& header);
+bool loadCookedEnvironment(const vector<string>& faces, ThreadPool& pool, AssetFile& file, const EnvironmentFileHeader*& header);
+
+// Whether the driver can sample the block format, needs a current context
+bool supportsCompressedFormat(unsigned int internalFormat);
+
+#endif
@@ -0,0 +1,87 @@
+#include "TextureRegistry.h"
+#include "TextureStreamer.h"
+#include "TextureUploader.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <filesystem>
+
+TextureRegistry& TextureRegistry::instance()
+{
+	static TextureRegistry registry;
+	return registry;
+}
+
+TextureKey TextureRegistry::makeKey(const string& path, bool gamma)
+{
+	// material files mix separators, so normalize before resolving
+	string normalized = path;
+	replace(normalized.begin(), normalized.end(), '\\', '/');
+	error_code ec;
+	filesystem::path canonical = filesystem::weakly_canonical(filesystem::path(normalized), ec);
+	return { ec ? normalized : canonical.generic_string(), gamma };
+}
+
+TextureKey TextureRegistry::makeCubemapKey(const vector<string>& faces)
+{
+	TextureKey key = { "cubemap:", false };
+	for (const string& face : faces)
+		key.path += makeKey(face, false).path + ';';
+	return key;
+}
+
+unsigned int TextureRegistry::acquire(const TextureKey& key, const function<unsigned int()>& create)
+{
+	unsigned int id = acquire(key);
+	if (id != 0)
+		return id;
+
+	id = create();
+	// nothing to share, the next acquire tries again
+	if (id == 0)
+		return 0;
+	lock_guard<mutex> guard(lock);
+	entries[key] = { id, 1 };
+	keys[id] = key;
+	return id;
+}
+
+unsigned int TextureRegistry::acquire(const TextureKey& key)
+{
+	lock_guard<mutex> guard(lock);
+	auto entry = entries.find(key);
+	if (entry == entries.end())
+		return 0;
+	entry->second.refCount++;
+	return entry->second.id;
+}
+
+void TextureRegistry::release(unsigned int id)
+{
+	lock_guard<mutex> guard(lock);
+	auto key = keys.find(id);
+	if (key == keys.end())
+		return;
+	auto entry = entries.find(key->second);
+	if (--entry->second.refCount == 0)
+	{
+		TextureUploader::instance().cancel(id);
+		TextureStreamer::instance().remove(id);
+		glDeleteTextures(1, &id);
+		entries.erase(entry);
+		keys.erase(key);
+	}
+}
+
+bool TextureRegistry::contains(const TextureKey& key)
+{
+	lock_guard<mutex> guard(lock);
+	return entries.find(key) != entries.end();
+}
+
+size_t TextureRegistry::size()
+{
+	lock_guard<mutex> guard(lock);
+	return entries.size();
+}
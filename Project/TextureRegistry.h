@@ -0,0 +1,58 @@
+#ifndef TEXTURE_REGISTRY_H
+#define TEXTURE_REGISTRY_H
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Textures are shared per canonical path and colorspace
+struct TextureKey {
+    string path;
+    bool gamma;
+
+    bool operator==(const TextureKey& other) const { return gamma == other.gamma && path == other.path; }
+};
+
+struct TextureKeyHash {
+    size_t operator()(const TextureKey& key) const { return hash<string>()(key.path) ^ (key.gamma ? 0x9e3779b9u : 0u); }
+};
+
+// Process-wide, reference counted owner of every texture object.
+// acquire/release must run on the GL thread, contains() is safe anywhere.
+class TextureRegistry
+{
+public:
+    static TextureRegistry& instance();
+
+    static TextureKey makeKey(const string& path, bool gamma);
+    static TextureKey makeCubemapKey(const vector<string>& faces);
+
+    // Returns the texture for key, calling create() only if it isn't resident yet.
+    // Every call adds one reference.
+    unsigned int acquire(const TextureKey& key, const function<unsigned int()>& create);
+    // Adds a reference to a resident texture, returns 0 if there is none
+    unsigned int acquire(const TextureKey& key);
+    // Drops one reference, the GL texture is deleted with the last one
+    void release(unsigned int id);
+
+    bool contains(const TextureKey& key);
+    size_t size();
+
+private:
+    struct Entry {
+        unsigned int id;
+        unsigned int refCount;
+    };
+
+    unordered_map<TextureKey, Entry, TextureKeyHash> entries;
+    unordered_map<unsigned int, TextureKey> keys;
+    mutex lock;
+
+    TextureRegistry() {}
+};
+
+#endif
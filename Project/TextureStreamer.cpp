@@ -0,0 +1,162 @@
+#include "TextureStreamer.h"
+#include "TextureUploader.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+	// levels this size and smaller are uploaded with the texture and never evicted
+	const unsigned int TAIL_SIZE = 128;
+}
+
+TextureStreamer& TextureStreamer::instance()
+{
+	static TextureStreamer streamer;
+	return streamer;
+}
+
+TextureStreamer::TextureStreamer() : budget(64 * 1024 * 1024), frame(1), bytes(0), levelsIn(0), levelsOut(0)
+{
+}
+
+size_t TextureStreamer::levelBytes(const Entry& entry, int finest, int coarsest)
+{
+	size_t total = 0;
+	for (int level = finest; level <= coarsest; level++)
+		total += entry.source->imageSizes[level];
+	return total;
+}
+
+unsigned int TextureStreamer::add(unique_ptr<CompressedTexture> texture)
+{
+	TextureUploader& uploader = TextureUploader::instance();
+	if (texture->faces != 1)
+		return uploader.upload(move(texture));
+	if (!supportsCompressedFormat(texture->internalFormat))
+		return 0;
+
+	Entry entry;
+	int coarsest = int(texture->levels) - 1;
+	entry.tail = 0;
+	while (entry.tail < coarsest && max(texture->width, texture->height) >> entry.tail > TAIL_SIZE)
+		entry.tail++;
+	entry.resident = entry.desired = entry.tail;
+	entry.uvPerPixel = FLT_MAX;
+	entry.lastUsed = 0;
+	unsigned int textureID = uploader.create(*texture);
+	// the mapping stays open so evicted levels can be streamed in again
+	entry.source = shared_ptr<const CompressedTexture>(move(texture));
+	uploader.uploadLevels(textureID, entry.source, coarsest, entry.tail);
+	bytes += levelBytes(entry, entry.tail, coarsest);
+	entries[textureID] = entry;
+	return textureID;
+}
+
+void TextureStreamer::remove(unsigned int textureID)
+{
+	auto entry = entries.find(textureID);
+	if (entry == entries.end())
+		return;
+	bytes -= levelBytes(entry->second, entry->second.resident, int(entry->second.source->levels) - 1);
+	entries.erase(entry);
+}
+
+void TextureStreamer::touch(unsigned int textureID, float uvPerPixel)
+{
+	auto entry = entries.find(textureID);
+	if (entry == entries.end())
+		return;
+	entry->second.uvPerPixel = min(entry->second.uvPerPixel, uvPerPixel);
+	entry->second.lastUsed = frame;
+}
+
+bool TextureStreamer::evictOne(unsigned int keep)
+{
+	TextureUploader& uploader = TextureUploader::instance();
+	unsigned int victimID = 0;
+	Entry* victim = nullptr;
+	for (auto& item : entries)
+	{
+		// levels finer than the last draw asked for are spare, all but the tail once it isn't drawn
+		Entry& entry = item.second;
+		int needed = entry.lastUsed == frame ? entry.desired : entry.tail;
+		if (item.first == keep || entry.resident >= needed || uploader.isPending(item.first))
+			continue;
+		if (!victim || entry.lastUsed < victim->lastUsed)
+		{
+			victim = &entry;
+			victimID = item.first;
+		}
+	}
+	if (!victim)
+		return false;
+
+	glBindTexture(GL_TEXTURE_2D, victimID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, victim->resident + 1);
+	// respecifying the level as empty hands its storage back to the driver
+	glCompressedTexImage2D(GL_TEXTURE_2D, victim->resident, victim->source->internalFormat, 0, 0, 0, 0, nullptr);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	bytes -= levelBytes(*victim, victim->resident, victim->resident);
+	victim->resident++;
+	levelsOut++;
+	return true;
+}
+
+void TextureStreamer::update()
+{
+	for (auto& item : entries)
+	{
+		Entry& entry = item.second;
+		if (entry.lastUsed != frame)
+			continue;
+		// mip where one texel covers about one pixel
+		float texels = float(max(entry.source->width, entry.source->height)) * entry.uvPerPixel;
+		entry.desired = texels > 1.0f ? min(int(log2f(texels)), entry.tail) : 0;
+		entry.uvPerPixel = FLT_MAX;
+	}
+
+	TextureUploader& uploader = TextureUploader::instance();
+	for (auto& item : entries)
+	{
+		Entry& entry = item.second;
+		if (entry.lastUsed != frame || entry.desired >= entry.resident || uploader.isPending(item.first))
+			continue;
+		int target = entry.desired;
+		while (bytes + levelBytes(entry, target, entry.resident - 1) > budget && evictOne(item.first))
+			;
+		// what still doesn't fit waits until something else goes out of use
+		while (target < entry.resident && bytes + levelBytes(entry, target, entry.resident - 1) > budget)
+			target++;
+		if (target == entry.resident)
+			continue;
+		uploader.uploadLevels(item.first, entry.source, entry.resident - 1, target);
+		bytes += levelBytes(entry, target, entry.resident - 1);
+		levelsIn += entry.resident - target;
+		entry.resident = target;
+	}
+
+	// a budget lowered at runtime applies even when nothing is streaming in
+	while (bytes > budget && evictOne(0))
+		;
+	frame++;
+}
+
+size_t TextureStreamer::fullBytes() const
+{
+	size_t total = 0;
+	for (const auto& item : entries)
+		total += levelBytes(item.second, 0, int(item.second.source->levels) - 1);
+	return total;
+}
+
+void TextureStreamer::printStats() const
+{
+	cout << "Texture streaming: " << entries.size() << " textures, " << bytes / (1024.0 * 1024.0) << " MiB resident of "
+		<< fullBytes() / (1024.0 * 1024.0) << " MiB full chains, budget " << budget / (1024.0 * 1024.0) << " MiB, "
+		<< levelsIn << " levels streamed in, " << levelsOut << " evicted" << endl;
+}
@@ -0,0 +1,59 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+
+#include "TextureCook.h"
+using namespace std;
+
+// Keeps each cooked model texture at the mip level its on-screen use needs, under a memory budget.
+// Draws report how many UV units a screen pixel spans; update() streams finer levels in through
+// TextureUploader and, when over budget, drops the finest levels of the least recently used
+// textures. The coarse tail of every chain stays resident. GL thread only.
+class TextureStreamer
+{
+public:
+    // bytes of streamed texture levels allowed on the GPU, tails included
+    size_t budget;
+
+    static TextureStreamer& instance();
+
+    // Takes over a cooked 2D chain and uploads its tail, finer levels follow once it is drawn.
+    // Returns 0 if the driver lacks the block format.
+    unsigned int add(unique_ptr<CompressedTexture> texture);
+    // Forgets a texture that is about to be deleted
+    void remove(unsigned int textureID);
+    // A draw this frame samples the texture with uvPerPixel UV units across one pixel
+    void touch(unsigned int textureID, float uvPerPixel);
+    // Once per frame after the draws: picks the wanted levels and streams them in or out
+    void update();
+
+    size_t residentBytes() const { return bytes; }
+    // what the managed textures would take with every level resident
+    size_t fullBytes() const;
+    void printStats() const;
+
+private:
+    struct Entry {
+        shared_ptr<const CompressedTexture> source;
+        int resident;       // finest level with storage, every coarser one has it too
+        int tail;           // finest level that is never evicted
+        int desired;        // as of the last frame the texture was drawn
+        float uvPerPixel;   // smallest footprint reported this frame
+        unsigned long long lastUsed;
+    };
+
+    unordered_map<unsigned int, Entry> entries;
+    unsigned long long frame;
+    size_t bytes;
+    size_t levelsIn, levelsOut;
+
+    TextureStreamer();
+    static size_t levelBytes(const Entry& entry, int finest, int coarsest);
+    // drops the finest spare level of the least recently used texture other than keep
+    bool evictOne(unsigned int keep);
+};
+
+#endif
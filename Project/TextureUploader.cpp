@@ -0,0 +1,331 @@
+#include "TextureUploader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+	const size_t RING_CAPACITY = 16 * 1024 * 1024;
+	// compressed blocks are at most 16 bytes, keeping slices aligned keeps every source offset legal
+	const size_t SLICE_ALIGNMENT = 16;
+
+	GLenum faceTarget(GLenum target, unsigned int face)
+	{
+		return target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target;
+	}
+}
+
+TextureUploader& TextureUploader::instance()
+{
+	static TextureUploader uploader;
+	return uploader;
+}
+
+TextureUploader::TextureUploader() : frameBudget(4 * 1024 * 1024), buffer(0), capacity(0), head(0), used(0), pending(0),
+	mapped(nullptr), bufferStorage(nullptr), lastFrameBytes(0)
+{
+}
+
+void TextureUploader::createRing()
+{
+	capacity = RING_CAPACITY;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	if (hasGLExtension("GL_ARB_buffer_storage"))
+		bufferStorage = (PFNGLBUFFERSTORAGEPROC)getGLProcAddress("glBufferStorage");
+	if (bufferStorage)
+	{
+		// mapped once for the whole run, fences tell when a region may be written again
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		bufferStorage(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, flags);
+		mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, capacity, flags);
+	}
+	else
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	cout << "Texture staging ring: " << capacity / (1024 * 1024) << " MiB, " << (mapped ? "persistent mapping" : "mapped per slice") << endl;
+}
+
+bool TextureUploader::allocate(size_t size, size_t& offset)
+{
+	size = (size + SLICE_ALIGNMENT - 1) & ~(SLICE_ALIGNMENT - 1);
+	size_t skipped = head + size > capacity ? capacity - head : 0;
+	if (used + skipped + size > capacity)
+		return false;
+	offset = skipped ? 0 : head;
+	head = offset + size;
+	used += skipped + size;
+	pending += skipped + size;
+	return true;
+}
+
+void TextureUploader::retire()
+{
+	// never waits: a batch the GPU is still reading keeps its space until a later frame
+	while (!batches.empty())
+	{
+		GLenum status = glClientWaitSync(batches.front().fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			break;
+		glDeleteSync(batches.front().fence);
+		used -= batches.front().bytes;
+		batches.pop_front();
+	}
+	if (batches.empty() && !pending)
+		head = used = 0;
+}
+
+unsigned int TextureUploader::upload(unique_ptr<CompressedTexture> texture)
+{
+	if (!supportsCompressedFormat(texture->internalFormat))
+		return 0;
+	unsigned int textureID = create(*texture);
+	int coarsest = int(texture->levels) - 1;
+	uploadLevels(textureID, shared_ptr<const CompressedTexture>(move(texture)), coarsest, 0);
+	return textureID;
+}
+
+unsigned int TextureUploader::create(const CompressedTexture& texture)
+{
+	GLenum target = texture.faces == 6 ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+	unsigned int textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(target, textureID);
+	// sampling is clamped to the levels that have landed, BASE_LEVEL drops as finer ones arrive
+	glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, texture.levels - 1);
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, texture.levels - 1);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, texture.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	if (target == GL_TEXTURE_CUBE_MAP)
+	{
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	}
+	else
+	{
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	}
+	return textureID;
+}
+
+void TextureUploader::uploadLevels(unsigned int textureID, shared_ptr<const CompressedTexture> source, int coarsest, int finest)
+{
+	Job job;
+	job.texture = textureID;
+	job.target = source->faces == 6 ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+	job.format = source->internalFormat;
+	job.level = coarsest;
+	job.finest = finest;
+	job.face = job.row = 0;
+	glBindTexture(job.target, textureID);
+	// storage for the whole range up front, the contents follow from the ring
+	for (int level = finest; level <= coarsest; level++)
+	{
+		GLsizei width = max(1u, source->width >> level), height = max(1u, source->height >> level);
+		for (unsigned int f = 0; f < source->faces; f++)
+			glCompressedTexImage2D(faceTarget(job.target, f), level, job.format, width, height, 0,
+				source->imageSizes[level * source->faces + f], nullptr);
+	}
+	job.compressed = move(source);
+	jobs.push_back(move(job));
+}
+
+unsigned int TextureUploader::upload(ImageData image, bool gamma)
+{
+	unsigned int textureID;
+	glGenTextures(1, &textureID);
+	if (!image.pixels)
+		return textureID;
+
+	GLenum internalFormat = GL_RED;
+	GLenum format = GL_RED;
+	if (image.components == 3)
+	{
+		internalFormat = gamma ? GL_SRGB : GL_RGB;
+		format = GL_RGB;
+	}
+	else if (image.components == 4)
+	{
+		internalFormat = gamma ? GL_SRGB_ALPHA : GL_RGBA;
+		format = GL_RGBA;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+	// level 0 only until the mips are generated
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	Job job;
+	job.texture = textureID;
+	job.target = GL_TEXTURE_2D;
+	job.format = format;
+	job.level = job.finest = 0;
+	job.face = job.row = 0;
+	job.images.push_back(move(image));
+	jobs.push_back(move(job));
+	return textureID;
+}
+
+unsigned int TextureUploader::uploadCubemap(vector<ImageData> faces)
+{
+	Job job;
+	job.target = GL_TEXTURE_CUBE_MAP;
+	job.format = GL_RGB;
+	job.level = job.finest = 0;
+	job.face = job.row = 0;
+	glGenTextures(1, &job.texture);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, job.texture);
+	for (unsigned int f = 0; f < faces.size(); f++)
+		if (faces[f].pixels)
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, GL_RGB, faces[f].width, faces[f].height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	job.images = move(faces);
+	unsigned int textureID = job.texture;
+	jobs.push_back(move(job));
+	return textureID;
+}
+
+void TextureUploader::cancel(unsigned int textureID)
+{
+	jobs.erase(remove_if(jobs.begin(), jobs.end(), [textureID](const Job& job) { return job.texture == textureID; }), jobs.end());
+}
+
+bool TextureUploader::isPending(unsigned int textureID) const
+{
+	for (const Job& job : jobs)
+		if (job.texture == textureID)
+			return true;
+	return false;
+}
+
+bool TextureUploader::stage(Job& job, size_t budget)
+{
+	// one face of one level is a stack of rows; a slice is as many rows as the budget and ring allow
+	GLsizei width, height;
+	size_t rows, rowBytes;
+	const unsigned char* source;
+	if (job.compressed)
+	{
+		const CompressedTexture& texture = *job.compressed;
+		width = max(1u, texture.width >> job.level);
+		height = max(1u, texture.height >> job.level);
+		unsigned int image = job.level * texture.faces + job.face;
+		rows = (height + 3) / 4;
+		rowBytes = texture.imageSizes[image] / rows;
+		source = texture.images[image];
+	}
+	else
+	{
+		const ImageData& image = job.images[job.face];
+		width = image.width;
+		height = image.height;
+		rows = image.pixels ? size_t(height) : 0;
+		rowBytes = size_t(width) * (job.target == GL_TEXTURE_CUBE_MAP ? 3 : image.components);
+		source = image.pixels;
+	}
+
+	size_t count = rows - job.row;
+	size_t offset = 0;
+	if (count)
+	{
+		// the first slice of a frame goes through however wide its rows are
+		count = min(count, (budget > lastFrameBytes ? budget - lastFrameBytes : 0) / rowBytes);
+		if (!count && lastFrameBytes)
+			return false;
+		count = max(count, size_t(1));
+		while (count && !allocate(count * rowBytes, offset))
+			count /= 2;
+		if (!count)
+			return false;
+	}
+
+	if (count)
+	{
+		size_t bytes = count * rowBytes;
+		const unsigned char* slice = source + job.row * rowBytes;
+		if (mapped)
+			memcpy(mapped + offset, slice, bytes);
+		else
+		{
+			// the fences already keep this range out of the GPU's hands, so no implicit sync is needed
+			void* target = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, bytes,
+				GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+			memcpy(target, slice, bytes);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+
+		glBindTexture(job.target, job.texture);
+		GLenum face = faceTarget(job.target, job.face);
+		if (job.compressed)
+		{
+			GLsizei y = GLsizei(job.row) * 4;
+			glCompressedTexSubImage2D(face, job.level, 0, y, width, min(height - y, GLsizei(count) * 4),
+				job.format, GLsizei(bytes), (const void*)offset);
+		}
+		else
+			glTexSubImage2D(face, 0, 0, job.row, width, GLsizei(count), job.format, GL_UNSIGNED_BYTE, (const void*)offset);
+		job.row += (unsigned int)count;
+		lastFrameBytes += bytes;
+	}
+
+	if (job.row < rows)
+		return true;
+	job.row = 0;
+	if (++job.face < (job.compressed ? job.compressed->faces : job.images.size()))
+		return true;
+	job.face = 0;
+	if (job.compressed)
+		glTexParameteri(job.target, GL_TEXTURE_BASE_LEVEL, job.level);
+	job.level = job.compressed && job.level > job.finest ? job.level - 1 : -1;
+	return true;
+}
+
+void TextureUploader::finish(Job& job)
+{
+	if (job.compressed || job.target == GL_TEXTURE_CUBE_MAP)
+		return;
+	// generated from the level that just landed, on the GPU like before
+	glBindTexture(GL_TEXTURE_2D, job.texture);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+}
+
+void TextureUploader::update()
+{
+	lastFrameBytes = 0;
+	if (!buffer && !jobs.empty())
+		createRing();
+	retire();
+	if (jobs.empty())
+		return;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	while (!jobs.empty() && stage(jobs.front(), frameBudget))
+		if (jobs.front().level < 0)
+		{
+			finish(jobs.front());
+			jobs.pop_front();
+		}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if (pending)
+	{
+		batches.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), pending });
+		pending = 0;
+	}
+}
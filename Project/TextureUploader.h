@@ -0,0 +1,83 @@
+#ifndef TEXTURE_UPLOADER_H
+#define TEXTURE_UPLOADER_H
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "GLExtensions.h"
+#include "Model.h"
+#include "TextureCook.h"
+using namespace std;
+
+// Moves texel data to the GPU through a ring of pixel unpack buffer memory, a slice per frame.
+// A texture gets its name and storage right away and fills in over the next frames, coarsest
+// mip first; ring space is reclaimed by fences, so a full ring defers work instead of waiting.
+// GL thread only.
+class TextureUploader
+{
+public:
+    // bytes staged per update(), the rest waits for the next frame
+    size_t frameBudget;
+
+    static TextureUploader& instance();
+
+    // Queues every level of a cooked chain, returns 0 if the driver lacks the block format
+    unsigned int upload(unique_ptr<CompressedTexture> texture);
+    // Creates a texture object for the chain with its sampling state but no level storage
+    unsigned int create(const CompressedTexture& texture);
+    // Allocates levels finest..coarsest and queues them coarsest first, the texture must already
+    // hold every level coarser than that range
+    void uploadLevels(unsigned int textureID, shared_ptr<const CompressedTexture> source, int coarsest, int finest);
+    // Queues level 0 of decoded pixels, the mips are generated once it has landed
+    unsigned int upload(ImageData image, bool gamma = false);
+    // Queues the six faces of a cubemap without mips, faces that failed to decode stay undefined
+    unsigned int uploadCubemap(vector<ImageData> faces);
+    // Drops queued work for a texture that is about to be deleted
+    void cancel(unsigned int textureID);
+    bool isPending(unsigned int textureID) const;
+
+    // Once per frame: reclaims ring space the GPU is done with and stages the next slice
+    void update();
+    bool idle() const { return jobs.empty(); }
+    size_t stagedLastFrame() const { return lastFrameBytes; }
+
+private:
+    struct Job {
+        unsigned int texture;
+        GLenum target;
+        shared_ptr<const CompressedTexture> compressed;
+        vector<ImageData> images;   // raw level 0 per face
+        GLenum format;
+        int level;                  // level being staged, -1 once everything has landed
+        int finest;                 // last compressed level to stage
+        unsigned int face;
+        unsigned int row;           // next pixel row, block row for compressed levels
+    };
+    struct Batch {
+        GLsync fence;
+        size_t bytes;
+    };
+
+    unsigned int buffer;
+    size_t capacity;
+    size_t head;            // next free byte
+    size_t used;            // bytes the GPU may still read, including the tail skipped on wrap
+    size_t pending;         // bytes staged since the last fence
+    unsigned char* mapped;  // persistent mapping, nullptr when each slice is mapped on its own
+    PFNGLBUFFERSTORAGEPROC bufferStorage;
+    deque<Batch> batches;
+    deque<Job> jobs;
+    size_t lastFrameBytes;
+
+    TextureUploader();
+    void createRing();
+    bool allocate(size_t size, size_t& offset);
+    void retire();
+    // stages one slice of job, false if the budget or the ring is exhausted
+    bool stage(Job& job, size_t budget);
+    void finish(Job& job);
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "ThreadPool.h"
+
+namespace
+{
+	// the pool whose worker loop runs on this thread
+	thread_local const ThreadPool* currentPool = nullptr;
+}
+
+ThreadPool::ThreadPool(unsigned int threads) : stopping(false)
+{
+	if (threads == 0)
+	{
+		unsigned int hardware = std::thread::hardware_concurrency();
+		threads = hardware > 1 ? hardware - 1 : 1;
+	}
+	for (unsigned int i = 0; i < threads; i++)
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+bool ThreadPool::onWorker() const
+{
+	return currentPool == this;
+}
+
+bool ThreadPool::runPending()
+{
+	std::function<void()> job;
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		if (tasks.empty())
+			return false;
+		job = std::move(tasks.front());
+		tasks.pop_front();
+	}
+	job();
+	return true;
+}
+
+void ThreadPool::workerLoop()
+{
+	currentPool = this;
+	for (;;)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			wakeUp.wait(lock, [this]() { return stopping || !tasks.empty(); });
+			if (stopping && tasks.empty())
+				return;
+			job = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		job();
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    // threads = 0 picks one worker per hardware thread, minus the caller
+    explicit ThreadPool(unsigned int threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    template<class F>
+    auto submit(F&& job) -> std::future<decltype(job())>
+    {
+        using Result = decltype(job());
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+        std::future<Result> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            tasks.push_back([task]() { (*task)(); });
+        }
+        wakeUp.notify_one();
+        return result;
+    }
+
+    // Blocks until the future is ready. On a worker it runs queued jobs meanwhile, so jobs may
+    // wait on jobs they submitted without deadlocking; any other thread (the GL thread) only
+    // sleeps, it would otherwise pick up whatever is queued, a whole model import included.
+    template<class T>
+    T wait(std::future<T>& result)
+    {
+        if (!onWorker())
+            return result.get();
+        while (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            if (!runPending())
+                result.wait_for(std::chrono::microseconds(200));
+        }
+        return result.get();
+    }
+
+    unsigned int size() const { return (unsigned int)workers.size(); }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex queueMutex;
+    std::condition_variable wakeUp;
+    bool stopping;
+
+    bool onWorker() const;
+    bool runPending();
+    void workerLoop();
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "VirtualFileSystem.h"
+
+#include <filesystem>
+#include <iostream>
+
+using namespace std;
+
+AssetFile::AssetFile() : ptr(nullptr), length(0)
+{
+}
+
+void AssetFile::close()
+{
+	ptr = nullptr;
+	length = 0;
+	mapping.reset();
+	buffer.clear();
+	buffer.shrink_to_fit();
+}
+
+VirtualFileSystem& VirtualFileSystem::instance()
+{
+	static VirtualFileSystem vfs;
+	return vfs;
+}
+
+bool VirtualFileSystem::mount(const string& packPath)
+{
+	unique_ptr<AssetPack> pack(new AssetPack());
+	if (!pack->open(packPath))
+		return false;
+	cout << "Mounted " << packPath << " (" << pack->entryCount() << " files)" << endl;
+	packs.push_back(move(pack));
+	return true;
+}
+
+const AssetPack::Entry* VirtualFileSystem::find(const string& path, const AssetPack*& pack) const
+{
+	if (packs.empty())
+		return nullptr;
+	string key = normalizeAssetPath(path);
+	for (const unique_ptr<AssetPack>& candidate : packs)
+		if (const AssetPack::Entry* entry = candidate->find(key))
+		{
+			pack = candidate.get();
+			return entry;
+		}
+	return nullptr;
+}
+
+bool VirtualFileSystem::open(const string& path, AssetFile& file) const
+{
+	file.close();
+	const AssetPack* pack = nullptr;
+	if (const AssetPack::Entry* entry = find(path, pack))
+	{
+		// stored entries are handed out in place, compressed ones are inflated into the file
+		if (entry->storedSize == entry->size)
+			file.ptr = pack->data(*entry);
+		else if (pack->extract(*entry, file.buffer))
+			file.ptr = file.buffer.data();
+		else
+		{
+			cout << "ERROR::VFS:: Corrupt pack entry " << path << endl;
+			return false;
+		}
+		file.length = size_t(entry->size);
+		return file.ptr != nullptr;
+	}
+
+	file.mapping.reset(new MappedFile());
+	if (!file.mapping->open(path))
+	{
+		file.mapping.reset();
+		return false;
+	}
+	file.ptr = file.mapping->data();
+	file.length = file.mapping->size();
+	return true;
+}
+
+bool VirtualFileSystem::exists(const string& path) const
+{
+	const AssetPack* pack = nullptr;
+	error_code ec;
+	return find(path, pack) || filesystem::is_regular_file(path, ec);
+}
+
+bool VirtualFileSystem::modifiedTime(const string& path, int64_t& ticks) const
+{
+	const AssetPack* pack = nullptr;
+	if (const AssetPack::Entry* entry = find(path, pack))
+	{
+		ticks = entry->modified;
+		return true;
+	}
+	error_code ec;
+	filesystem::file_time_type time = filesystem::last_write_time(path, ec);
+	if (ec)
+		return false;
+	ticks = time.time_since_epoch().count();
+	return true;
+}
+
+bool VirtualFileSystem::stat(const string& path, uint64_t& size, int64_t& ticks) const
+{
+	const AssetPack* pack = nullptr;
+	if (const AssetPack::Entry* entry = find(path, pack))
+	{
+		size = entry->size;
+		ticks = entry->modified;
+		return true;
+	}
+	error_code ec;
+	size = filesystem::file_size(path, ec);
+	return !ec && modifiedTime(path, ticks);
+}
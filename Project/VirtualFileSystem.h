@@ -0,0 +1,63 @@
+#ifndef VIRTUAL_FILE_SYSTEM_H
+#define VIRTUAL_FILE_SYSTEM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AssetPack.h"
+#include "MappedFile.h"
+using namespace std;
+
+// Contents of one asset: points into a mounted pack, or owns a mapping of a loose file
+// or the decompressed bytes of a packed one.
+class AssetFile
+{
+public:
+    AssetFile();
+    AssetFile(AssetFile&&) = default;
+    AssetFile& operator=(AssetFile&&) = default;
+    AssetFile(const AssetFile&) = delete;
+    AssetFile& operator=(const AssetFile&) = delete;
+
+    bool isOpen() const { return ptr != nullptr; }
+    const unsigned char* data() const { return ptr; }
+    size_t size() const { return length; }
+    void close();
+
+private:
+    friend class VirtualFileSystem;
+
+    const unsigned char* ptr;
+    size_t length;
+    unique_ptr<MappedFile> mapping;
+    vector<unsigned char> buffer;
+};
+
+// Resolves asset paths against the mounted packs first, then the working directory.
+// Mount before any loading starts; lookups are read-only and safe from any thread.
+class VirtualFileSystem
+{
+public:
+    static VirtualFileSystem& instance();
+
+    // Adds a pack behind the ones already mounted, false if it is missing or invalid
+    bool mount(const string& packPath);
+
+    bool open(const string& path, AssetFile& file) const;
+    bool exists(const string& path) const;
+    // file_time_type ticks of the source, recorded at pack time for packed files
+    bool modifiedTime(const string& path, int64_t& ticks) const;
+    // size and modifiedTime together, enough to tell an unchanged file without reading it
+    bool stat(const string& path, uint64_t& size, int64_t& ticks) const;
+
+private:
+    vector<unique_ptr<AssetPack>> packs;
+
+    VirtualFileSystem() {}
+    const AssetPack::Entry* find(const string& path, const AssetPack*& pack) const;
+};
+
+#endif
@@ -0,0 +1,381 @@
+#include "VirtualTexture.h"
+#include "GLExtensions.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+	const unsigned int ATLAS_SLOTS = 16;            // per side, 256 tiles resident at once
+	const uint32_t NO_TILE = 0xFFFFFFFFu;
+	const unsigned long long PINNED = ULLONG_MAX;
+	const int FEEDBACK_DIVISOR = 8;                 // feedback is rendered at 1/8 of the viewport
+	const size_t MAX_LOADS_IN_FLIGHT = 32;
+	const size_t MAX_UPLOADS_PER_FRAME = 16;
+
+	const UniformHandle<bool> virtualTexturedUniform("virtualTextured");
+	const UniformHandle<int> pageTableUniform("vtPageTable");
+	const UniformHandle<glm::vec4> layoutUniform("vtLayout");
+	const UniformHandle<glm::vec3> tileUniform("vtTile");
+	const UniformHandle<float> feedbackBiasUniform("vtFeedbackBias");
+
+	const UniformHandle<int>& atlasUniform(unsigned int layer)
+	{
+		static vector<UniformHandle<int>> atlases;
+		while (atlases.size() <= layer)
+			atlases.emplace_back("vtAtlas" + to_string(atlases.size()));
+		return atlases[layer];
+	}
+}
+
+VirtualTexture::VirtualTexture(ThreadPool& pool) : pool(pool), ready(false), header(nullptr), tileBytes(0), pageTable(0),
+	frame(0), pageTableDirty(false), feedbackFBO(0), feedbackColor(0), feedbackDepth(0), feedbackWidth(0), feedbackHeight(0),
+	readbackBuffers(), readbackFences(), readbackHead(0), savedFramebuffer(0), savedViewport()
+{
+}
+
+VirtualTexture::~VirtualTexture()
+{
+	// workers may still be reading the mapping
+	if (opening.valid())
+		pool.wait(opening);
+	for (auto& load : loading)
+		pool.wait(load.second);
+	if (!ready)
+		return;
+	glDeleteTextures(GLsizei(atlases.size()), atlases.data());
+	glDeleteTextures(1, &pageTable);
+	for (int i = 0; i < 3; i++)
+		if (readbackFences[i])
+			glDeleteSync(readbackFences[i]);
+	glDeleteBuffers(3, readbackBuffers);
+	if (feedbackFBO)
+	{
+		glDeleteFramebuffers(1, &feedbackFBO);
+		glDeleteRenderbuffers(1, &feedbackColor);
+		glDeleteRenderbuffers(1, &feedbackDepth);
+	}
+}
+
+void VirtualTexture::open(const vector<VirtualTextureLayer>& layers)
+{
+	if (opening.valid() || ready)
+		return;
+	opening = pool.submit([this, layers]() {
+		return loadCookedVirtualTexture(layers, file, header);
+	});
+}
+
+uint32_t VirtualTexture::tileKey(unsigned int level, unsigned int x, unsigned int y)
+{
+	return (level << 16) | (y << 8) | x;
+}
+
+unsigned int VirtualTexture::tilesX(unsigned int level) const
+{
+	return max(1u, (header->width >> level) / header->tileSize);
+}
+
+unsigned int VirtualTexture::tilesY(unsigned int level) const
+{
+	return max(1u, (header->height >> level) / header->tileSize);
+}
+
+const unsigned char* VirtualTexture::tileData(uint32_t key) const
+{
+	unsigned int level = key >> 16, y = (key >> 8) & 0xFF, x = key & 0xFF;
+	return file.data() + sizeof(TileFileHeader) + (levelFirstTile[level] + size_t(y) * tilesX(level) + x) * tileBytes;
+}
+
+void VirtualTexture::createGLObjects()
+{
+	levelFirstTile.clear();
+	size_t tiles = 0;
+	for (unsigned int level = 0; level < header->levels; level++)
+	{
+		levelFirstTile.push_back(tiles);
+		tiles += size_t(tilesX(level)) * tilesY(level);
+	}
+	tileBytes = 0;
+	for (unsigned int i = 0; i < header->layerCount; i++)
+		tileBytes += header->layerBytes[i];
+
+	// one block-compressed atlas per layer, a single level: the page table already picked the mip
+	GLsizei atlasSize = ATLAS_SLOTS * (header->tileSize + 2 * header->border);
+	atlases.resize(header->layerCount);
+	glGenTextures(GLsizei(atlases.size()), atlases.data());
+	for (unsigned int i = 0; i < header->layerCount; i++)
+	{
+		GLsizei blocks = (header->tileSize + 2 * header->border) / 4;
+		GLsizei imageSize = GLsizei(header->layerBytes[i] / (blocks * blocks)) * (atlasSize / 4) * (atlasSize / 4);
+		glBindTexture(GL_TEXTURE_2D, atlases[i]);
+		glCompressedTexImage2D(GL_TEXTURE_2D, 0, header->formats[i], atlasSize, atlasSize, 0, imageSize, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+
+	// a texel per tile and level: atlas slot x, y, the level the slot holds, 255 when mapped
+	glGenTextures(1, &pageTable);
+	glBindTexture(GL_TEXTURE_2D, pageTable);
+	for (unsigned int level = 0; level < header->levels; level++)
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, tilesX(level), tilesY(level), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header->levels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	slots.assign(ATLAS_SLOTS * ATLAS_SLOTS, { NO_TILE, 0 });
+	// the coarsest level is always there to fall back to
+	unsigned int coarsest = header->levels - 1;
+	for (unsigned int y = 0; y < tilesY(coarsest); y++)
+		for (unsigned int x = 0; x < tilesX(coarsest); x++)
+		{
+			uint32_t key = tileKey(coarsest, x, y);
+			if (placeTile(key, tileData(key)))
+				slots[residentTiles[key]].lastUsed = PINNED;
+		}
+	rebuildPageTable();
+
+	glGenBuffers(3, readbackBuffers);
+	cout << "Virtual texture: " << header->width << "x" << header->height << ", " << header->levels << " levels, "
+		<< tiles << " tiles, atlas " << atlasSize << "x" << atlasSize << endl;
+}
+
+void VirtualTexture::bind(Shader* shader, unsigned int firstUnit) const
+{
+	shader->set(virtualTexturedUniform, ready);
+	if (!ready)
+		return;
+	glActiveTexture(GL_TEXTURE0 + firstUnit);
+	glBindTexture(GL_TEXTURE_2D, pageTable);
+	shader->set(pageTableUniform, int(firstUnit));
+	for (unsigned int i = 0; i < atlases.size(); i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + firstUnit + 1 + i);
+		glBindTexture(GL_TEXTURE_2D, atlases[i]);
+		shader->set(atlasUniform(i), int(firstUnit + 1 + i));
+	}
+	glActiveTexture(GL_TEXTURE0);
+
+	float slotSize = float(header->tileSize + 2 * header->border);
+	shader->set(layoutUniform, glm::vec4(float(header->width), float(header->height), float(header->levels - 1), slotSize * ATLAS_SLOTS));
+	shader->set(tileUniform, glm::vec3(float(header->tileSize), float(header->border), slotSize));
+	shader->set(feedbackBiasUniform, log2f(float(FEEDBACK_DIVISOR)));
+}
+
+bool VirtualTexture::wantsFeedback() const
+{
+	return ready && !readbackFences[readbackHead];
+}
+
+void VirtualTexture::beginFeedback()
+{
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &savedFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, savedViewport);
+	if (!feedbackFBO)
+	{
+		feedbackWidth = max(1, savedViewport[2] / FEEDBACK_DIVISOR);
+		feedbackHeight = max(1, savedViewport[3] / FEEDBACK_DIVISOR);
+		glGenFramebuffers(1, &feedbackFBO);
+		glGenRenderbuffers(1, &feedbackColor);
+		glGenRenderbuffers(1, &feedbackDepth);
+		glBindRenderbuffer(GL_RENDERBUFFER, feedbackColor);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, feedbackWidth, feedbackHeight);
+		glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, feedbackWidth, feedbackHeight);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, feedbackFBO);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackColor);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			cout << "ERROR::VIRTUAL_TEXTURE:: Feedback framebuffer not complete!" << endl;
+		for (unsigned int buffer : readbackBuffers)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+			glBufferData(GL_PIXEL_PACK_BUFFER, size_t(feedbackWidth) * feedbackHeight * 4, nullptr, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, feedbackFBO);
+	glViewport(0, 0, feedbackWidth, feedbackHeight);
+	glClearColor(0.f, 0.f, 0.f, 0.f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void VirtualTexture::endFeedback()
+{
+	// read back asynchronously, update() maps the buffer once its fence has passed
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[readbackHead]);
+	glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	readbackFences[readbackHead] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	readbackHead = (readbackHead + 1) % 3;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+	glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+}
+
+void VirtualTexture::requestTiles(const unsigned char* feedback, size_t pixels)
+{
+	vector<uint32_t> wanted;
+	for (size_t i = 0; i < pixels; i++)
+	{
+		const unsigned char* texel = feedback + i * 4;
+		if (texel[3] == 255 && texel[2] < header->levels)
+			wanted.push_back(tileKey(texel[2], texel[0], texel[1]));
+	}
+	sort(wanted.begin(), wanted.end());
+	wanted.erase(unique(wanted.begin(), wanted.end()), wanted.end());
+	// the ancestors too, so a surface sharpens level by level instead of waiting for the finest
+	for (size_t i = 0, count = wanted.size(); i < count; i++)
+	{
+		unsigned int level = wanted[i] >> 16, y = (wanted[i] >> 8) & 0xFF, x = wanted[i] & 0xFF;
+		while (++level < header->levels)
+			wanted.push_back(tileKey(level, x >>= 1, y >>= 1));
+	}
+	sort(wanted.begin(), wanted.end());
+	wanted.erase(unique(wanted.begin(), wanted.end()), wanted.end());
+
+	// coarsest first, the keys start with the level
+	for (auto key = wanted.rbegin(); key != wanted.rend(); ++key)
+	{
+		auto resident = residentTiles.find(*key);
+		if (resident != residentTiles.end())
+		{
+			if (slots[resident->second].lastUsed != PINNED)
+				slots[resident->second].lastUsed = frame;
+			continue;
+		}
+		if (loading.size() >= MAX_LOADS_IN_FLIGHT || loading.count(*key))
+			continue;
+		const unsigned char* source = tileData(*key);
+		size_t bytes = tileBytes;
+		loading[*key] = pool.submit([source, bytes]() {
+			// touching the mapping pages the tile in here rather than on the GL thread
+			return vector<unsigned char>(source, source + bytes);
+		});
+	}
+}
+
+bool VirtualTexture::placeTile(uint32_t key, const unsigned char* data)
+{
+	// a free slot, else the least recently used one that no draw asked for this frame
+	size_t best = slots.size();
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		if (slots[i].tile == NO_TILE)
+		{
+			best = i;
+			break;
+		}
+		if (slots[i].lastUsed < frame && (best == slots.size() || slots[i].lastUsed < slots[best].lastUsed))
+			best = i;
+	}
+	if (best == slots.size())
+		return false;
+	if (slots[best].tile != NO_TILE)
+		residentTiles.erase(slots[best].tile);
+	slots[best] = { key, frame };
+	residentTiles[key] = (unsigned int)best;
+
+	GLsizei slotSize = header->tileSize + 2 * header->border;
+	GLint x = GLint(best % ATLAS_SLOTS) * slotSize, y = GLint(best / ATLAS_SLOTS) * slotSize;
+	for (unsigned int i = 0; i < atlases.size(); i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, atlases[i]);
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, slotSize, slotSize, header->formats[i], header->layerBytes[i], data);
+		data += header->layerBytes[i];
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	pageTableDirty = true;
+	return true;
+}
+
+void VirtualTexture::rebuildPageTable()
+{
+	// unmapped tiles inherit the entry of their parent, coarsest level first
+	vector<vector<uint32_t>> levels(header->levels);
+	glBindTexture(GL_TEXTURE_2D, pageTable);
+	for (int level = int(header->levels) - 1; level >= 0; level--)
+	{
+		unsigned int columns = tilesX(level), rows = tilesY(level);
+		levels[level].resize(size_t(columns) * rows);
+		for (unsigned int y = 0; y < rows; y++)
+			for (unsigned int x = 0; x < columns; x++)
+			{
+				uint32_t& entry = levels[level][size_t(y) * columns + x];
+				auto resident = residentTiles.find(tileKey(level, x, y));
+				if (resident != residentTiles.end())
+					entry = (resident->second % ATLAS_SLOTS) | ((resident->second / ATLAS_SLOTS) << 8) | (uint32_t(level) << 16) | 0xFF000000u;
+				else if (level + 1 < int(header->levels))
+					entry = levels[level + 1][size_t(y / 2) * tilesX(level + 1) + x / 2];
+				else
+					entry = 0;
+			}
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, columns, rows, GL_RGBA, GL_UNSIGNED_BYTE, levels[level].data());
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	pageTableDirty = false;
+}
+
+void VirtualTexture::update()
+{
+	if (!ready)
+	{
+		if (!opening.valid() || opening.wait_for(chrono::seconds(0)) != future_status::ready)
+			return;
+		if (!opening.get())
+		{
+			cout << "ERROR::VIRTUAL_TEXTURE:: No tile file, the meshes keep their ordinary textures" << endl;
+			return;
+		}
+		createGLObjects();
+		ready = true;
+	}
+	frame++;
+
+	// oldest readback first, one that hasn't landed yet holds back the newer ones
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		unsigned int index = (readbackHead + i) % 3;
+		if (!readbackFences[index])
+			continue;
+		GLenum status = glClientWaitSync(readbackFences[index], 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			break;
+		glDeleteSync(readbackFences[index]);
+		readbackFences[index] = 0;
+		size_t bytes = size_t(feedbackWidth) * feedbackHeight * 4;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[index]);
+		if (const unsigned char* feedback = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT))
+		{
+			requestTiles(feedback, bytes / 4);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	size_t uploads = 0;
+	for (auto load = loading.begin(); load != loading.end() && uploads < MAX_UPLOADS_PER_FRAME;)
+	{
+		if (load->second.wait_for(chrono::seconds(0)) != future_status::ready)
+		{
+			++load;
+			continue;
+		}
+		// a tile that finds no slot is dropped, the feedback asks for it again
+		vector<unsigned char> data = load->second.get();
+		placeTile(load->first, data.data());
+		uploads++;
+		load = loading.erase(load);
+	}
+	if (pageTableDirty)
+		rebuildPageTable();
+}
@@ -0,0 +1,83 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <cstdint>
+#include <future>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Shader.h"
+#include "TextureCook.h"
+#include "ThreadPool.h"
+using namespace std;
+
+// Sparse virtual texture over a tiled cook (see cookVirtualTexture). A low-resolution feedback
+// pass reports which tiles the meshes sample, the workers read them from the tile file and the GL
+// thread copies them into one atlas per layer. The page table texture maps every tile of every mip
+// to its atlas slot, or to the nearest coarser tile that is resident. GL thread only.
+class VirtualTexture
+{
+public:
+    VirtualTexture(ThreadPool& pool);
+    ~VirtualTexture();
+    VirtualTexture(const VirtualTexture&) = delete;
+    VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+    // Cooks (if stale) and maps the tile file on the pool, the GL side is set up by a later update()
+    void open(const vector<VirtualTextureLayer>& layers);
+    bool isReady() const { return ready; }
+
+    // Sets the vt* uniforms and binds the page table and atlases from firstUnit on
+    void bind(Shader* shader, unsigned int firstUnit) const;
+
+    // false while every readback buffer is still in flight
+    bool wantsFeedback() const;
+    // Redirects drawing to the feedback target; draw the tagged meshes with vt_feedback.frag
+    // between the two calls
+    void beginFeedback();
+    void endFeedback();
+
+    // Once per frame: reads back old feedback, requests missing tiles, uploads finished ones
+    void update();
+
+private:
+    struct Slot {
+        uint32_t tile;      // key of the tile it holds, NO_TILE when free
+        unsigned long long lastUsed;
+    };
+
+    ThreadPool& pool;
+    future<bool> opening;
+    bool ready;
+    AssetFile file;
+    const TileFileHeader* header;
+    size_t tileBytes;
+    vector<size_t> levelFirstTile;
+
+    vector<unsigned int> atlases;
+    unsigned int pageTable;
+    vector<Slot> slots;
+    unordered_map<uint32_t, unsigned int> residentTiles;   // tile key -> slot
+    unordered_map<uint32_t, future<vector<unsigned char>>> loading;
+    unsigned long long frame;
+    bool pageTableDirty;
+
+    unsigned int feedbackFBO, feedbackColor, feedbackDepth;
+    int feedbackWidth, feedbackHeight;
+    unsigned int readbackBuffers[3];
+    GLsync readbackFences[3];
+    unsigned int readbackHead;
+    int savedFramebuffer, savedViewport[4];
+
+    void createGLObjects();
+    static uint32_t tileKey(unsigned int level, unsigned int x, unsigned int y);
+    unsigned int tilesX(unsigned int level) const;
+    unsigned int tilesY(unsigned int level) const;
+    const unsigned char* tileData(uint32_t key) const;
+    void requestTiles(const unsigned char* feedback, size_t pixels);
+    bool placeTile(uint32_t key, const unsigned char* data);
+    void rebuildPageTable();
+};
+
+#endif
@@ -33,14 +33,32 @@ struct Light{
 uniform sampler2D ourTexture;
 
 uniform samplerCube depthMap;
-uniform float far_plane;
-uniform bool shadows;
+// the SHADOWS variant samples it
 
-uniform vec3 viewPos;
+// blocks shared by every lit program, filled once per frame by SharedUniforms
+layout (std140) uniform Camera {
+    mat4 pv;
+    vec3 viewPos;
+};
+layout (std140) uniform Frame {
+    float far_plane;
+};
 uniform Material material;
+// as many lights as the scene has with storage buffers (GL 4.3), MAX_LIGHTS otherwise
+#ifdef LIGHTS_IN_STORAGE_BUFFER
+layout (std430, binding = 0) buffer Lights {
+    int lights_count;
+    Light light[];
+};
+#else
 #define MAX_LIGHTS 4
-uniform int lights_count;
-uniform Light light[MAX_LIGHTS];
+layout (std140) uniform Lights {
+    int lights_count;
+    Light light[MAX_LIGHTS];
+};
+#endif
+
+#include "environment.glsl"
 
 float getAtten(int i){//
     float dist = distance(light[i].position, FragPos);
@@ -103,8 +121,12 @@ void main()
     vec3 lresult;
     for (int i = 0; i<lights_count; i++)
     {
-        vec3 ambient = light[i].ambient * material.ambient;    //  
-        float shadow = shadows ? ShadowCalculation(FragPos, i) : 0.0;       
+        vec3 ambient = environmentLit ? vec3(0.0) : light[i].ambient * material.ambient;    //  
+#ifdef SHADOWS
+        float shadow = ShadowCalculation(FragPos, i);
+#else
+        float shadow = 0.0;
+#endif
 
         if (light[i].type == 1) // Directional Light
         {
@@ -143,7 +165,7 @@ void main()
                 }
                 else
                 {
-                    lresult =  material.ambient * light[i].ambient;
+                    lresult = ambient;
                 }
             }
         }
@@ -156,5 +178,11 @@ void main()
     fragColor += texture(ourTexture, texCoords) * vec4(lresult, 1.0f);
 
     }// end of for
+
+    if (environmentLit)
+    {
+        vec3 environment = environmentLight(normalize(vertNormal), FragPos, material.diffuse, material.specular, material.shininess);
+        fragColor += texture(ourTexture, texCoords) * vec4(environment, 0.0);
+    }
     
 }
\ No newline at end of file
@@ -8,7 +8,11 @@ out vec2 texCoords;
 out vec3 vertNormal;
 out vec3 FragPos;
 
-uniform mat4 pv;
+// blocks shared by every lit program, filled once per frame by SharedUniforms
+layout (std140) uniform Camera {
+    mat4 pv;
+    vec3 viewPos;
+};
 uniform mat4 model;
 
 void main()
@@ -0,0 +1,41 @@
+// image-based light of the skybox, shared by the lit fragment shaders through #include (expanded by
+// Shader); goes after the Camera block, environmentLight reads viewPos
+
+// precomputed offline; off until it has been cooked and uploaded
+uniform bool environmentLit = false;
+// irradiance / pi as order 2 spherical harmonics with the basis constants folded in
+uniform vec3 environmentSH[9];
+// GGX-prefiltered radiance, roughness 0 at level 0 up to 1 at environmentMaxLevel
+uniform samplerCube environmentSpecular;
+uniform float environmentMaxLevel;
+uniform float environmentIntensity = 1.0;
+
+vec3 environmentDiffuse(vec3 n)
+{
+    return environmentSH[0]
+        + environmentSH[1] * n.y + environmentSH[2] * n.z + environmentSH[3] * n.x
+        + environmentSH[4] * (n.x * n.y) + environmentSH[5] * (n.y * n.z) + environmentSH[6] * (3.0 * n.z * n.z - 1.0)
+        + environmentSH[7] * (n.x * n.z) + environmentSH[8] * (n.x * n.x - n.y * n.y);
+}
+
+// split-sum environment BRDF fitted analytically (Karis), stands in for the lookup texture
+vec3 environmentBRDF(vec3 specularColor, float roughness, float NdotV)
+{
+    const vec4 c0 = vec4(-1.0, -0.0275, -0.572, 0.022);
+    const vec4 c1 = vec4(1.0, 0.0425, 1.04, -0.04);
+    vec4 r = roughness * c0 + c1;
+    float a004 = min(r.x * r.x, exp2(-9.28 * NdotV)) * r.x + r.y;
+    vec2 AB = vec2(-1.04, 1.04) * a004 + r.zw;
+    return specularColor * AB.x + AB.y;
+}
+
+// diffuse and specular light of the environment at a surface with phong exponent shininess
+vec3 environmentLight(vec3 n, vec3 fragPos, vec3 diffuseColor, vec3 specularColor, float shininess)
+{
+    vec3 v = normalize(viewPos - fragPos);
+    // phong exponent to GGX roughness, the way the levels were cooked (alpha = roughness^2)
+    float roughness = pow(2.0 / (shininess + 2.0), 0.25);
+    vec3 prefiltered = textureLod(environmentSpecular, reflect(-v, n), roughness * environmentMaxLevel).rgb;
+    vec3 specular = prefiltered * environmentBRDF(specularColor, roughness, max(dot(n, v), 0.0));
+    return (environmentDiffuse(n) * diffuseColor + specular) * environmentIntensity;
+}
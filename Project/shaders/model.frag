@@ -27,21 +27,52 @@ struct Light {
     float quadratic;
 };
 
+// as many lights as the scene has with storage buffers (GL 4.3), MAX_LIGHTS otherwise
+#ifdef LIGHTS_IN_STORAGE_BUFFER
+layout (std430, binding = 0) buffer Lights {
+    int lights_count;
+    Light light[];
+};
+#else
 #define MAX_LIGHTS 4
-uniform Light light[MAX_LIGHTS];
-uniform int lights_count;
+layout (std140) uniform Lights {
+    int lights_count;
+    Light light[MAX_LIGHTS];
+};
+#endif
 
 uniform sampler2D texture_diffuse1;
 uniform sampler2D texture_specular1;
 uniform sampler2D texture_normal1;
 uniform float shininess = 64.0f;
 
-uniform vec3 viewPos;
+// blocks shared by every lit program, filled once per frame by SharedUniforms
+layout (std140) uniform Camera {
+    mat4 pv;
+    vec3 viewPos;
+};
+layout (std140) uniform Frame {
+    float far_plane;
+};
+
+#include "environment.glsl"
+
+// meshes tagged virtual sample their albedo and normal through the page table instead
+uniform bool virtualTextured = false;
+uniform sampler2D vtPageTable;
+uniform sampler2D vtAtlas0;
+uniform sampler2D vtAtlas1;
+// virtual width, height, coarsest level, atlas size
+uniform vec4 vtLayout;
+// tile size, border, slot size
+uniform vec3 vtTile;
+
+vec3 albedo;
+vec2 normalXY;
+vec3 normal;
 
 uniform samplerCube depthMap;
-uniform float far_plane;
-uniform bool shadows;
-uniform bool blur;
+// variants: SHADOWS samples the cube shadow map, BLOOM writes the bright pass
 
 //     
 vec3 gridSamplingDisk[20] = vec3[](
@@ -52,6 +83,24 @@ vec3 gridSamplingDisk[20] = vec3[](
    vec3(0, 1,  1), vec3( 0, -1,  1), vec3( 0, -1, -1), vec3( 0, 1, -1)
 );
 
+vec2 vtAtlasCoord(vec2 uv)
+{
+    vec2 texel = uv * vtLayout.xy;
+    vec2 dx = dFdx(texel), dy = dFdy(texel);
+    float level = clamp(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy)))), 0.0, vtLayout.z);
+    uv = fract(uv);
+    vec2 tiles = max(vtLayout.xy / exp2(level) / vtTile.x, vec2(1.0));
+    // slot x, y and the level it holds, coarser than asked while the tile streams in
+    vec4 page = floor(texelFetch(vtPageTable, ivec2(min(floor(uv * tiles), tiles - 1.0)), int(level)) * 255.0 + 0.5);
+    vec2 inTile = fract(uv * vtLayout.xy / (exp2(page.z) * vtTile.x));
+    return (page.xy * vtTile.z + vtTile.y + inTile * vtTile.x) / vtLayout.w;
+}
+
+// the skybox replaces the lights' constant ambient once it is there
+vec3 lightAmbient(int i){
+    return environmentLit ? vec3(0.0) : light[i].ambient * albedo;
+}
+
 float getAtten(int i){
     float dist = distance(light[i].position, f_in.fragPos);
     float attenuation = 1.0 / (light[i].constant + light[i].linear*dist + light[i].quadratic * dist * dist);
@@ -59,12 +108,10 @@ float getAtten(int i){
 }
 
 vec3 CalcDiffusePlusSpecular(int i, vec3 lightDir){
-    vec3 norm = texture(texture_normal1, f_in.texCoords).rgb;
-    norm = normalize(norm * 2.0f - 1.0f);
-    norm = normalize(f_in.TBN * norm);
+    vec3 norm = normal;
     //vec3 norm = normalize(vertNormal);
     float diff_koef = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = light[i].diffuse * diff_koef * vec3(texture(texture_diffuse1, f_in.texCoords));
+    vec3 diffuse = light[i].diffuse * diff_koef * albedo;
 
     // specular
     vec3 reflectDir = reflect(lightDir, norm);
@@ -134,23 +181,43 @@ float ShadowCalculation(vec3 fragPos, int i){
 
 void main()
 {
+    // sampled once up front, the lighting below branches per fragment
+    if (virtualTextured)
+    {
+        vec2 vtCoord = vtAtlasCoord(f_in.texCoords);
+        albedo = textureLod(vtAtlas0, vtCoord, 0.0).rgb;
+        normalXY = textureLod(vtAtlas1, vtCoord, 0.0).rg * 2.0f - 1.0f;
+    }
+    else
+    {
+        albedo = texture(texture_diffuse1, f_in.texCoords).rgb;
+        normalXY = texture(texture_normal1, f_in.texCoords).rg * 2.0f - 1.0f;
+    }
+    // normal maps are cooked to two-channel BC5, rebuild z
+    normal.xy = normalXY;
+    normal.z = sqrt(max(1.0f - dot(normal.xy, normal.xy), 0.0f));
+    normal = normalize(f_in.TBN * normal);
+
     vec3 lresult;
     for (int i = 0; i<lights_count; i++)
     {
-        //float shadow = shadows ? ShadowCalculation(f_in.fragPos, i) : 0.0;
-        float shadow = 0.f;       
+#ifdef SHADOWS
+        float shadow = ShadowCalculation(f_in.fragPos, i);
+#else
+        float shadow = 0.0;
+#endif
         if (light[i].type == 1) // Directional Light
         {
             vec3 lightDir = -light[i].direction;
 
-            vec3 ambient = light[i].ambient * texture(texture_diffuse1, f_in.texCoords).rgb;
+            vec3 ambient = lightAmbient(i);
             vec3 diffspec = CalcDiffusePlusSpecular(i, lightDir);
 
             lresult = ambient + (1.0 - shadow) * diffspec;
         }
         else 
         { 
-            vec3 ambient = light[i].ambient * vec3(texture(texture_diffuse1, f_in.texCoords));
+            vec3 ambient = lightAmbient(i);
             vec3 lightDir = normalize(light[i].position - f_in.fragPos);
             if (light[i].type == 2) // Point Light
             {
@@ -178,16 +245,20 @@ void main()
                 }
                 else
                 {
-                    lresult =  vec3(texture(texture_diffuse1, f_in.texCoords)) * light[i].ambient;
+                    lresult = lightAmbient(i);
                 }
             }
         }
-    if (blur)
-        brightColor += vec4(lresult, 1.0f);
-    else
-        brightColor = vec4(0.0, 0.0, 0.0, 1.0);
+#ifdef BLOOM
+    brightColor += vec4(lresult, 1.0f);
+#else
+    brightColor = vec4(0.0, 0.0, 0.0, 1.0);
+#endif
     
     outColor += vec4(lresult, 1.0f);
 
     }// end of for
+
+    if (environmentLit)
+        outColor += vec4(environmentLight(normal, f_in.fragPos, albedo, texture(texture_specular1, f_in.texCoords).rgb, shininess), 0.0);
 }
\ No newline at end of file
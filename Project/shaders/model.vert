@@ -1,9 +1,9 @@
 #version 330 core
-layout (location = 0) in vec3 inPos;
-layout (location = 1) in vec3 inNormal;
+layout (location = 0) in vec4 inPos;
+layout (location = 1) in vec4 inFrame;
 layout (location = 2) in vec2 inTexCoords;
-layout (location = 3) in vec3 inTangent;
-layout (location = 4) in vec3 inBiTangent;
+// placement of the instance inside the model, only read for instanced meshes
+layout (location = 3) in mat4 inInstance;
 
 out V_OUT {
 out vec2 texCoords;
@@ -12,18 +12,39 @@ out mat3 TBN;
 out vec3 fragPos;
 } vs_out;
 
-uniform mat4 pv;
+// blocks shared by every lit program, filled once per frame by SharedUniforms
+layout (std140) uniform Camera {
+    mat4 pv;
+    vec3 viewPos;
+};
 uniform mat4 model;
+// positions are quantized to the mesh bounds
+uniform vec3 posScale = vec3(1.0);
+uniform vec3 posOffset = vec3(0.0);
+uniform bool instanced = false;
+
+vec3 octDecode(vec2 e)
+{
+	vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-v.z, 0.0);
+	v.x += v.x >= 0.0 ? -t : t;
+	v.y += v.y >= 0.0 ? -t : t;
+	return normalize(v);
+}
 
 void main()
 {
-	vec4 vertPos = model * vec4(inPos, 1.0);
+	vec3 inNormal = octDecode(inFrame.xy);
+	vec3 inTangent = octDecode(inFrame.zw);
+	mat4 world = instanced ? model * inInstance : model;
+	vec4 vertPos = world * vec4(inPos.xyz * posScale + posOffset, 1.0);
 	gl_Position = pv * vertPos;
 	vs_out.texCoords = inTexCoords;
-	vs_out.vertNormal = mat3(model)*inNormal;
+	vs_out.vertNormal = mat3(world)*inNormal;
 	vs_out.fragPos = vertPos.xyz;
-	vec3 T = normalize((model*vec4(inTangent, 0.0f)).xyz);
-	vec3 B = normalize((model*vec4(inBiTangent, 0.0f)).xyz);
-	vec3 N = normalize((model*vec4(inNormal, 0.0f)).xyz);
+	vec3 T = normalize((world*vec4(inTangent, 0.0f)).xyz);
+	vec3 N = normalize((world*vec4(inNormal, 0.0f)).xyz);
+	// bitangent isn't stored, w carries its sign
+	vec3 B = cross(N, T) * (inPos.w < 0.0 ? -1.0 : 1.0);
 	vs_out.TBN = mat3(T,B,N);
 }
\ No newline at end of file
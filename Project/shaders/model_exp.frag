@@ -1,6 +1,10 @@
 #version 330 core
 
+#ifdef NO_GEOMETRY_SHADER
+in V_OUT {
+#else
 in G_OUT {
+#endif
 in vec2 texCoords;
 in vec3 vertNormal;
 in mat3 TBN;
@@ -27,21 +31,39 @@ struct Light {
     float quadratic;
 };
 
+// as many lights as the scene has with storage buffers (GL 4.3), MAX_LIGHTS otherwise
+#ifdef LIGHTS_IN_STORAGE_BUFFER
+layout (std430, binding = 0) buffer Lights {
+    int lights_count;
+    Light light[];
+};
+#else
 #define MAX_LIGHTS 4
-uniform Light light[MAX_LIGHTS];
-uniform int lights_count;
+layout (std140) uniform Lights {
+    int lights_count;
+    Light light[MAX_LIGHTS];
+};
+#endif
 
 uniform sampler2D texture_diffuse1;
 uniform sampler2D texture_specular1;
 uniform sampler2D texture_normal1;
 uniform float shininess = 64.0f;
 
-uniform vec3 viewPos;
+// blocks shared by every lit program, filled once per frame by SharedUniforms
+layout (std140) uniform Camera {
+    mat4 pv;
+    vec3 viewPos;
+};
+layout (std140) uniform Frame {
+    float far_plane;
+};
+
+#include "environment.glsl"
 
 uniform samplerCube depthMap;
-uniform float far_plane;
-uniform bool shadows;
-uniform bool blur;
+// variants: SHADOWS samples the cube shadow map, BLOOM writes the bright pass,
+// NO_GEOMETRY_SHADER reads the vertex stage when the ISS isn't exploding
 
 //     
 vec3 gridSamplingDisk[20] = vec3[](
@@ -52,6 +74,19 @@ vec3 gridSamplingDisk[20] = vec3[](
    vec3(0, 1,  1), vec3( 0, -1,  1), vec3( 0, -1, -1), vec3( 0, 1, -1)
 );
 
+// the skybox replaces the lights' constant ambient once it is there
+vec3 lightAmbient(int i){
+    return environmentLit ? vec3(0.0) : light[i].ambient * texture(texture_diffuse1, f_in.texCoords).rgb;
+}
+
+// normal maps are cooked to two-channel BC5, rebuild z
+vec3 mappedNormal(){
+    vec3 norm;
+    norm.xy = texture(texture_normal1, f_in.texCoords).rg * 2.0f - 1.0f;
+    norm.z = sqrt(max(1.0f - dot(norm.xy, norm.xy), 0.0f));
+    return normalize(f_in.TBN * norm);
+}
+
 float getAtten(int i){
     float dist = distance(light[i].position, f_in.fragPos);
     float attenuation = 1.0 / (light[i].constant + light[i].linear*dist + light[i].quadratic * dist * dist);
@@ -59,9 +94,7 @@ float getAtten(int i){
 }
 
 vec3 CalcDiffusePlusSpecular(int i, vec3 lightDir){
-    vec3 norm = texture(texture_normal1, f_in.texCoords).rgb;
-    norm = normalize(norm * 2.0f - 1.0f);
-    norm = normalize(f_in.TBN * norm);
+    vec3 norm = mappedNormal();
     //vec3 norm = normalize(vertNormal);
     float diff_koef = max(dot(norm, lightDir), 0.0);
     vec3 diffuse = light[i].diffuse * diff_koef * vec3(texture(texture_diffuse1, f_in.texCoords));
@@ -137,20 +170,23 @@ void main()
     vec3 lresult;
     for (int i = 0; i<lights_count; i++)
     {
-        //float shadow = shadows ? ShadowCalculation(f_in.fragPos, i) : 0.0;
-        float shadow = 0.f;       
+#ifdef SHADOWS
+        float shadow = ShadowCalculation(f_in.fragPos, i);
+#else
+        float shadow = 0.0;
+#endif
         if (light[i].type == 1) // Directional Light
         {
             vec3 lightDir = -light[i].direction;
 
-            vec3 ambient = light[i].ambient * texture(texture_diffuse1, f_in.texCoords).rgb;
+            vec3 ambient = lightAmbient(i);
             vec3 diffspec = CalcDiffusePlusSpecular(i, lightDir);
 
             lresult = ambient + (1.0 - shadow) * diffspec;
         }
         else 
         { 
-            vec3 ambient = light[i].ambient * vec3(texture(texture_diffuse1, f_in.texCoords));
+            vec3 ambient = lightAmbient(i);
             vec3 lightDir = normalize(light[i].position - f_in.fragPos);
             if (light[i].type == 2) // Point Light
             {
@@ -178,16 +214,21 @@ void main()
                 }
                 else
                 {
-                    lresult =  vec3(texture(texture_diffuse1, f_in.texCoords)) * light[i].ambient;
+                    lresult = lightAmbient(i);
                 }
             }
         }
-    if (blur)
-        brightColor += vec4(lresult, 1.0f);
-    else
-        brightColor = vec4(0.0, 0.0, 0.0, 1.0);
+#ifdef BLOOM
+    brightColor += vec4(lresult, 1.0f);
+#else
+    brightColor = vec4(0.0, 0.0, 0.0, 1.0);
+#endif
     
     outColor += vec4(lresult, 1.0f);
 
     }// end of for
+
+    if (environmentLit)
+        outColor += vec4(environmentLight(mappedNormal(), f_in.fragPos, texture(texture_diffuse1, f_in.texCoords).rgb,
+            texture(texture_specular1, f_in.texCoords).rgb, shininess), 0.0);
 }
\ No newline at end of file
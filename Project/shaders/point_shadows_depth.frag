@@ -2,7 +2,10 @@
 in vec4 FragPos;
 
 uniform vec3 lightPos;
-uniform float far_plane;
+// shared with the lit programs, see SharedUniforms
+layout (std140) uniform Frame {
+    float far_plane;
+};
 
 void main()
 {
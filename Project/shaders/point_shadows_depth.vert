@@ -1,10 +1,17 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+// placement of the instance inside the model, only read for instanced meshes
+layout (location = 3) in mat4 aInstance;
 
 uniform mat4 model;
+// identity for float geometry, mesh bounds for quantized positions
+uniform vec3 posScale = vec3(1.0);
+uniform vec3 posOffset = vec3(0.0);
+uniform bool instanced = false;
 
 void main()
 {
-    gl_Position = model * vec4(aPos, 1.0);
+    mat4 world = instanced ? model * aInstance : model;
+    gl_Position = world * vec4(aPos * posScale + posOffset, 1.0);
 }
 
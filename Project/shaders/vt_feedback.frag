@@ -0,0 +1,28 @@
+#version 330 core
+
+in V_OUT {
+in vec2 texCoords;
+in vec3 vertNormal;
+in mat3 TBN;
+in vec3 fragPos;
+} f_in;
+
+layout (location = 0) out vec4 feedback;
+
+// virtual width, height, coarsest level, atlas size
+uniform vec4 vtLayout;
+// tile size, border, slot size
+uniform vec3 vtTile;
+// the target is smaller than the screen, so derivatives come out that many levels too coarse
+uniform float vtFeedbackBias;
+
+// the tile the main pass will want here: x, y and level, alpha marks covered pixels
+void main()
+{
+    vec2 texel = f_in.texCoords * vtLayout.xy;
+    vec2 dx = dFdx(texel), dy = dFdy(texel);
+    float level = clamp(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) - vtFeedbackBias), 0.0, vtLayout.z);
+    vec2 tiles = max(vtLayout.xy / exp2(level) / vtTile.x, vec2(1.0));
+    vec2 tile = min(floor(fract(f_in.texCoords) * tiles), tiles - 1.0);
+    feedback = vec4(tile, level, 255.0) / 255.0;
+}